@@ -0,0 +1,339 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "async_save.slc"
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+  TITLE: Asynchronous Saving
+  OVERVIEW: Saves FileBuffers on a worker thread, so that slow filesystems
+    (where fsync() in particular can take seconds) never freeze the
+    editor. See $y_FileBuffer_save_asynchronously.
+
+  NOTES: Threading
+    As with multi-buffer search, the worker must never touch objects or
+    symbols, nor allocate GC memory. The save snapshots the line array on the
+    main thread; since the lines themselves are immutable wstrings, copying
+    the array of pointers is enough, and the AsyncSave keeps the snapshot
+    alive. Everything else the worker needs is copied into a malloc()ed job.
+    The worker reports the outcome (an errno value, or zero) through a pipe,
+    which the AsyncSave consumes through the kernel loop.
+
+    The worker writes to "NAME#save" rather than the autosave file, since the
+    main thread may write the latter at any time while the save is in
+    progress. Once it has written the outcome, the worker closes its end of
+    the pipe; if the outcome could not be written, the AsyncSave thus reads
+    end-of-file instead, and reports the save as failed rather than waiting
+    forever.
+ */
+
+struct save_job {
+  const wstring* lines;
+  unsigned nlines;
+  // All malloc()ed
+  char* basename, * bakname, * tmpname;
+  mode_t default_mode;
+  bool fsync, backup;
+  int output;
+};
+
+static char* cstrdup(string str) {
+  return strcpy(xmalloc(strlen(str) + 1), str);
+}
+
+/* Writes the lines of the job to its temporary file, then moves it into
+ * place as described by $f_FileBuffer_save. Returns 0 on success, or the
+ * errno of the step that failed.
+ */
+static int save_file(const struct save_job* job) {
+  FILE* output = fopen(job->tmpname, "w");
+  struct stat orig_info;
+  bool orig_exists;
+  mode_t mode;
+  int err;
+
+  if (!output)
+    return errno;
+
+  for (unsigned i = 0; i < job->nlines; ++i)
+    if (-1 == fprintf(output, "%ls\n", job->lines[i]))
+      goto fail;
+
+  if (fflush(output))
+    goto fail;
+
+  if (-1 != stat(job->basename, &orig_info)) {
+    mode = orig_info.st_mode;
+    orig_exists = true;
+  } else if (errno == ENOENT) {
+    mode = job->default_mode;
+    orig_exists = false;
+  } else {
+    goto fail;
+  }
+
+  if (-1 == fchmod(fileno(output), mode))
+    goto fail;
+
+  if (job->fsync && -1 == fsync(fileno(output)))
+    goto fail;
+
+  if (fclose(output)) {
+    output = NULL;
+    goto fail;
+  }
+  output = NULL;
+
+  if (job->backup && orig_exists && -1 == rename(job->basename, job->bakname))
+    goto fail;
+
+  if (-1 == rename(job->tmpname, job->basename))
+    goto fail;
+
+  return 0;
+
+  fail:
+  err = errno;
+  if (output)
+    fclose(output);
+  unlink(job->tmpname);
+  return err;
+}
+
+static void* save_worker(void* vjob) {
+  struct save_job* job = vjob;
+  // The job may be freed as soon as the outcome has been read
+  int output = job->output;
+  int result = save_file(job);
+  if (!write_fully(output, &result, sizeof(result)))
+    // Closing the pipe regardless still tells the AsyncSave that we're done
+    perror("write");
+  close(output);
+  return NULL;
+}
+
+static void free_job(struct save_job* job) {
+  free(job->basename);
+  free(job->bakname);
+  free(job->tmpname);
+  free(job);
+}
+
+/*
+  SYMBOL: $c_AsyncSave
+    Consumer which saves $o_AsyncSave_buffer on a worker thread. The buffer is
+    snapshotted when the object is constructed, but the worker only starts
+    from $f_run_tasks, once the transaction which constructed it can no longer
+    be rolled back; it destroys itself once the outcome has been reported. It
+    is normally created by $f_FileBuffer_save when
+    $y_FileBuffer_save_asynchronously is true, rather than directly.
+
+  SYMBOL: $o_AsyncSave_buffer
+    The FileBuffer being saved.
+
+  SYMBOL: $o_AsyncSave_transcript
+    The Transcript in which the outcome of the save is reported; that current
+    when the save started. The kernel calls Consumers outside of any
+    Workspace, so there would otherwise be nowhere to show it.
+
+  SYMBOL: $aw_AsyncSave_snapshot
+    A copy of the line array of the buffer at the time the save started, which
+    is what the worker writes.
+
+  SYMBOL: $I_AsyncSave_undo_offset
+    The undo offset of the buffer at the time of the snapshot. Once the save is
+    durable, this becomes the buffer's $I_FileBuffer_saved_undo_offset.
+
+  SYMBOL: $p_AsyncSave_job
+    The struct save_job shared with the worker thread, or NULL if the worker
+    has not been started.
+
+  SYMBOL: $i_AsyncSave_output
+    The write end of the pipe whose read end is $i_Consumer_fd, through which
+    the worker reports the outcome of the save. Once the worker has been
+    started, it belongs to the worker, which closes it.
+
+  SYMBOL: $o_FileBuffer_pending_save
+    The AsyncSave currently saving this FileBuffer, if any.
+
+  SYMBOL: $y_FileBuffer_save_asynchronously
+    If true, $f_FileBuffer_save snapshots the buffer and hands writing,
+    fsync()ing and renaming the file to a worker thread. The buffer remains
+    modified until the save is durable, at which point it becomes unmodified
+    (if it has not been edited in the meantime) and a notice is shown;
+    failures are reported as error messages, since the transaction which
+    started the save has long since committed.
+ */
+subclass($c_Consumer, $c_AsyncSave)
+STATIC_INIT_TO($y_FileBuffer_save_asynchronously, false)
+
+static void close_pipe(void* vpipes) {
+  int* pipes = vpipes;
+  close(pipes[0]);
+  close(pipes[1]);
+}
+
+defun($h_AsyncSave) {
+  object buffer = $o_AsyncSave_buffer;
+  dynar_w snapshot;
+  unsigned undo_offset;
+  int pipes[2];
+
+  $$(buffer) {
+    if ($o_FileBuffer_pending_save)
+      tx_rollback_merrno($u_AsyncSave, 0,
+                         "A save of this buffer is already in progress");
+
+    $m_access();
+    snapshot = dynar_clone_w($aw_FileBuffer_contents);
+    undo_offset = $I_FileBuffer_undo_offset;
+  }
+
+  if (-1 == pipe(pipes))
+    tx_rollback_errno($u_AsyncSave);
+  fcntl(pipes[0], F_SETFL, O_NONBLOCK);
+  // The pipe is the only thing which would outlive a rollback; the worker
+  // isn't started until the transaction has committed.
+  tx_push_undo(close_pipe, memcpy(gcalloc_atomic(sizeof(pipes)),
+                                  pipes, sizeof(pipes)));
+
+  $o_AsyncSave_transcript = $o_Transcript;
+  $aw_AsyncSave_snapshot = snapshot;
+  $I_AsyncSave_undo_offset = undo_offset;
+  $i_Consumer_fd = pipes[0];
+  $i_AsyncSave_output = pipes[1];
+  lpush_o($$lo_unstarted_saves, $o_AsyncSave);
+  $$(buffer)
+    $o_FileBuffer_pending_save = $o_AsyncSave;
+}
+
+/* Starts the worker thread for the AsyncSave in the current context. Since
+ * there is no transaction to roll back at this point, a failure is written to
+ * the pipe in place of the worker's outcome (and the pipe closed, as the
+ * worker would), and so reported by $f_AsyncSave_read like any other.
+ */
+static void start_worker(void) {
+  object buffer = $o_AsyncSave_buffer;
+  struct save_job* job = xmalloc(sizeof(struct save_job));
+  pthread_t thread;
+  int err;
+
+  if (!job) {
+    err = ENOMEM;
+    goto fail;
+  }
+  memset(job, 0, sizeof(struct save_job));
+
+  $$(buffer) {
+    job->basename = cstrdup(wstrtocstr($w_FileBuffer_filename));
+    job->bakname = cstrdup(wstrtocstr(wstrap($w_FileBuffer_filename, L"~")));
+    job->tmpname =
+      cstrdup(wstrtocstr(wstrap($w_FileBuffer_filename, L"#save")));
+    job->default_mode = $I_FileBuffer_default_file_mode;
+    job->fsync = !$y_FileBuffer_suppress_fsync_on_save;
+    job->backup = !$y_FileBuffer_suppress_backup;
+  }
+
+  job->lines = $aw_AsyncSave_snapshot->v;
+  job->nlines = $aw_AsyncSave_snapshot->len;
+  job->output = $i_AsyncSave_output;
+
+  if ((err = pthread_create(&thread, NULL, save_worker, job))) {
+    free_job(job);
+    goto fail;
+  }
+  pthread_detach(thread);
+
+  $p_AsyncSave_job = job;
+  return;
+
+  fail:
+  if (!write_fully($i_AsyncSave_output, &err, sizeof(err)))
+    // The AsyncSave will read end-of-file instead, which is also a failure
+    perror("write");
+  close($i_AsyncSave_output);
+}
+
+advise_after($h_run_tasks) {
+  list_o saves = $$lo_unstarted_saves;
+  $$lo_unstarted_saves = NULL;
+
+  while (saves) {
+    object save = lpop_o(saves);
+    $$(save) start_worker();
+  }
+}
+
+/*
+  SYMBOL: $f_AsyncSave_read
+    Takes the outcome of the save from the worker. On success, marks the
+    buffer as saved as of the snapshot; otherwise (including if the worker
+    closed the pipe without reporting anything), it is an error. The outcome
+    is reported within $o_AsyncSave_transcript, and the AsyncSave then
+    destroys itself.
+ */
+defun($h_AsyncSave_read) {
+  int err;
+  ssize_t nread = read($i_Consumer_fd, &err, sizeof(err));
+  if (nread == -1 && (errno == EAGAIN || errno == EINTR))
+    return;
+  if (nread != sizeof(err))
+    err = nread == -1? errno : EIO;
+
+  object buffer = $o_AsyncSave_buffer, transcript = $o_AsyncSave_transcript;
+  unsigned undo_offset = $I_AsyncSave_undo_offset;
+  wstring message;
+  $$(buffer) {
+    $o_FileBuffer_pending_save = NULL;
+    if (!err) {
+      $I_FileBuffer_saved_undo_offset = undo_offset;
+      $y_FileBuffer_modified =
+        ($I_FileBuffer_undo_offset != $I_FileBuffer_saved_undo_offset);
+      // Any autosave file is now redundant, unless there are newer edits
+      if (!$y_FileBuffer_modified)
+        unlink(wstrtocstr(wstrap($w_FileBuffer_filename, L"#")));
+      $m_saved();
+
+      message = wstrap(L"Saved ", $w_FileBuffer_filename);
+    } else {
+      message = wstrap(wstrap(L"Could not save ", $w_FileBuffer_filename),
+                       wstrap(L": ", cstrtowstr(strerror(err))));
+    }
+  }
+
+  if (transcript) {
+    $$(transcript) {
+      if (err)
+        $F_message_error(0,0, $w_message_text = message);
+      else
+        $F_message_notice(0,0, $w_message_text = message);
+    }
+  }
+
+  close($i_Consumer_fd);
+  if ($p_AsyncSave_job)
+    free_job($p_AsyncSave_job);
+  $p_AsyncSave_job = NULL;
+  $aw_AsyncSave_snapshot = NULL;
+  $m_destroy();
+}
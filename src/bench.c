@@ -0,0 +1,180 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  TITLE: Benchmark Harness
+  OVERVIEW: Runs the benchmarks defined throughout the program with
+    defbench() against a headless Terminal, and reports the throughput and
+    allocation behaviour of each. This is invoked with `sol --bench`, or
+    `make bench`.
+*/
+
+#include "bench.slc"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "cmdline.h"
+
+typedef struct {
+  string name, description;
+  void (*run)(unsigned);
+} benchmark;
+
+void bind_benchmark(string name, string description,
+                    void (*run)(unsigned)) {
+  benchmark* bench = new(benchmark);
+  bench->name = name;
+  bench->description = description;
+  bench->run = run;
+  $$lp_benchmarks = cons_p(bench, $$lp_benchmarks);
+}
+
+/*
+  SYMBOL: $o_bench_terminal
+    The headless Terminal on which all benchmarks run.
+
+  SYMBOL: $I_bench_min_ms
+    The minimum duration, in milliseconds, of the measured portion of a
+    benchmark run. The number of iterations is doubled until a run takes at
+    least this long.
+ */
+STATIC_INIT_TO($I_bench_min_ms, 500)
+
+static unsigned long long start_ns, stop_ns;
+static unsigned long start_allocs, stop_allocs;
+static size_t start_bytes, stop_bytes;
+static unsigned long start_gcs, stop_gcs;
+static bool stopped;
+
+void bench_start(void) {
+  stopped = false;
+  start_allocs = gcalloc_count;
+  start_bytes = GC_get_total_bytes();
+  start_gcs = GC_get_gc_no();
+  start_ns = now_ns();
+}
+
+void bench_stop(void) {
+  if (stopped) return;
+
+  stop_ns = now_ns();
+  stop_allocs = gcalloc_count;
+  stop_bytes = GC_get_total_bytes();
+  stop_gcs = GC_get_gc_no();
+  stopped = true;
+}
+
+string bench_write_file(unsigned lines) {
+  static char template[] = "/tmp/sol-bench-XXXXXX";
+  char* filename = gcstrdup(template);
+  int fd = mkstemp(filename);
+  FILE* out = -1 == fd? NULL : fdopen(fd, "w");
+  if (!out) {
+    perror("creating benchmark file");
+    exit(1);
+  }
+
+  for (unsigned i = 0; i < lines; ++i)
+    fprintf(out, "Line %u of the benchmark file, followed by some text.\n", i);
+
+  fclose(out);
+  return filename;
+}
+
+object bench_buffer(unsigned lines) {
+  string filename = bench_write_file(lines);
+  object buffer = $c_FileBuffer($w_FileBuffer_filename = cstrtowstr(filename));
+  $M_access(0, buffer);
+  unlink(filename);
+  return buffer;
+}
+
+object bench_workspace(void) {
+  object workspace;
+  $$($o_bench_terminal) {
+    workspace = $c_TopLevel();
+    $$(workspace) {
+      $o_Terminal_current_view =
+        $c_View($o_View_terminal = $o_bench_terminal,
+                $o_View_workspace = workspace);
+    }
+    $M_redraw(0, $o_Terminal_current_view);
+  }
+  bench_keys(L"");
+  return workspace;
+}
+
+void bench_keys(wstring keys) {
+  $M_feed(0, $o_bench_terminal, $w_Terminal_feed = keys);
+  $M_read(0, $o_bench_terminal);
+  $M_flush(0, $o_bench_terminal);
+  arena_reset();
+}
+
+static void run_benchmark(benchmark* bench) {
+  unsigned iterations = 1;
+  unsigned long long elapsed;
+
+  for (;;) {
+    bench_start();
+    bench->run(iterations);
+    bench_stop();
+
+    elapsed = stop_ns - start_ns;
+    if (elapsed >= $I_bench_min_ms * 1000000ULL || iterations >= 1u << 30)
+      break;
+
+    iterations *= 2;
+  }
+
+  printf("%-16s %12.1f ops/s %10.1f allocs/op %12.1f bytes/op %6lu GCs\n",
+         bench->name,
+         iterations * 1.0e9 / (elapsed? elapsed : 1),
+         (stop_allocs - start_allocs) / (double)iterations,
+         (stop_bytes - start_bytes) / (double)iterations,
+         stop_gcs - start_gcs);
+  printf("                 (%s; %u iterations)\n",
+         bench->description, iterations);
+  fflush(stdout);
+}
+
+def_cmdline_arg(-, bench, none,
+                "Run the benchmarks without a terminal, print their results, "
+                "and exit.") {
+  $o_bench_terminal = $c_Terminal($y_Terminal_headless = true);
+  if (!$($o_bench_terminal, $y_Terminal_ok)) {
+    perror("initialising headless terminal");
+    exit(1);
+  }
+
+  // Workspaces assume that at least one buffer always exists, and would
+  // otherwise fail when a benchmark destroys its own.
+  $c_FileBuffer($w_FileBuffer_filename = L"*scratch*",
+                $y_FileBuffer_memory_backed = true);
+
+  $$lp_benchmarks = lrev_p($$lp_benchmarks);
+  for (list_p curr = $$lp_benchmarks; curr; curr = curr->cdr)
+    run_benchmark(curr->car);
+
+  $M_destroy(0, $o_bench_terminal);
+  exit(0);
+}
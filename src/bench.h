@@ -0,0 +1,84 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef BENCH_H_
+#define BENCH_H_
+
+/**
+ * Usage: defbench(name, "description") { (* body *) }
+ *
+ * Defines a benchmark, which is run by `sol --bench` (and thus `make
+ * bench`). The body has a single parameter, `unsigned iterations`, and must
+ * perform the operation being measured that many times; the harness
+ * increases the count until the run takes long enough to measure reliably.
+ *
+ * Benchmarks run against a headless Terminal (see $y_Terminal_headless), so
+ * no tty is needed. Setup which should not be measured should precede a
+ * call to bench_start(), and teardown should follow a call to bench_stop().
+ */
+#define defbench(name, description)                             \
+  static void bench_##name(unsigned);                           \
+  ATSINIT {                                                     \
+    bind_benchmark(#name, description, bench_##name);           \
+  }                                                             \
+  static void bench_##name(unsigned iterations)
+
+/**
+ * Registers a benchmark. You probably want the defbench() macro above.
+ */
+void bind_benchmark(string name, string description, void (*)(unsigned));
+
+/**
+ * Begins (or restarts) measurement of the current benchmark run.
+ */
+void bench_start(void);
+
+/**
+ * Ends measurement of the current benchmark run. If not called, measurement
+ * ends when the benchmark returns.
+ */
+void bench_stop(void);
+
+/**
+ * Writes a temporary file containing the given number of lines of text, and
+ * returns its name. The caller is responsible for unlinking it. Line N
+ * (counting from zero) begins with "Line N ".
+ */
+string bench_write_file(unsigned lines);
+
+/**
+ * Returns a new FileBuffer whose contents are those written by
+ * bench_write_file(lines), already loaded into memory.
+ */
+object bench_buffer(unsigned lines);
+
+/**
+ * Creates a new TopLevel Workspace, showing the most recently created
+ * FileBuffer, and makes it the current view of the benchmark Terminal.
+ * Returns the Workspace.
+ */
+object bench_workspace(void);
+
+/**
+ * Processes the given keys as if they had been typed into the benchmark
+ * Terminal, then refreshes the screen and ends the kernel cycle (as far as
+ * the transient arena is concerned).
+ */
+void bench_keys(wstring keys);
+
+#endif /* BENCH_H_ */
@@ -17,10 +17,16 @@
   along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "buffer_editor.slc"
+#include <unistd.h>
 
 #include "face.h"
 #include "interactive.h"
 #include "key_dispatch.h"
+#include "trigram_index.h"
+#include "streamed_lines.h"
+#include "file_buffer.h"
+#include "gap_buffer.h"
+#include "bench.h"
 
 /*
   TITLE: Buffer Editor
@@ -148,8 +154,7 @@ defun($h_BufferEditor_get_echo_area_contents) {
   $$($o_BufferEditor_buffer) $$($o_BufferEditor_point) {
     $m_access();
 
-    if ($I_FileBufferCursor_line_number <
-        $aw_FileBuffer_contents->len) {
+    if ($I_FileBufferCursor_line_number < fb_len()) {
       $q_Workspace_echo_area_contents =
         $M_cvt($q_RenderedLine_cvt,
                $M_format($lo_BufferEditor_format, 0,
@@ -363,12 +368,13 @@ defun($h_BufferLineEditor_get_echo_area_meta) {
     Whether the BufferLineEditor will replace a line, or insert a new one.
  */
 defun($h_BufferLineEditor_accept) {
-  list_w replacements = NULL;
-  mwstring line = wcalloc($az_LineEditor_buffer->len + 1);
-  wmemcpy(line, $az_LineEditor_buffer->v, $az_LineEditor_buffer->len);
+  // Pastes may consist of a great many lines, so they are collected into a
+  // dynar and passed as bulk replacements.
+  dynar_w replacements = dynar_new_w();
+  mwstring line = gb_text($p_LineEditor_buffer);
   if (!wcschr(line, L'\n')) {
     // Simple single-line insertion
-    replacements = cons_w(line, NULL);
+    dynar_push_w(replacements, line);
   } else {
     //This is a multiple-line edit, since there are line feeds embedded in the
     //line
@@ -378,9 +384,7 @@ defun($h_BufferLineEditor_accept) {
          subline;
          subline = wcstok(NULL, L"\n", &state))
       // It's OK to continue pointing to the modified string
-      lpush_w(replacements, subline);
-
-    replacements = lrev_w(replacements);
+      dynar_push_w(replacements, subline);
   }
   unsigned line_number = $($o_BufferLineEditor_cursor, $I_FileBufferCursor_line_number);
 
@@ -392,11 +396,12 @@ defun($h_BufferLineEditor_accept) {
   }
   $M_edit(0, $o_BufferLineEditor_buffer,
           $I_FileBuffer_ndeletions = ($y_BufferLineEditor_replace? 1:0),
-          $lw_FileBuffer_replacements = replacements,
+          $lw_FileBuffer_replacements = NULL,
+          $aw_FileBuffer_bulk_replacements = replacements,
           $I_FileBuffer_edit_line = line_number);
   // If echo is on, output the new line to the Transcript
   if (($v_LineEditor_echo_mode ?: $v_Workspace_echo_mode) == $u_echo_on) {
-    unsigned cnt = llen_w(replacements);
+    unsigned cnt = replacements->len;
     for (unsigned i = 0; i < cnt; ++i)
       $M_echo_line(0, $o_BufferLineEditor_parent,
                    $I_BufferEditor_index = line_number+i);
@@ -432,8 +437,13 @@ defun($h_BufferEditor_insert_blank_line_above) {
  */
 defun($h_BufferEditor_insert_blank_line_below) {
   unsigned where = $($o_BufferEditor_point, $I_FileBufferCursor_line_number);
-  $M_access(0, $o_BufferEditor_buffer);
-  if (where < $($o_BufferEditor_buffer, $aw_FileBuffer_contents)->len) {
+  unsigned len;
+  $$($o_BufferEditor_buffer) {
+    $m_access();
+    len = fb_len();
+  }
+
+  if (where < len) {
     $M_edit(0, $o_BufferEditor_buffer,
             $I_FileBuffer_ndeletions = 0,
             $lw_FileBuffer_replacements = cons_w(L"", NULL),
@@ -458,13 +468,13 @@ defun($h_BufferEditor_edit_current) {
     unsigned where = $($o_BufferEditor_point,
                        $I_FileBufferCursor_line_number);
     wstring text = L"";
-    if (where < $aw_FileBuffer_contents->len)
-      text = $aw_FileBuffer_contents->v[where];
+    if (where < fb_len())
+      text = fb_line(where);
     // We need to temporarily NULL our keybindings so that the BufferLineEditor
     // doesn't inherit them.
     $c_BufferLineEditor($w_LineEditor_text = text,
                         $y_BufferLineEditor_replace =
-                          (where < $aw_FileBuffer_contents->len));
+                          (where < fb_len()));
   }
 }
 
@@ -523,7 +533,7 @@ defun($h_BufferEditor_forward_line) {
   $$($o_BufferEditor_point) $$($o_BufferEditor_buffer) {
     $m_access();
     unsigned dist = accelerate_max(&$I_LastCommand_forward_line,
-                                   $aw_FileBuffer_contents->len -
+                                   fb_len() -
                                    $I_FileBufferCursor_line_number);
     $I_FileBufferCursor_line_number += dist;
   }
@@ -575,10 +585,10 @@ defun($h_BufferEditor_kill_forward_line) {
   $$($o_BufferEditor_buffer) {
     $m_access();
     $$($o_BufferEditor_point) {
-      if ($I_FileBufferCursor_line_number != $aw_FileBuffer_contents->len) {
+      if ($I_FileBufferCursor_line_number != fb_len()) {
         $F_l_kill(0,0,
                   $lw_kill = cons_w(
-                    $aw_FileBuffer_contents->v[$I_FileBufferCursor_line_number],
+                    fb_line($I_FileBufferCursor_line_number),
                     NULL),
                   $v_kill_direction = $u_forward);
         $M_edit(0,0,
@@ -601,7 +611,7 @@ defun($h_BufferEditor_kill_backward_line) {
       if ($I_FileBufferCursor_line_number) {
         $F_l_kill(0,0,
                   $lw_kill = cons_w(
-                    $aw_FileBuffer_contents->v[$I_FileBufferCursor_line_number-1],
+                    fb_line($I_FileBufferCursor_line_number-1),
                     NULL),
                   $v_kill_direction = $u_backward);
         $M_edit(0,0,
@@ -634,7 +644,7 @@ defun($h_BufferEditor_end) {
     $m_access();
     $$($o_BufferEditor_point) {
       let($i_FileBufferCursor_shunt_distance,
-          $aw_FileBuffer_contents->len -
+          fb_len() -
             $I_FileBufferCursor_line_number);
       $m_shunt();
     }
@@ -657,7 +667,7 @@ defun($h_BufferEditor_show_forward_line) {
     $$($o_BufferEditor_point) {
       unsigned offset = $($o_prev_command, $I_LastCommand_show_forward_line_off);
       unsigned cnt = accelerate_max(&$I_LastCommand_show_forward_line,
-                                    $aw_FileBuffer_contents->len -
+                                    fb_len() -
                                       $I_FileBufferCursor_line_number -
                                       offset);
 
@@ -759,8 +769,7 @@ defun($h_BufferEditor_echo_line) {
 defun($h_BufferEditor_format) {
   // Get the base RenderedLine
   object base = $c_RenderedLine(
-    $q_RenderedLine_body = wstrtoqstr($aw_FileBuffer_contents->v[
-                                        $I_BufferEditor_index]),
+    $q_RenderedLine_body = wstrtoqstr(fb_line($I_BufferEditor_index)),
     $q_RenderedLine_meta = NULL);
 
   // Apply syntax highlighting, etc
@@ -875,7 +884,7 @@ defun($h_BufferEditor_digit_input) {
 
   $$($o_BufferEditor_buffer) {
     $m_access();
-    max = $aw_FileBuffer_contents->len;
+    max = fb_len();
   }
 
   if (($x_Terminal_input_value < L'0' || $x_Terminal_input_value > L'9') &&
@@ -955,7 +964,7 @@ defun($h_BufferEditor_reset_mark) {
   unsigned max = 0;
   $$($o_BufferEditor_buffer) {
     $m_access();
-    max = $aw_FileBuffer_contents->len;
+    max = fb_len();
   }
 
   $$($lo_BufferEditor_marks->car) {
@@ -1078,8 +1087,8 @@ defun($h_BufferEditor_print_region) {
   $lo_BufferEditor_format = NULL;
   $$($o_BufferEditor_buffer) {
     $m_access();
-    if (end > $aw_FileBuffer_contents->len)
-      end = $aw_FileBuffer_contents->len;
+    if (end > fb_len())
+      end = fb_len();
 
     for (signed i = end-1; i >= start; --i) {
       $M_format(0,0, $I_BufferEditor_index = i);
@@ -1104,7 +1113,7 @@ defun($h_BufferEditor_print_region_and_advance) {
   unsigned max = 0;
   $$($o_BufferEditor_buffer) {
     $m_access();
-    max = $aw_FileBuffer_contents->len;
+    max = fb_len();
   }
 
   bool advance_mark = false;
@@ -1160,34 +1169,49 @@ defun($h_BufferEditor_search) {
   object pattern = $c_Pattern($w_Pattern_pattern = $w_BufferEditor_search);
   int start_line = $($o_BufferEditor_point, $I_FileBufferCursor_line_number);
 
+  // Streamed buffers are read through their window; since the search
+  // proceeds a line at a time, each block of the file is read once.
   dynar_w contents;
+  streamed_lines* stream;
+  trigram_index* index;
+  unsigned len;
   $$($o_BufferEditor_buffer) {
-    $m_access();
+    $m_build_trigram_index();
     contents = $aw_FileBuffer_contents;
+    stream = $p_FileBuffer_stream;
+    index = $p_FileBuffer_trigram_index;
+    len = fb_len();
   }
 
+  // Lines lacking any of the pattern's required literals can be skipped
+  // without running the full matcher
+  tgi_query query = {{0}};
+  if (index)
+    each_w($(pattern, $lw_Pattern_literals),
+           lambdav((wstring literal), tgi_query_add(&query, literal)));
+
   // Just do nothing if this buffer is empty
-  if (!contents->len)
+  if (!len)
     return;
 
   // Prevent "starting" past the end
-  if (start_line == contents->len)
+  if (start_line == len)
     --start_line;
 
   // If starting on the virtual line at the end of the file, pretend that we
   // started one before that.
-  if ($i_BufferEditor_search == contents->len)
-    $i_BufferEditor_search = contents->len-1;
+  if ($i_BufferEditor_search == len)
+    $i_BufferEditor_search = len-1;
 
   int line = start_line + $i_BufferEditor_search;
   bool wrapped = false;
   while (true) {
     // Wrap if necessary
-    wrapped |= (line < 0 || line >= contents->len);
+    wrapped |= (line < 0 || line >= len);
     if (line < 0)
-      line += contents->len;
+      line += len;
     else
-      line %= contents->len;
+      line %= len;
 
     if (line == start_line) {
       // Search failed
@@ -1197,8 +1221,10 @@ defun($h_BufferEditor_search) {
       return;
     }
 
-    if ($M_matches($y_Pattern_matches, pattern,
-                   $w_Pattern_input = contents->v[line])) {
+    if ((!index || tgi_may_match(index, line, &query)) &&
+        $M_matches($y_Pattern_matches, pattern,
+                   $w_Pattern_input = stream?
+                     sl_line(stream, line) : contents->v[line])) {
       // Success; move mark and point, and display this line
       $I_BufferEditor_move_point_to = line;
       $I_BufferEditor_move_mark_to = start_line;
@@ -1339,3 +1365,31 @@ ATSINIT {
   bind_char($lp_BufferEditor_keymap, $u_meta, L'Y', $v_end_meta,
             $m_redo);
 }
+
+defbench(search, "Search a 20000-line buffer, alternating between two hits") {
+  object buffer = bench_buffer(20000);
+  bench_workspace();
+
+  bench_start();
+  for (unsigned i = 0; i < iterations; ++i)
+    bench_keys(L"g9999\r");
+  bench_stop();
+
+  $M_destroy(0, buffer);
+}
+
+defbench(streamed_search,
+         "Search a streamed 200000-line file, alternating between two hits") {
+  string filename = bench_write_file(200000);
+  object buffer = $c_FileBuffer($w_FileBuffer_filename = cstrtowstr(filename),
+                                $y_FileBuffer_streamed = true);
+  bench_workspace();
+
+  bench_start();
+  for (unsigned i = 0; i < iterations; ++i)
+    bench_keys(L"g99999\r");
+  bench_stop();
+
+  $M_destroy(0, buffer);
+  unlink(filename);
+}
@@ -0,0 +1,274 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "chunked_lines.slc"
+
+#include "chunked_lines.h"
+
+/*
+  TITLE: Chunked Line Storage
+  OVERVIEW: Provides the chunked_lines, the representation of the lines of a
+    Backing, which keeps them in fixed-size chunks so that edits and growth of
+    very long Backings (such as Transcripts of verbose processes) never need to
+    move or copy the whole array. Insertions take their lines as a list, as
+    they arrive in $lo_Backing_replacements.
+*/
+
+chunked_lines* cl_new(void) {
+  chunked_lines* this = new(chunked_lines);
+  this->chunks_size = 4;
+  this->chunks = gcalloc(this->chunks_size * sizeof(line_chunk*));
+  this->ends = gcalloc(this->chunks_size * sizeof(unsigned));
+  this->chunks[0] = new(line_chunk);
+  this->nchunks = 1;
+  return this;
+}
+
+unsigned cl_find(chunked_lines* this, unsigned ix) {
+  unsigned lo = 0, hi = this->nchunks - 1;
+  while (lo < hi) {
+    unsigned mid = (lo + hi) / 2;
+    if (this->ends[mid] <= ix)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return this->cursor = lo;
+}
+
+/* Recomputes ends[] and len from the given chunk onward. */
+static void cl_recount(chunked_lines* this, unsigned from) {
+  unsigned total = from? this->ends[from-1] : 0;
+  for (unsigned i = from; i < this->nchunks; ++i)
+    this->ends[i] = total += this->chunks[i]->len;
+  this->len = total;
+}
+
+/* Inserts cnt new, empty chunks before the chunk at index at. ends[] is not
+ * updated.
+ */
+static void cl_open_chunks(chunked_lines* this, unsigned at, unsigned cnt) {
+  if (this->nchunks + cnt > this->chunks_size) {
+    this->chunks_size *= 2;
+    if (this->chunks_size < this->nchunks + cnt)
+      this->chunks_size = this->nchunks + cnt;
+
+    this->chunks = gcrealloc(this->chunks,
+                             this->chunks_size * sizeof(line_chunk*));
+    this->ends = gcrealloc(this->ends, this->chunks_size * sizeof(unsigned));
+  }
+
+  memmove(this->chunks + at + cnt, this->chunks + at,
+          (this->nchunks - at) * sizeof(line_chunk*));
+  for (unsigned i = 0; i < cnt; ++i)
+    this->chunks[at + i] = new(line_chunk);
+  this->nchunks += cnt;
+  this->cursor = 0;
+}
+
+/* Removes cnt chunks beginning at index at. ends[] is not updated. */
+static void cl_close_chunks(chunked_lines* this, unsigned at, unsigned cnt) {
+  memmove(this->chunks + at, this->chunks + at + cnt,
+          (this->nchunks - at - cnt) * sizeof(line_chunk*));
+  this->nchunks -= cnt;
+  memset(this->chunks + this->nchunks, 0, cnt * sizeof(line_chunk*));
+  this->cursor = 0;
+}
+
+/* Merges the chunk after the one at index c into it if their lines fit in a
+ * single chunk. Returns whether it did so. ends[] is not updated.
+ */
+static bool cl_coalesce(chunked_lines* this, unsigned c) {
+  if (c + 1 >= this->nchunks) return false;
+
+  line_chunk* dst = this->chunks[c], * src = this->chunks[c+1];
+  if (dst->len + src->len > CL_CHUNK_SIZE) return false;
+
+  memcpy(dst->v + dst->len, src->v, src->len * sizeof(object));
+  dst->len += src->len;
+  cl_close_chunks(this, c+1, 1);
+  return true;
+}
+
+void cl_push(chunked_lines* this, object line) {
+  unsigned c = this->nchunks - 1;
+  if (this->chunks[c]->len == CL_CHUNK_SIZE) {
+    cl_open_chunks(this, ++c, 1);
+    this->ends[c] = this->len;
+  }
+
+  line_chunk* chunk = this->chunks[c];
+  chunk->v[chunk->len++] = line;
+  ++this->ends[c];
+  ++this->len;
+}
+
+void cl_insert(chunked_lines* this, unsigned off, list_o lines) {
+  if (off == this->len) {
+    for (; lines; lines = lines->cdr)
+      cl_push(this, lines->car);
+    return;
+  }
+
+  if (!lines) return;
+
+  unsigned cnt = llen_o(lines);
+  unsigned c = cl_find(this, off);
+  line_chunk* chunk = this->chunks[c];
+  unsigned o = off - (c? this->ends[c-1] : 0);
+
+  if (chunk->len + cnt <= CL_CHUNK_SIZE) {
+    memmove(chunk->v + o + cnt, chunk->v + o,
+            (chunk->len - o) * sizeof(object));
+    for (; lines; lines = lines->cdr)
+      chunk->v[o++] = lines->car;
+    chunk->len += cnt;
+  } else {
+    // Move the lines after the insertion point into a chunk of their own,
+    // then fill this chunk and as many new ones as needed in between.
+    unsigned tail = chunk->len - o;
+    unsigned nfill = (o + cnt + CL_CHUNK_SIZE - 1) / CL_CHUNK_SIZE;
+    cl_open_chunks(this, c+1, nfill - 1 + !!tail);
+    if (tail) {
+      line_chunk* dst = this->chunks[c + nfill];
+      memcpy(dst->v, chunk->v + o, tail * sizeof(object));
+      dst->len = tail;
+      memset(chunk->v + o, 0, tail * sizeof(object));
+    }
+    chunk->len = o;
+
+    unsigned dc = c;
+    for (; lines; lines = lines->cdr) {
+      if (this->chunks[dc]->len == CL_CHUNK_SIZE)
+        ++dc;
+      chunk = this->chunks[dc];
+      chunk->v[chunk->len++] = lines->car;
+    }
+
+    if (tail && !cl_coalesce(this, dc))
+      ++dc;
+    cl_coalesce(this, dc);
+  }
+
+  cl_recount(this, c);
+}
+
+void cl_delete(chunked_lines* this, unsigned off, unsigned cnt) {
+  if (!cnt) return;
+
+  unsigned c = cl_find(this, off);
+  line_chunk* chunk = this->chunks[c];
+  unsigned o = off - (c? this->ends[c-1] : 0);
+
+  // Trim the first affected chunk
+  unsigned n = chunk->len - o;
+  if (n > cnt) n = cnt;
+  memmove(chunk->v + o, chunk->v + o + n,
+          (chunk->len - o - n) * sizeof(object));
+  chunk->len -= n;
+  memset(chunk->v + chunk->len, 0, n * sizeof(object));
+  cnt -= n;
+
+  // Drop chunks which are deleted entirely, and trim the head of the last one
+  unsigned nwhole = 0;
+  while (cnt && this->chunks[c + 1 + nwhole]->len <= cnt)
+    cnt -= this->chunks[c + 1 + nwhole++]->len;
+
+  if (cnt) {
+    chunk = this->chunks[c + 1 + nwhole];
+    memmove(chunk->v, chunk->v + cnt, (chunk->len - cnt) * sizeof(object));
+    chunk->len -= cnt;
+    memset(chunk->v + chunk->len, 0, cnt * sizeof(object));
+  }
+
+  cl_close_chunks(this, c+1, nwhole);
+
+  // Don't let the edit leave empty or sparse chunks behind
+  if (!this->chunks[c]->len && this->nchunks > 1)
+    cl_close_chunks(this, c, 1);
+  else
+    cl_coalesce(this, c);
+  if (c)
+    cl_coalesce(this, c-1);
+
+  cl_recount(this, c? c-1 : 0);
+}
+
+/* Checks the structural invariants of the chunked_lines, and that its
+ * contents match the first len elements of expected.
+ */
+static inline void cl_check(chunked_lines* this,
+                            const object* expected, unsigned len) {
+  unsigned total = 0;
+  assert(this->nchunks >= 1);
+  for (unsigned i = 0; i < this->nchunks; ++i) {
+    assert(this->chunks[i]->len <= CL_CHUNK_SIZE);
+    assert(this->chunks[i]->len || 1 == this->nchunks);
+    total += this->chunks[i]->len;
+    assert(total == this->ends[i]);
+  }
+
+  assert(total == cl_len(this));
+  assert(len == cl_len(this));
+  for (unsigned i = 0; i < len; ++i)
+    assert(expected[i] == cl_at(this, i));
+}
+
+deftest(chunked_lines_edits) {
+  chunked_lines* lines = cl_new();
+  object* expected = gcalloc(65536 * sizeof(object));
+  unsigned len = 0, next = 1, seed = 1;
+
+  // Line identities only need to be distinct and never dereferenced
+  #define LINE() ((object)(size_t)(next++ * sizeof(void*)))
+
+  for (; len < 3000; ++len)
+    cl_push(lines, expected[len] = LINE());
+  cl_check(lines, expected, len);
+
+  for (unsigned i = 0; i < 200; ++i) {
+    seed = seed * 1103515245 + 12345;
+    unsigned off = (seed >> 8) % (len + 1);
+    seed = seed * 1103515245 + 12345;
+    unsigned cnt = (seed >> 8) % (i & 1? 8 : 1200);
+
+    if (i % 3) {
+      list_o ins = NULL;
+      memmove(expected + off + cnt, expected + off,
+              (len - off) * sizeof(object));
+      for (unsigned j = 0; j < cnt; ++j)
+        ins = cons_o(expected[off + cnt - j - 1] = LINE(), ins);
+      len += cnt;
+      cl_insert(lines, off, ins);
+    } else {
+      if (cnt > len - off) cnt = len - off;
+      memmove(expected + off, expected + off + cnt,
+              (len - off - cnt) * sizeof(object));
+      len -= cnt;
+      cl_delete(lines, off, cnt);
+    }
+
+    cl_check(lines, expected, len);
+  }
+
+  cl_delete(lines, 0, len);
+  cl_check(lines, expected, 0);
+
+  #undef LINE
+}
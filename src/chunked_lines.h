@@ -0,0 +1,114 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef CHUNKED_LINES_H_
+#define CHUNKED_LINES_H_
+
+/**
+ * The maximum number of lines held by a single chunk of a chunked_lines.
+ */
+#define CL_CHUNK_SIZE 512
+
+/**
+ * A fixed-capacity block of lines within a chunked_lines.
+ */
+typedef struct line_chunk {
+  unsigned len;
+  object v[CL_CHUNK_SIZE];
+} line_chunk;
+
+/**
+ * An array of objects (in practice, RenderedLines) stored as a sequence of
+ * fixed-capacity chunks, as used for the lines of a Backing. Growing the
+ * array never copies more than the table of chunks, and insertions and
+ * deletions in the middle only move lines within the chunks they touch, plus
+ * the table of cumulative line counts, so they cost time proportional to
+ * CL_CHUNK_SIZE plus the number of chunks, rather than to the number of lines
+ * after the edit.
+ *
+ * ends[i] is the total number of lines in chunks[0..i]. There is always at
+ * least one chunk; only the sole chunk of an empty array may be empty. cursor
+ * is the index of the chunk most recently accessed, which makes sequential
+ * access (as when painting a View) constant-time.
+ *
+ * Instances are allocated on the heap with the GC.
+ */
+typedef struct chunked_lines {
+  unsigned len, nchunks, chunks_size, cursor;
+  line_chunk** chunks;
+  unsigned* ends;
+} chunked_lines;
+
+/**
+ * Creates a new, empty chunked_lines.
+ */
+chunked_lines* cl_new(void);
+
+/**
+ * Returns the number of lines in the chunked_lines.
+ */
+static inline unsigned cl_len(const chunked_lines* this) {
+  return this->len;
+}
+
+/**
+ * Returns the index of the chunk containing the line at the given index,
+ * which must be less than cl_len(), and makes it the cursor.
+ */
+unsigned cl_find(chunked_lines*, unsigned ix);
+
+/**
+ * Returns a pointer to the slot holding the line at the given index, which
+ * must be less than cl_len(). The pointer is invalidated by any structural
+ * change to the chunked_lines.
+ */
+static inline object* cl_slot(chunked_lines* this, unsigned ix) {
+  unsigned c = this->cursor;
+  unsigned begin = c? this->ends[c-1] : 0;
+  if (ix < begin || ix >= this->ends[c]) {
+    c = cl_find(this, ix);
+    begin = c? this->ends[c-1] : 0;
+  }
+
+  return this->chunks[c]->v + (ix - begin);
+}
+
+/**
+ * Returns the line at the given index, which must be less than cl_len().
+ */
+static inline object cl_at(chunked_lines* this, unsigned ix) {
+  return *cl_slot(this, ix);
+}
+
+/**
+ * Appends a line to the end of the chunked_lines.
+ */
+void cl_push(chunked_lines*, object);
+
+/**
+ * Inserts the elements of the given list before the line at index off (which
+ * may be equal to cl_len() to append), in the order they occur in the list.
+ */
+void cl_insert(chunked_lines*, unsigned off, list_o);
+
+/**
+ * Deletes cnt lines beginning at index off.
+ */
+void cl_delete(chunked_lines*, unsigned off, unsigned cnt);
+
+#endif /* CHUNKED_LINES_H_ */
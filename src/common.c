@@ -42,11 +42,15 @@
 #include <assert.h>
 #include <errno.h>
 #include <setjmp.h>
+#include <time.h>
+#include <unistd.h>
 
 // Formerly known as $$ao_evisceration_stack
 // (This comment necessary for the dynar_o template)
 static dynar_o evisceration_stack;
 
+unsigned long gcalloc_count;
+
 char* gcstrdup(const char* str) {
   size_t len = strlen(str)+1;
   char* dst = gcalloc(len);
@@ -85,6 +89,135 @@ mstring wstrtocstr(wstring str) {
   }
 }
 
+unsigned long long now_ns(void) {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts))
+    return 0;
+
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool write_fully(int fd, const void* data, size_t size) {
+  const char* curr = data;
+  while (size) {
+    ssize_t nwritten = write(fd, curr, size);
+    if (-1 == nwritten) {
+      if (EINTR == errno) continue;
+      return false;
+    }
+
+    curr += nwritten;
+    size -= nwritten;
+  }
+
+  return true;
+}
+
+/**
+ * The transient arena is a list of large chunks, each of which is allocated
+ * uncollectable so that the GC scans it for pointers without ever tracing or
+ * reclaiming it. Allocation bumps the used counter of the current chunk,
+ * moving on to (or creating) the next chunk when it is exhausted; resetting
+ * simply rewinds every chunk.
+ */
+typedef union {
+  long double ld;
+  long long ll;
+  void* p;
+} arena_align_t;
+
+typedef struct arena_chunk {
+  struct arena_chunk* next;
+  size_t size, used;
+  arena_align_t data[];
+} arena_chunk;
+
+#define ARENA_CHUNK_SIZE 65536
+#define ARENA_ALIGN(sz) \
+  (((sz) + sizeof(arena_align_t) - 1) & ~(sizeof(arena_align_t) - 1))
+#ifdef DEBUG
+#define ARENA_POISON 0xA5
+#else
+#define ARENA_POISON 0
+#endif
+
+static arena_chunk* arena_head, * arena_curr;
+
+void* arena_alloc(size_t size) {
+  size = ARENA_ALIGN(size ?: 1);
+
+  while (!arena_curr || arena_curr->size - arena_curr->used < size) {
+    if (arena_curr && arena_curr->next) {
+      arena_curr = arena_curr->next;
+      continue;
+    }
+
+    size_t chunk_size = size > ARENA_CHUNK_SIZE? size : ARENA_CHUNK_SIZE;
+    arena_chunk* chunk = GC_MALLOC_UNCOLLECTABLE(
+      sizeof(arena_chunk) + chunk_size);
+    if (!chunk) {
+      fprintf(stderr, "Out of memory");
+      exit(255);
+    }
+    chunk->size = chunk_size;
+    chunk->used = 0;
+    chunk->next = NULL;
+
+    if (arena_curr)
+      arena_curr->next = chunk;
+    else
+      arena_head = chunk;
+    arena_curr = chunk;
+  }
+
+  void* ret = (char*)arena_curr->data + arena_curr->used;
+  arena_curr->used += size;
+#ifdef DEBUG
+  // Undo the poison left by arena_reset()
+  memset(ret, 0, size);
+#endif
+  return ret;
+}
+
+void arena_reset(void) {
+  for (arena_chunk* chunk = arena_head; chunk; chunk = chunk->next) {
+    // Clear (or poison) what was used so that stale pointers neither keep
+    // garbage alive nor look valid.
+    memset(chunk->data, ARENA_POISON, chunk->used);
+    chunk->used = 0;
+  }
+
+  arena_curr = arena_head;
+}
+
+bool arena_owns(const void* ptr) {
+  for (arena_chunk* chunk = arena_head; chunk; chunk = chunk->next)
+    if ((const char*)ptr >= (const char*)chunk->data &&
+        (const char*)ptr < (const char*)chunk->data + chunk->used)
+      return true;
+
+  return false;
+}
+
+deftest(arena_alloc_and_reset) {
+  arena_reset();
+
+  unsigned* small = arena_alloc(sizeof(unsigned));
+  char* large = arena_alloc(3 * ARENA_CHUNK_SIZE);
+  assert(!*small);
+  assert(!large[3 * ARENA_CHUNK_SIZE - 1]);
+  // Both allocations must be usable in full
+  *small = 42;
+  memset(large, 1, 3 * ARENA_CHUNK_SIZE);
+  assert(arena_owns(small));
+  assert(arena_owns(large + ARENA_CHUNK_SIZE));
+  assert(!arena_owns(gcalloc(1)));
+
+  arena_reset();
+  assert(!arena_owns(small));
+  assert(!arena_owns(large));
+}
+
 /**
  * Objects are stored in two parts: A hashtable of entries, and a data section
  * storing the values of the implanted symbols at the time of the last
@@ -117,6 +250,8 @@ struct object_t {
   /* Stored data and data bookkeeping */
   unsigned data_end, data_size;
   unsigned char* data;
+  /* Set by the class constructor macros; only used for profiling. */
+  string class_name;
 };
 
 static inline unsigned ptrhash(void* v) {
@@ -193,6 +328,10 @@ object object_new(object parent) {
   return this;
 }
 
+void object_set_class_name(object this, string name) {
+  this->class_name = name;
+}
+
 object object_clone(object that) {
   object_writeback(that);
 
@@ -247,8 +386,10 @@ static void symbol_push_ownership(object,
                                   struct object_implant_hashtable_entry*);
 static void symbol_pop_ownership(object this,
                                  struct object_implant_hashtable_entry*);
+static void profile_evisceration(object);
 void object_eviscerate(object this) {
   if (this->parent) object_eviscerate(this->parent);
+  if (hook_profiling) profile_evisceration(this);
 
   ++this->evisceration_count;
 
@@ -482,6 +623,92 @@ void object_get_implanted_value(void* dst, object this,
   memcpy(dst, sym->payload, sym->size);
 }
 
+void object_get_implanted_value_cached(void* dst, object this,
+                                       struct symbol_header* sym,
+                                       unsigned* cache) {
+  if (sym->owner_stack && sym->owner_stack->owner == this) {
+    memcpy(dst, sym->payload, sym->size);
+    return;
+  }
+
+  /* Entries are never removed from an implantation table in place (tables are
+   * replaced wholesale on expansion and transaction rollback), so if the
+   * cached slot holds this symbol, its offset is valid for this object.
+   */
+  struct object_implant_hashtable* implants = this->implants;
+  unsigned ix = *cache;
+  if (ix >= implants->table_size || implants->entries[ix].sym != sym) {
+    ix = object_find_hashtable_entry(this, sym);
+    if (!implants->entries[ix].sym) {
+      // Not implanted here; the uncached search handles the rest of the chain
+      if (this->parent)
+        object_get_implanted_value(dst, this->parent, sym);
+      else
+        memcpy(dst, sym->payload, sym->size);
+      return;
+    }
+
+    *cache = ix;
+  }
+
+  memcpy(dst, this->data + implants->entries[ix].offset, sym->size);
+}
+
+deftest(implanted_value_lookup_cache) {
+  object a = object_new(NULL), b = object_new(NULL);
+  object child = object_new(a), neither = object_new(NULL);
+  $$(a) {
+    implant($$i_lookup_cache_test);
+    $$i_lookup_cache_test = 1;
+  }
+  $$(b) {
+    implant($$i_lookup_cache_test);
+    $$i_lookup_cache_test = 2;
+  }
+  $$i_lookup_cache_test = 3;
+
+  object objects[] = { a, b, a, child, neither, b };
+  signed expected[] = { 1, 2, 1, 1, 3, 2 };
+  unsigned mismatches = 0;
+  // All lookups must go through the same call site to exercise the cache
+  for (unsigned i = 0; i < lenof(objects); ++i)
+    if (expected[i] != $(objects[i], $$i_lookup_cache_test))
+      ++mismatches;
+  assert(!mismatches);
+
+  $$(a) {
+    assert(1 == $(a, $$i_lookup_cache_test));
+    $$i_lookup_cache_test = 4;
+    assert(4 == $(a, $$i_lookup_cache_test));
+  }
+  assert(4 == $(a, $$i_lookup_cache_test));
+}
+
+deftest(hashmap_put_get_del) {
+  object keys[1000];
+  $$mo_hashmap_test = hashmap_new_o();
+  for (unsigned i = 0; i < lenof(keys); ++i) {
+    keys[i] = object_new(NULL);
+    hashmap_put_o($$mo_hashmap_test, keys[i], keys[i]);
+  }
+  hashmap_put_o($$mo_hashmap_test, keys[0], keys[1]);
+  assert(lenof(keys) == $$mo_hashmap_test->len);
+
+  // Deleting must not break the probe runs of the survivors
+  for (unsigned i = 0; i < lenof(keys); i += 3)
+    assert(hashmap_del_o($$mo_hashmap_test, keys[i]));
+  assert(!hashmap_del_o($$mo_hashmap_test, keys[0]));
+
+  unsigned mismatches = 0;
+  for (unsigned i = 0; i < lenof(keys); ++i) {
+    object* value = hashmap_get_o($$mo_hashmap_test, keys[i]);
+    if (i % 3? !value || keys[i] != *value : !!value)
+      ++mismatches;
+  }
+  assert(!mismatches);
+  assert(lenof(keys) - (lenof(keys)+2)/3 == $$mo_hashmap_test->len);
+}
+
 static void clone_hook_chain(struct hook_point_entry** base) {
   if (!*base) return;
 
@@ -544,6 +771,15 @@ static void sort_hook_functions(struct hook_point_entry** base) {
   }
 }
 
+/* Until all advice has been installed at startup, hook chains are neither
+ * cloned (nothing can be running them yet) nor sorted on every addition.
+ * Instead, each modified chain is flagged in its hook point and recorded
+ * here, and sort_startup_hooks() sorts each exactly once.
+ */
+static bool hooks_installed;
+static list_p unsorted_hook_points;
+unsigned startup_hooks_added, startup_chains_sorted;
+
 static void del_hook_impl(struct hook_point*,
                           unsigned, identity, object);
 void add_hook_obj_cond(struct hook_point* point, unsigned priority,
@@ -552,7 +788,8 @@ void add_hook_obj_cond(struct hook_point* point, unsigned priority,
                        void (*fun)(void), object context,
                        hook_constraint_function constraints) {
   // Copy the current chain in case we are currently sharing it
-  clone_hook_chain(&point->entries[priority]);
+  if (hooks_installed)
+    clone_hook_chain(&point->entries[priority]);
   // Remove any existing
   del_hook_impl(point, priority, id, context);
   struct hook_point_entry hpe = {
@@ -566,7 +803,36 @@ void add_hook_obj_cond(struct hook_point* point, unsigned priority,
   };
   point->entries[priority] = newdup(&hpe);
 
-  sort_hook_functions(&point->entries[priority]);
+  if (hooks_installed) {
+    sort_hook_functions(&point->entries[priority]);
+  } else {
+    ++startup_hooks_added;
+    if (!point->unsorted)
+      lpush_p(unsorted_hook_points, point);
+    point->unsorted |= 1 << priority;
+  }
+}
+
+ATSTART(sort_startup_hooks, HOOK_SORTING_PRIORITY) {
+  for (list_p it = unsorted_hook_points; it; it = it->cdr) {
+    struct hook_point* point = it->car;
+    for (unsigned priority = 0; priority < lenof(point->entries); ++priority) {
+      if (point->unsorted & (1 << priority)) {
+        sort_hook_functions(&point->entries[priority]);
+        ++startup_chains_sorted;
+      }
+    }
+    point->unsorted = 0;
+  }
+
+  unsorted_hook_points = NULL;
+  hooks_installed = true;
+}
+
+void add_hooks(const struct hook_registration* regs, unsigned count) {
+  for (unsigned i = 0; i < count; ++i)
+    add_hook(regs[i].point, regs[i].priority, regs[i].id, regs[i].class,
+             regs[i].fun, regs[i].constraints);
 }
 
 void add_hook(struct hook_point* point, unsigned priority,
@@ -627,6 +893,175 @@ void del_hooks_of_id(struct hook_point* point, unsigned priority, identity id) {
       base = &(*base)->next;
 }
 
+/**
+ * Profile entries live in an open-addressed hashtable keyed by their kind,
+ * name, and identity. Names are compared by content, since silc emits the
+ * same class name as a separate literal in every translation unit that uses
+ * it, and these are only merged when the compiler chooses to; identities are
+ * compared by address.
+ *
+ * Timing uses a stack of frames parallel to the native stack. Since hooks may
+ * be exited by longjmp (eg, on transaction rollback), frames are not popped
+ * individually; instead, each profiled invoke_hook() unwinds the stack back to
+ * the depth at which it started, charging any frames abandoned above it with
+ * the time up to that point.
+ */
+bool hook_profiling;
+
+static hook_profile_entry** profile_table;
+static unsigned profile_table_size, profile_count;
+
+typedef struct {
+  hook_profile_entry* entry;
+  unsigned long long start_ns, child_ns;
+} profile_frame;
+static profile_frame* profile_stack;
+static unsigned profile_depth, profile_stack_size;
+
+static unsigned profile_hash(enum hook_profile_kind kind,
+                             string name, identity id) {
+  unsigned hash = 5381;
+  if (name)
+    for (string curr = name; *curr; ++curr)
+      hash = hash*33 + (unsigned char)*curr;
+
+  return hash ^ (ptrhash(id) * 31) ^ kind;
+}
+
+static bool profile_names_equal(string a, string b) {
+  return a == b || (a && b && !strcmp(a, b));
+}
+
+static void profile_insert(hook_profile_entry* entry) {
+  unsigned mask = profile_table_size - 1;
+  unsigned ix = profile_hash(entry->kind, entry->name, entry->id) & mask;
+  while (profile_table[ix])
+    ix = (ix+1) & mask;
+  profile_table[ix] = entry;
+}
+
+static hook_profile_entry* profile_lookup(enum hook_profile_kind kind,
+                                          string name, identity id) {
+  unsigned mask = profile_table_size - 1;
+  for (unsigned ix = profile_hash(kind, name, id) & mask;
+       profile_table[ix]; ix = (ix+1) & mask) {
+    hook_profile_entry* entry = profile_table[ix];
+    if (entry->kind == kind && entry->id == id &&
+        profile_names_equal(entry->name, name))
+      return entry;
+  }
+
+  // Not found; keep the table at most half full
+  if (2*(profile_count+1) > profile_table_size) {
+    hook_profile_entry** old = profile_table;
+    unsigned old_size = profile_table_size;
+    profile_table_size *= 2;
+    profile_table = gcalloc(profile_table_size * sizeof(hook_profile_entry*));
+    for (unsigned i = 0; i < old_size; ++i)
+      if (old[i])
+        profile_insert(old[i]);
+  }
+
+  hook_profile_entry* entry = new(hook_profile_entry);
+  entry->kind = kind;
+  entry->name = name;
+  entry->id = id;
+  profile_insert(entry);
+  ++profile_count;
+  return entry;
+}
+
+static unsigned profile_push(hook_profile_entry* entry) {
+  if (profile_depth == profile_stack_size) {
+    profile_stack_size = profile_stack_size? 2*profile_stack_size : 64;
+    profile_stack = gcrealloc(profile_stack,
+                              profile_stack_size * sizeof(profile_frame));
+  }
+
+  ++entry->calls;
+  profile_frame frame = {
+    .entry = entry,
+    .start_ns = now_ns(),
+    .child_ns = 0,
+  };
+  profile_stack[profile_depth] = frame;
+  return profile_depth++;
+}
+
+static void profile_unwind(unsigned depth) {
+  if (profile_depth <= depth) return;
+
+  unsigned long long now = now_ns();
+  while (profile_depth > depth) {
+    profile_frame* frame = &profile_stack[--profile_depth];
+    unsigned long long inclusive = now - frame->start_ns;
+    frame->entry->inclusive_ns += inclusive;
+    if (inclusive > frame->child_ns)
+      frame->entry->exclusive_ns += inclusive - frame->child_ns;
+    if (profile_depth)
+      profile_stack[profile_depth-1].child_ns += inclusive;
+  }
+}
+
+static void profile_evisceration(object this) {
+  hook_profile_entry* entry =
+    profile_lookup(HookProfileClass, this->class_name, NULL);
+  ++entry->calls;
+  entry->symbols += this->implants->num_entries;
+}
+
+void hook_profile_start(void) {
+  profile_table_size = 256;
+  profile_table = gcalloc(profile_table_size * sizeof(hook_profile_entry*));
+  profile_count = 0;
+  // Any frames still on the stack belong to the previous profile
+  profile_depth = 0;
+  hook_profiling = true;
+}
+
+void hook_profile_stop(void) {
+  hook_profiling = false;
+}
+
+hook_profile_entry** hook_profile_entries(unsigned* count) {
+  hook_profile_entry** entries =
+    gcalloc((profile_count? profile_count : 1) * sizeof(hook_profile_entry*));
+  *count = 0;
+  for (unsigned i = 0; i < profile_table_size; ++i)
+    if (profile_table[i])
+      entries[(*count)++] = profile_table[i];
+
+  return entries;
+}
+
+deftest(hook_profile_counts_calls) {
+  static struct hook_point point;
+  static unsigned invocations;
+  void f(void) { ++invocations; }
+
+  point.name = "test_hook";
+  add_hook(&point, HOOK_MAIN, (identity)f, NULL, f, NULL);
+
+  hook_profile_start();
+  invoke_hook(&point);
+  invoke_hook(&point);
+  hook_profile_stop();
+  invoke_hook(&point);
+
+  unsigned count, found = 0;
+  hook_profile_entry** entries = hook_profile_entries(&count);
+  for (unsigned i = 0; i < count; ++i) {
+    if (entries[i]->name != point.name) continue;
+
+    ++found;
+    assert(2 == entries[i]->calls);
+    assert(entries[i]->inclusive_ns >= entries[i]->exclusive_ns);
+  }
+
+  assert(2 == found);
+  assert(3 == invocations);
+}
+
 static sigjmp_buf hook_abort_point;
 void hook_abort(void) {
   siglongjmp(hook_abort_point, 1);
@@ -650,6 +1085,12 @@ void invoke_hook(struct hook_point* ppoint) {
   memcpy(old_abort_point, hook_abort_point, sizeof(hook_abort_point));
   memcpy(old_continue_point, hook_continue_point, sizeof(hook_continue_point));
 
+  // Profiling state is fixed for the whole invocation, so that toggling it
+  // from within a hook does not leave the frame stack unbalanced.
+  bool profiled = hook_profiling;
+  unsigned profile_base = profiled?
+    profile_push(profile_lookup(HookProfileHook, ppoint->name, NULL)) : 0;
+
   // Save this location; if it returns non-zero, the hook was aborted
   if (sigsetjmp(hook_abort_point, 1)) goto end;
 
@@ -668,12 +1109,26 @@ void invoke_hook(struct hook_point* ppoint) {
       // if sigsetjmp() returns 0 (ie, continue_hook_in_current_context() was
       // not called).
       if ((!curr->when || *curr->when) && !sigsetjmp(hook_continue_point, 1)) {
+        if (profiled) {
+          // Close the frame of the previous function if it did not return
+          // normally
+          profile_unwind(profile_base+1);
+          hook_profile_entry* entry =
+            profile_lookup(HookProfileAdvice, point.name, curr->id);
+          entry->fun = curr->fun;
+          profile_push(entry);
+        }
         within_context(curr->context, curr->fun());
+        if (profiled)
+          profile_unwind(profile_base+1);
       }
     }
   }
 
   end:
+  if (profiled)
+    profile_unwind(profile_base);
+
   // Restore old hooks
   memcpy(hook_abort_point, old_abort_point, sizeof(hook_abort_point));
   memcpy(hook_continue_point, old_continue_point, sizeof(hook_continue_point));
@@ -715,6 +1170,17 @@ void add_symbol_to_domain(struct symbol_header* sym,
   *dom = newdup(&entry);
 }
 
+void add_symbols_to_domains(const struct domain_registration* regs,
+                            unsigned count) {
+  for (unsigned i = 0; i < count; ++i)
+    add_symbol_to_domain(regs[i].sym, regs[i].domain, regs[i].implant_type);
+}
+
+void implant_symbols(struct symbol_header*const* syms, unsigned count) {
+  for (unsigned i = 0; i < count; ++i)
+    object_implant(syms[i], ImplantSingle);
+}
+
 ATSTART(eviscerate_root_object, ROOT_OBJECT_EVISCERATION_PRIORITY) {
   evisceration_stack = dynar_new_o();
   $o_root = object_new(NULL);
@@ -728,6 +1194,11 @@ void on_each_o(list_o these, void (*f)(void)) {
 
 // So we get the list_o and list_p templates: $$lo_unused $$lp_unused
 
+struct tx_undo {
+  void (*fun)(void*);
+  void* arg;
+};
+
 typedef struct transaction {
   //The unique identifier for this transaction
   unsigned id;
@@ -737,6 +1208,8 @@ typedef struct transaction {
   list_o objects_touched;
   //A list of void (*)(void) to invoke on (before) rollback
   list_p rollback_handlers;
+  //A list of struct tx_undo* recorded by tx_push_undo(), most recent first
+  list_p undos;
   //Function to call to exit the transaction on rollback
   void (*exit_function)(void);
 
@@ -774,6 +1247,7 @@ void tx_start(void (*exit_function)(void)) {
     .evisceration_depth = evisceration_stack->len,
     .objects_touched = NULL,
     .rollback_handlers = NULL,
+    .undos = NULL,
     .exit_function = exit_function,
     .next = tx_current,
   };
@@ -795,6 +1269,14 @@ void tx_commit(void) {
     this->tx_backup = this->tx_backup->tx_backup;
   }
 
+  // The enclosing transaction may still be rolled back, in which case the
+  // changes made by this one must be undone too.
+  if (tx_current->next) {
+    list_p undos = lrev_p(tx_current->undos);
+    while (undos)
+      lpush_p(tx_current->next->undos, lpop_p(undos));
+  }
+
   tx_current = tx_current->next;
 }
 
@@ -820,6 +1302,12 @@ void tx_rollback(void) {
     h();
   }
 
+  // Undo changes to ephemeral state
+  while (tx_current->undos) {
+    const struct tx_undo* undo = lpop_p(tx_current->undos);
+    undo->fun(undo->arg);
+  }
+
   // Revert touched objects
   for (list_o curr = tx_current->objects_touched; curr; curr = curr->cdr) {
     object this = curr->car;
@@ -874,6 +1362,13 @@ void tx_pop_handler(void) {
   lpop_p(tx_current->rollback_handlers);
 }
 
+void tx_push_undo(void (*fun)(void*), void* arg) {
+  if (!tx_current) return;
+
+  struct tx_undo undo = { fun, arg };
+  lpush_p(tx_current->undos, newdup(&undo));
+}
+
 void tx_write_through_impl(struct symbol_header* sym) {
   if (!sym->owner_stack) return;
 
@@ -47,6 +47,7 @@
 #define ROOT_OBJECT_EVISCERATION_PRIORITY 132
 #define SYMBOL_ROOT_IMPLANTATION_PRIORITY 133
 #define ADVICE_INSTALLATION_PRIORITY 164
+#define HOOK_SORTING_PRIORITY 166
 #define STATIC_INITIALISATION_PRIORITY 228
 #define TEST_EXECUTION_PRIORITY 356
 
@@ -115,8 +116,15 @@
  *
  * If allocation fails, the program aborts.
  */
+/**
+ * The number of allocations made with gcalloc() (and thus also wcalloc(),
+ * qcalloc(), new(), etc) so far. Used by the benchmark harness.
+ */
+extern unsigned long gcalloc_count;
+
 static inline void* gcalloc(size_t) __attribute__((malloc));
 static inline void* gcalloc(size_t size) {
+  ++gcalloc_count;
   void* ret = GC_MALLOC(size);
   if (!ret) {
     fprintf(stderr, "Out of memory");
@@ -125,6 +133,39 @@ static inline void* gcalloc(size_t size) {
   return ret;
 }
 
+/**
+ * Like gcalloc(), but for memory which will never contain pointers, such as
+ * compressed data. The collector does not scan it, so its contents cannot
+ * keep anything alive by accident. Unlike gcalloc(), the memory is NOT
+ * zero-initialised.
+ */
+static inline void* gcalloc_atomic(size_t) __attribute__((malloc));
+static inline void* gcalloc_atomic(size_t size) {
+  ++gcalloc_count;
+  void* ret = GC_MALLOC_ATOMIC(size);
+  if (!ret) {
+    fprintf(stderr, "Out of memory");
+    exit(255);
+  }
+  return ret;
+}
+
+/**
+ * Like malloc(), but aborts the program if allocation fails. The memory lies
+ * outside of the GC heap, so it is neither scanned nor collected, and must be
+ * released with free(); this suits large, transient buffers, and anything
+ * used by threads other than the main one. A size of zero is permitted.
+ */
+static inline void* xmalloc(size_t) __attribute__((malloc));
+static inline void* xmalloc(size_t size) {
+  void* ret = malloc(size? size : 1);
+  if (!ret) {
+    fprintf(stderr, "Out of memory");
+    exit(255);
+  }
+  return ret;
+}
+
 /**
  * Allocates the given number of wchar_ts with gcalloc().
  */
@@ -226,6 +267,54 @@ static inline void* gcrealloc(void* ptr, size_t size) {
  */
 char* gcstrdup(const char*) __attribute__((malloc));
 
+/**
+ * Allocates memory of the given size from the transient arena. The memory is
+ * zero-initialised, and is scanned by the garbage collector for pointers, but
+ * is not itself garbage-collected: ALL memory in the arena is reclaimed at
+ * once by arena_reset(), which the kernel calls at the end of every cycle.
+ *
+ * This is intended for temporaries which are built while handling a single
+ * keystroke or drawing a single frame and then discarded, and which would
+ * otherwise give the collector nothing but garbage to trace. Pointers to
+ * arena memory must never be stored anywhere that outlives the current kernel
+ * cycle. In DEBUG builds, reclaimed memory is filled with a poison pattern so
+ * that any such escaped pointer yields obviously invalid data; places which
+ * retain memory long-term can also assert(!arena_owns(ptr)).
+ *
+ * The arena is not thread-safe, and must only be used from the main thread.
+ *
+ * If allocation fails, the program aborts.
+ */
+void* arena_alloc(size_t) __attribute__((malloc));
+
+/**
+ * Allocates the given number of wchar_ts with arena_alloc().
+ */
+static inline wchar_t* arena_wcalloc(size_t cnt) __attribute__((malloc));
+static inline wchar_t* arena_wcalloc(size_t cnt) {
+  return arena_alloc(cnt*sizeof(wchar_t));
+}
+
+/**
+ * Allocates the given number of qchars with arena_alloc().
+ */
+static inline qchar* arena_qcalloc(size_t cnt) __attribute__((malloc));
+static inline qchar* arena_qcalloc(size_t cnt) {
+  return arena_alloc(cnt*sizeof(qchar));
+}
+
+/**
+ * Reclaims all memory allocated by arena_alloc() since the last call to
+ * arena_reset().
+ */
+void arena_reset(void);
+
+/**
+ * Returns whether the given pointer points into memory currently allocated
+ * from the transient arena.
+ */
+bool arena_owns(const void*);
+
 /// STANDARD TYPES
 typedef char* mstring;
 typedef const char* string;
@@ -260,6 +349,27 @@ mwstring cstrtowstr(string);
  */
 mstring wstrtocstr(wstring);
 
+/**
+ * Writes all size bytes at data to the given file descriptor, retrying after
+ * short writes and interruption by signals. Returns true on success; on
+ * failure, returns false with errno set. Unlike most functions here, this
+ * touches neither the GC nor the object system, so worker threads may use it.
+ */
+bool write_fully(int fd, const void* data, size_t size);
+
+/**
+ * Returns the current time of the monotonic clock, in nanoseconds, or 0 if it
+ * cannot be read. This is only meaningful relative to other readings.
+ */
+unsigned long long now_ns(void);
+
+/**
+ * Like now_ns(), but in microseconds.
+ */
+static inline unsigned long long now_us(void) {
+  return now_ns() / 1000;
+}
+
 /// OBJECTS/CONTEXTS
 /**
  * Creates a new object with no implants. If a parent is specified, any
@@ -318,11 +428,16 @@ object object_current(void);
  * through the trouble of eviscerating _obj_. If _sym_ is not implanted in
  * _obj_, its parents are searched; failing that, the value in the current
  * context is used.
+ *
+ * Each use of this macro carries its own inline cache; see
+ * object_get_implanted_value_cached().
  */
 #define $(obj,sym) ({                                                   \
   typeof(sym) _GLUE(_ret_, __LINE__);                                   \
-  object_get_implanted_value(&_GLUE(_ret_, __LINE__), obj,              \
-                             &_GLUE(sym,$base));                        \
+  static unsigned _GLUE(_ic_, __LINE__);                                \
+  object_get_implanted_value_cached(&_GLUE(_ret_, __LINE__), obj,       \
+                                    &_GLUE(sym,$base),                  \
+                                    &_GLUE(_ic_, __LINE__));            \
   _GLUE(_ret_, __LINE__);})
 
 typedef enum hook_constraint {
@@ -398,6 +513,28 @@ void add_hook_obj_cond(struct hook_point*, unsigned priority, const bool* when,
                        void (*fun)(void), object,
                        hook_constraint_function);
 
+/**
+ * Describes one call to add_hook(), for use with add_hooks(). Silc emits
+ * tables of these as static data for the advice it generates.
+ */
+struct hook_registration {
+  struct hook_point* point;
+  unsigned priority;
+  identity id, class;
+  void (*fun)(void);
+  hook_constraint_function constraints;
+};
+
+/**
+ * Calls add_hook() for each of the count registrations.
+ *
+ * Before main() is run, add_hook() only flags the affected chain as unsorted;
+ * every flagged chain is then sorted once, after all advice has been
+ * installed (ie, after ADVICE_INSTALLATION_PRIORITY). Hooks must not be
+ * invoked before then.
+ */
+void add_hooks(const struct hook_registration*, unsigned count);
+
 /**
  * Deletes the given hook of the given priority from the given hook point, if
  * such a hook exists. Does nothing otherwise.
@@ -716,6 +853,19 @@ void tx_push_handler(void (*)(void));
  */
 void tx_pop_handler(void);
 
+/**
+ * Records fun(arg) as the undo action for a change to ephemeral state (ie,
+ * state which transactions do not otherwise restore) made within the current
+ * transaction. If the current transaction, or any transaction enclosing it, is
+ * rolled back, the undo actions recorded since it began are run in reverse
+ * order of recording, before objects and symbols are restored. Undo actions
+ * recorded by a transaction which commits are inherited by the enclosing
+ * transaction, if any, and discarded otherwise.
+ *
+ * Outside of any transaction, this has no effect.
+ */
+void tx_push_undo(void (*fun)(void*), void* arg);
+
 /**
  * Propagates the current value of the given symbol within the current context
  * through all transactions.
@@ -770,6 +920,68 @@ typedef struct list_o const* list_o;
  */
 void on_each_o(list_o, void (*)(void));
 
+/**
+ * Sets the name of the class of the given object, as reported by the hook
+ * profiler. The $c_ constructor macros call this automatically.
+ */
+void object_set_class_name(object, string);
+
+/**
+ * While hook_profiling is true, invoke_hook() counts calls to and time spent
+ * in every hook point and every function hooked onto each, and
+ * object_eviscerate() counts context switches into objects of each
+ * class. When false, the only cost is a test of this variable. Use
+ * hook_profile_start() and hook_profile_stop() rather than setting it
+ * directly.
+ */
+extern bool hook_profiling;
+
+enum hook_profile_kind {
+  HookProfileHook, HookProfileAdvice, HookProfileClass
+};
+
+typedef struct {
+  enum hook_profile_kind kind;
+  /**
+   * The name of the hook point (for HookProfileHook and HookProfileAdvice) or
+   * of the class (for HookProfileClass). NULL if unknown.
+   */
+  string name;
+  /**
+   * For HookProfileAdvice, the identity of the hooked function, and the
+   * function itself (as most recently seen under that identity).
+   */
+  identity id;
+  hook_function fun;
+  /**
+   * The number of invocations, or, for classes, of eviscerations.
+   */
+  unsigned long long calls;
+  /**
+   * Nanoseconds spent within the hook or function, respectively including
+   * and excluding nested hook invocations. Unused for classes.
+   */
+  unsigned long long inclusive_ns, exclusive_ns;
+  /**
+   * For classes, the total number of symbols swapped in by evisceration.
+   */
+  unsigned long long symbols;
+} hook_profile_entry;
+
+/**
+ * Discards any existing profile and begins profiling.
+ */
+void hook_profile_start(void);
+/**
+ * Stops profiling, retaining the profile collected so far.
+ */
+void hook_profile_stop(void);
+/**
+ * Returns an array of all profile entries collected since the last call to
+ * hook_profile_start(), in no particular order, and sets *count to its length.
+ */
+hook_profile_entry** hook_profile_entries(unsigned* count);
+
 ///////////////////////////////////////////////////////////////////////////////
 /// Mostly internal details below. You need not concern yourself with these.///
 ///////////////////////////////////////////////////////////////////////////////
@@ -809,6 +1021,11 @@ struct hook_point_entry {
 #define HOOK_AFTER 3
 struct hook_point {
   struct hook_point_entry* entries[4];
+  // The name of the hook symbol, set by silc.
+  string name;
+  // Bitmask of priorities whose chains were modified during startup and are
+  // yet to be sorted.
+  unsigned char unsorted;
 };
 
 enum implantation_type { ImplantSingle, ImplantDomain };
@@ -828,10 +1045,50 @@ static inline void reembowel_if_not_null(object* that) {
 void object_implant(struct symbol_header*, enum implantation_type);
 void object_get_implanted_value(void* dst, object,
                                 struct symbol_header* sym);
+/**
+ * Like object_get_implanted_value(), but first tries the implantation table
+ * slot remembered in *cache, which is updated whenever the symbol is found
+ * directly within the object. Since objects of the same class implant the same
+ * symbols in the same order, they place each symbol in the same slot, so a
+ * cache per call site turns most lookups into an indexed load, even when the
+ * call site sees many different objects.
+ *
+ * The cache is only ever a hint; it is validated against the object's table on
+ * every use, so it need never be invalidated.
+ */
+void object_get_implanted_value_cached(void* dst, object,
+                                       struct symbol_header* sym,
+                                       unsigned* cache);
 
 void add_symbol_to_domain(struct symbol_header*, struct symbol_domain**,
                           enum implantation_type);
 
+/**
+ * Describes one call to add_symbol_to_domain(), for use with
+ * add_symbols_to_domains().
+ */
+struct domain_registration {
+  struct symbol_header* sym;
+  struct symbol_domain** domain;
+  enum implantation_type implant_type;
+};
+
+/**
+ * Calls add_symbol_to_domain() for each of the count registrations.
+ */
+void add_symbols_to_domains(const struct domain_registration*, unsigned count);
+/**
+ * Implants each of the count symbols into the current object, as with
+ * object_implant(..., ImplantSingle).
+ */
+void implant_symbols(struct symbol_header*const*, unsigned count);
+
+/**
+ * The number of hooks added, and hook chains sorted, before main() was run,
+ * for the startup report.
+ */
+extern unsigned startup_hooks_added, startup_chains_sorted;
+
 hook_constraint constraint_after_superconstructor(
   identity, identity, identity, identity);
 hook_constraint constraint_before_superconstructor(
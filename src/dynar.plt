@@ -59,12 +59,21 @@ static inline typeof(CTYPE) dynar_top_HUNG(dynar_HUNG this) {
   return this->v[this->len-1];
 }
 
-static inline void dynar_ins_HUNG(dynar_HUNG this, size_t off,
-                                  const CTYPE* value, size_t cnt) {
+/* Opens a gap of cnt elements at off, and returns a pointer to the first
+ * element in the gap. The gap holds garbage, and must be filled in by the
+ * caller.
+ */
+static inline typeof(CTYPE)* dynar_open_HUNG(dynar_HUNG this, size_t off,
+                                             size_t cnt) {
   dynar_expand_by_HUNG(this, cnt);
   memmove(this->v + off + cnt, this->v + off,
           (this->len - off - cnt)*sizeof(CTYPE));
-  memcpy(this->v + off, value, cnt*sizeof(CTYPE));
+  return this->v + off;
+}
+
+static inline void dynar_ins_HUNG(dynar_HUNG this, size_t off,
+                                  const CTYPE* value, size_t cnt) {
+  memcpy(dynar_open_HUNG(this, off, cnt), value, cnt*sizeof(CTYPE));
 }
 
 static inline void dynar_erase_HUNG(dynar_HUNG this, size_t off, size_t cnt) {
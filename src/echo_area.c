@@ -155,6 +155,10 @@ defun($h_Workspace_draw_echo_area) {
     let($q_qch, str + i);
     $f_Terminal_putch();
   }
+
+  // The contents may have been allocated from the transient arena; don't keep
+  // them around past this frame.
+  $q_Workspace_echo_area_contents = NULL;
 }
 
 /*
@@ -23,6 +23,7 @@
 
 #include "../key_dispatch.h"
 #include "../face.h"
+#include "../gap_buffer.h"
 
 /*
   TITLE: Process stdin from line editor
@@ -41,11 +42,17 @@ subclass($c_Producer, $c_SfleProducer)
 
 /*
   SYMBOL: $as_StdinFromLineEditor_buffer
-    The input queue provided by the user so far.
+    The input queue provided by the user so far. Only the entries starting at
+    $I_StdinFromLineEditor_buffer_head are still pending.
+
+  SYMBOL: $I_StdinFromLineEditor_buffer_head
+    The index of the front of the input queue within
+    $as_StdinFromLineEditor_buffer.
  */
 defun($h_StdinFromLineEditor) {
-  $az_LineEditor_buffer = dynar_new_z();
+  $p_LineEditor_buffer = gb_new(NULL, 0);
   $as_StdinFromLineEditor_buffer = dynar_new_s();
+  $I_StdinFromLineEditor_buffer_head = 0;
   $i_LineEditor_point = 0;
 
   add_hook(&$h_Executor_set_meta_face, HOOK_MAIN,
@@ -138,6 +145,21 @@ defun($h_StdinFromLineEditor_begin_waiting) {
   }
 }
 
+/* Drops the front of the input queue. Consumed entries are only removed from
+ * the dynar once they make up at least half of it, so that draining a queue of
+ * N entries costs O(N) in total rather than O(N^2).
+ */
+static void dequeue_input(void) {
+  $as_StdinFromLineEditor_buffer->v[$I_StdinFromLineEditor_buffer_head++] =
+    NULL;
+  if ($I_StdinFromLineEditor_buffer_head * 2 >=
+      $as_StdinFromLineEditor_buffer->len) {
+    dynar_erase_s($as_StdinFromLineEditor_buffer, 0,
+                  $I_StdinFromLineEditor_buffer_head);
+    $I_StdinFromLineEditor_buffer_head = 0;
+  }
+}
+
 /*
   SYMBOL: $f_StdinFromLineEditor_pump_input
     Pushes as much data as possible to the output pipe. If writing to the pipe
@@ -151,9 +173,11 @@ defun($h_StdinFromLineEditor_pump_input) {
     $o_StdinFromLineEditor_producer = NULL;
   }
 
-  while ($as_StdinFromLineEditor_buffer->len) {
-    int written = write($i_Producer_fd, $as_StdinFromLineEditor_buffer->v[0],
-                        strlen($as_StdinFromLineEditor_buffer->v[0]));
+  while ($I_StdinFromLineEditor_buffer_head <
+         $as_StdinFromLineEditor_buffer->len) {
+    string* front =
+      $as_StdinFromLineEditor_buffer->v + $I_StdinFromLineEditor_buffer_head;
+    int written = write($i_Producer_fd, *front, strlen(*front));
     if (-1 == written) {
       if (errno == EAGAIN || errno == EWOULDBLOCK) {
         //Too much input, must wait for the pipe to become available again
@@ -165,9 +189,9 @@ defun($h_StdinFromLineEditor_pump_input) {
     }
 
     // Advance the buffer
-    $as_StdinFromLineEditor_buffer->v[0] += written;
-    if (!*$as_StdinFromLineEditor_buffer->v[0])
-      dynar_erase_s($as_StdinFromLineEditor_buffer, 0, 1);
+    *front += written;
+    if (!**front)
+      dequeue_input();
   }
 
   // Current input exhausted; if EOF has been entered, close the stream
@@ -238,7 +262,10 @@ defun($h_StdinFromLineEditor_accept) {
 
   // Reset the line editor
   $m_push_undo();
-  $az_LineEditor_buffer = dynar_new_z();
+  $M_edit(0,0,
+          $I_LineEditor_edit_offset = 0,
+          $I_LineEditor_edit_length = gb_len($p_LineEditor_buffer),
+          $I_LineEditor_edit_insertion_length = 0);
   $i_LineEditor_point = 0;
 
   $M_update_echo_area(0, $o_Activity_workspace);
@@ -256,7 +283,7 @@ defun($h_StdinFromLineEditor_eof) {
   if ($y_StdinFromLineEditor_eof) return;
 
   $y_StdinFromLineEditor_eof = true;
-  if ($az_LineEditor_buffer->len)
+  if (gb_len($p_LineEditor_buffer))
     $m_accept();
   else
     $m_pump_input();
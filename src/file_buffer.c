@@ -25,6 +25,12 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include "trigram_index.h"
+#include "packed_lines.h"
+#include "streamed_lines.h"
+#include "registry.h"
+#include "bench.h"
+
 /*
   TITLE: (Textual) File Buffer
   OVERVIEW: Efficiently manages the lines of text in a file, including undo
@@ -106,20 +112,21 @@ static object new_meta(void) {
     cause $m_window_changed() to be called on the cursor.
  */
 defun($h_FileBufferCursor) {
-  $$($o_FileBufferCursor_buffer) {
-    lpush_o($lo_FileBuffer_cursors, $o_FileBufferCursor);
-  }
+  $p_FileBufferCursor_registration =
+    reg_add($($o_FileBufferCursor_buffer, $p_FileBuffer_cursors),
+            $o_FileBufferCursor);
 }
 
 /*
   SYMBOL: $f_FileBufferCursor_destroy
     De-registers the FileBufferCursor from its associated FileBuffer.
+
+  SYMBOL: $p_FileBufferCursor_registration
+    The registry_node of this FileBufferCursor within the
+    $p_FileBuffer_cursors of its buffer.
  */
 defun($h_FileBufferCursor_destroy) {
-  $$($o_FileBufferCursor_buffer) {
-    $lo_FileBuffer_cursors = lrm_o($lo_FileBuffer_cursors,
-                                   $o_FileBufferCursor);
-  }
+  reg_remove($p_FileBufferCursor_registration);
 }
 
 /*
@@ -148,8 +155,11 @@ defun($h_FileBufferCursor_window_changed) {}
   SYMBOL: $c_FileBuffer
     Manages a single file- or memory-backed, editable buffer. Memory-backed
     buffers always have their contents stored in memory, but only
-    recently-accessed file-backed buffers keep their contents in memory. If an
-    external operation fails, it rolls the current transaction back.
+    recently-accessed file-backed buffers keep their contents in memory. Any
+    buffer not accessed for a while is kept compressed (see
+    $f_FileBuffer_freeze). Files too large for that are instead streamed
+    from disk (see $y_FileBuffer_streamed). If an external operation fails, it
+    rolls the current transaction back.
 
   SYMBOL: $p_shared_undo_log
     A FILE* where all undo information for all FileBuffers is kept. The file
@@ -171,22 +181,61 @@ defun($h_FileBufferCursor_window_changed) {}
 
   SYMBOL: $aw_FileBuffer_contents
     The contents of this FileBuffer. This may be NULL, indicating that the
-    contents currently reside on disk. Any operation that needs this value
-    should call $f_FileBuffer_access() to ensure that it is non-NULL and to
-    update the access time.
+    contents currently reside on disk or in $p_FileBuffer_packed. Any
+    operation that needs this value should call $f_FileBuffer_access() to
+    ensure that it is non-NULL and to update the access time.
+
+  SYMBOL: $p_FileBuffer_packed
+    A packed_lines* holding the contents of this FileBuffer while it is cold;
+    that is, while $aw_FileBuffer_contents is NULL but the contents have not
+    been released to disk. It is only meaningful when $aw_FileBuffer_contents
+    is NULL.
+
+  SYMBOL: $I_FileBuffer_last_access
+    The time() at which $f_FileBuffer_access was last called on this
+    FileBuffer.
 
   SYMBOL: $ao_FileBuffer_meta
     Arbitrary data to associate with each line. This array is transient; it is
     released whenever $aw_FileBuffer_contents is. When re-loaded, its objects
     are empty.
 
-  SYMBOL: $lo_FileBuffer_cursors
-    A list of all FileBufferCursors currently associated with this FileBuffer.
+  SYMBOL: $p_FileBuffer_cursors
+    A registry of all FileBufferCursors currently associated with this
+    FileBuffer.
 
-  SYMBOL: $lo_buffers
-    A list of all FileBuffer-like objects in existence.
+  SYMBOL: $p_buffers
+    A registry of all FileBuffer-like objects in existence, most recently
+    created first.
+
+  SYMBOL: $p_FileBuffer_registration
+    The registry_node of this FileBuffer within $p_buffers.
+
+  SYMBOL: $y_FileBuffer_streamed
+    If true, this FileBuffer is a read-only view of its file, whose contents
+    are never loaded into memory. $aw_FileBuffer_contents and
+    $ao_FileBuffer_meta always remain NULL; instead, $p_FileBuffer_stream
+    indexes the file and decodes lines on demand, keeping only a small window
+    of them (see src/streamed_lines.h), so that the memory used does not
+    depend on the size of the file. Readers should use fb_len() and fb_line()
+    (see src/file_buffer.h). This may be set when constructing a FileBuffer
+    for an existing file; it is set automatically, with a notice saying so,
+    for files of at least $I_FileBuffer_stream_threshold_mib MiB.
+
+  SYMBOL: $p_FileBuffer_stream
+    The streamed_lines* of a streamed FileBuffer, or NULL if the buffer is not
+    streamed or is released.
+
+  SYMBOL: $I_FileBuffer_stream_threshold_mib
+    The size in MiB at or above which files are opened as streamed
+    FileBuffers. Zero means never to stream files automatically.
  */
+STATIC_INIT_TO($p_buffers, reg_new())
+STATIC_INIT_TO($I_FileBuffer_stream_threshold_mib, 256)
+
 defun($h_FileBuffer) {
+  $p_FileBuffer_cursors = reg_new();
+
   if (!$p_shared_undo_log) {
     $p_shared_undo_log = tmpfile();
     //$p_shared_undo_log = fopen("sol.out", "w+b");
@@ -220,9 +269,29 @@ defun($h_FileBuffer) {
       // Read-only
       $y_FileBuffer_readonly = true;
     }
+
+    struct stat info;
+    if ($y_FileBuffer_modified) {
+      // Only existing files can be streamed
+      $y_FileBuffer_streamed = false;
+    } else if ($I_FileBuffer_stream_threshold_mib &&
+             -1 != stat(filename, &info) &&
+             (unsigned long long)info.st_size >=
+               $I_FileBuffer_stream_threshold_mib * 1024ULL * 1024ULL) {
+      $y_FileBuffer_streamed = true;
+      $F_message_notice(0,0, $w_message_text =
+                        wstrap($w_FileBuffer_filename,
+                               L" is too large to load; streaming it "
+                               L"read-only"));
+    }
+  } else {
+    $y_FileBuffer_streamed = false;
   }
 
-  lpush_o($lo_buffers, $o_FileBuffer);
+  if ($y_FileBuffer_streamed)
+    $y_FileBuffer_readonly = true;
+
+  $p_FileBuffer_registration = reg_add($p_buffers, $o_FileBuffer);
 }
 
 /*
@@ -236,8 +305,11 @@ defun($h_FileBuffer) {
 defun($h_FileBuffer_destroy) {
   each_o($lo_FileBuffer_attachments,
          lambdav((object that), $M_destroy(0,that)));
-  $lo_buffers = lrm_o($lo_buffers, $o_FileBuffer);
-
+  reg_remove($p_FileBuffer_registration);
+  if ($p_FileBuffer_stream) {
+    sl_close($p_FileBuffer_stream);
+    $p_FileBuffer_stream = NULL;
+  }
 
   // If we have been modified, there may be an autosave file on-disk. Remove it
   // if it is there.
@@ -251,26 +323,156 @@ defun($h_FileBuffer_destroy) {
 
 /*
   SYMBOL: $f_FileBuffer_access
-    Ensures that $aw_FileBuffer_contents is loaded, and checks for changes to
-    the source file.
+    Ensures that $aw_FileBuffer_contents (or, if the buffer is streamed,
+    $p_FileBuffer_stream) is loaded, and updates the access time. Changes to
+    the source file are picked up as they happen; see src/file_watch.c.
  */
+static bool has_warm_buffers;
+
 defun($h_FileBuffer_access) {
-  if (!$aw_FileBuffer_contents)
+  if ($y_FileBuffer_streamed? !$p_FileBuffer_stream : !$aw_FileBuffer_contents)
     $m_reload();
 
-  //TODO: Maintain access time; check for changes in source file
+  $I_FileBuffer_last_access = time(0);
+  has_warm_buffers = true;
+}
+
+unsigned fb_len(void) {
+  return $p_FileBuffer_stream?
+    sl_len($p_FileBuffer_stream) : $aw_FileBuffer_contents->len;
+}
+
+wstring fb_line(unsigned ix) {
+  return $p_FileBuffer_stream?
+    sl_line($p_FileBuffer_stream, ix) : $aw_FileBuffer_contents->v[ix];
+}
+
+/* Reads lines from input until EOF, appending them to lines. *size is
+ * advanced by the number of bytes read; *tail is set to the offset at which
+ * the last line read begins if it lacks a trailing newline, or to *size
+ * otherwise. Rolls the transaction back (closing input) on error.
+ */
+static void read_lines(FILE* input, dynar_w lines,
+                       unsigned long long* size, unsigned long long* tail) {
+  mstring line = NULL;
+  size_t line_len = 0;
+  ssize_t nread;
+
+  /* Reading the file in as a narrow string, then converting the lines to
+   * wstrings, has the advantage that we can fall back to ISO-8859-1 if
+   * decoding fails, whereas using, eg, fgetwc, we simply get an error and
+   * have no good way to fall back. The disadvantage is that this can't
+   * handle files encoded in encodings like UCS-4 or UTF-16, since the NUL
+   * "characters" will prematurely terminate the string. To handle such
+   * encodings, a subclass of FileBuffer will be needed which implements
+   * reload differently.
+   */
+  while (-1 != (nread = getline(&line, &line_len, input))) {
+    *size += nread;
+    *tail = *size;
+    // Delete the trailing newline character
+    if (nread && line[nread-1] == '\n')
+      line[nread-1] = 0;
+    else
+      *tail -= nread;
+    dynar_push_w(lines, cstrtowstr(line));
+  }
+
+  if (line)
+    free(line);
+
+  if (ferror(input)) {
+    int err = errno;
+    fclose(input);
+    errno = err;
+    tx_rollback_errno($u_FileBuffer);
+  }
+}
+
+/* Shunts any cursors of the FileBuffer in the current context which are past
+ * the given length back to it.
+ */
+static void clamp_cursors(unsigned len) {
+  REG_EACH(curr, $p_FileBuffer_cursors) {
+    $$(curr->obj) {
+      if ($I_FileBufferCursor_line_number > len) {
+        $i_FileBufferCursor_shunt_distance =
+          len - (signed)$I_FileBufferCursor_line_number;
+        $m_shunt();
+      }
+    }
+  }
+}
+
+/* Reads the len bytes of the file behind the FileBuffer in the current
+ * context which end at offset end into dst. Returns whether all of them could
+ * be read.
+ */
+static bool read_disk_sample(unsigned char* dst, unsigned len,
+                             unsigned long long end) {
+  int fd = open(wstrtocstr($w_FileBuffer_filename), O_RDONLY);
+  if (-1 == fd) return false;
+
+  ssize_t nread = pread(fd, dst, len, end - len);
+  close(fd);
+  return nread == (ssize_t)len;
+}
+
+/* Replaces $p_FileBuffer_disk_extent of the FileBuffer in the current
+ * context, sampling the bytes just before the tail from the file.
+ */
+static void set_disk_extent(unsigned long long size, unsigned long long tail) {
+  struct disk_extent* extent = gcalloc_atomic(sizeof(struct disk_extent));
+  extent->size = size;
+  extent->tail = tail;
+  extent->sample_len = tail < DISK_EXTENT_SAMPLE? tail : DISK_EXTENT_SAMPLE;
+  extent->sampled = read_disk_sample(extent->sample, extent->sample_len, tail);
+  $p_FileBuffer_disk_extent = extent;
+}
+
+bool fb_disk_appended(unsigned long long size) {
+  const struct disk_extent* extent = $p_FileBuffer_disk_extent;
+  unsigned char now[DISK_EXTENT_SAMPLE];
+
+  return extent && extent->sampled && size >= extent->size &&
+         read_disk_sample(now, extent->sample_len, extent->tail) &&
+         !memcmp(now, extent->sample, extent->sample_len);
 }
 
 /*
   SYMBOL: $f_FileBuffer_reload
     Reloads this FileBuffer, so that $aw_FileBuffer_contents and
-    $ao_FileBuffer_meta are non-NULL. This should not be called directly; use
+    $ao_FileBuffer_meta are non-NULL, or, if the buffer is streamed, so that
+    $p_FileBuffer_stream is. This should not be called directly; use
     $f_FileBuffer_access() instead. It is provided as a separate function for
     hooking purposes only.
  */
 defun($h_FileBuffer_reload) {
+  if ($y_FileBuffer_streamed) {
+    if (!$p_FileBuffer_stream) {
+      $p_FileBuffer_stream = sl_open(wstrtocstr($w_FileBuffer_filename));
+      if (!$p_FileBuffer_stream)
+        tx_rollback_errno($u_FileBuffer);
+      // The file descriptor is part of the outside world; rolling back must
+      // not lose it.
+      tx_write_through($p_FileBuffer_stream);
+
+      set_disk_extent(sl_size($p_FileBuffer_stream),
+                      sl_size($p_FileBuffer_stream));
+      clamp_cursors(sl_len($p_FileBuffer_stream));
+    }
+
+    return;
+  }
+
   if (!$aw_FileBuffer_contents) {
-    if ($y_FileBuffer_memory_backed) {
+    if ($p_FileBuffer_packed) {
+      packed_lines* packed = $p_FileBuffer_packed;
+      $aw_FileBuffer_contents = dynar_new_w();
+      dynar_expand_by_w($aw_FileBuffer_contents, packed->nlines);
+      pl_unpack(packed, $aw_FileBuffer_contents->v);
+      $p_FileBuffer_packed = NULL;
+    } else if ($y_FileBuffer_memory_backed) {
       $aw_FileBuffer_contents = dynar_new_w();
     } else {
       // Re-read the file. If the buffer is currently modified, read from the
@@ -281,54 +483,19 @@ defun($h_FileBuffer_reload) {
       string filename = wstrtocstr(wfilename);
 
       FILE* input = fopen(filename, "r");
-      mstring line = NULL;
-      size_t line_len = 0;
+      unsigned long long size = 0, tail = 0;
       if (!input)
         tx_rollback_errno($u_FileBuffer);
 
       $aw_FileBuffer_contents = dynar_new_w();
-
-      /* Reading the file in as a narrow string, then converting the lines to
-       * wstrings, has the advantage that we can fall back to ISO-8859-1 if
-       * decoding fails, whereas using, eg, fgetwc, we simply get an error and
-       * have no good way to fall back. The disadvantage is that this can't
-       * handle files encoded in encodings like UCS-4 or UTF-16, since the NUL
-       * "characters" will prematurely terminate the string. To handle such
-       * encodings, a subclass of FileBuffer will be needed which implements
-       * reload differently.
-       */
-      while (-1 != getline(&line, &line_len, input)) {
-        // Delete the trailing newline character
-        for (unsigned i = 0; line[i]; ++i)
-          if (line[i] == L'\n')
-            line[i] = 0;
-        dynar_push_w($aw_FileBuffer_contents,
-                     cstrtowstr(line));
-      }
-
-      if (line)
-        free(line);
-
-      if (ferror(input)) {
-        int err = errno;
-        fclose(input);
-        errno = err;
-        tx_rollback_errno($u_FileBuffer);
-      }
+      read_lines(input, $aw_FileBuffer_contents, &size, &tail);
       fclose(input);
-    }
 
-    // Ensure that all cursors are within bounds
-    for (list_o curr = $lo_FileBuffer_cursors; curr; curr = curr->cdr) {
-      $$(curr->car) {
-        if ($I_FileBufferCursor_line_number > $aw_FileBuffer_contents->len) {
-          $i_FileBufferCursor_shunt_distance =
-            $aw_FileBuffer_contents->len -
-            (signed)$I_FileBufferCursor_line_number;
-          $m_shunt();
-        }
-      }
+      if (!$y_FileBuffer_modified)
+        set_disk_extent(size, tail);
     }
+
+    clamp_cursors($aw_FileBuffer_contents->len);
   }
 
   if (!$ao_FileBuffer_meta) {
@@ -339,6 +506,88 @@ defun($h_FileBuffer_reload) {
   }
 }
 
+/*
+  SYMBOL: $p_FileBuffer_disk_extent
+    A const struct disk_extent* (see src/file_buffer.h) holding the size in
+    bytes of the file behind this FileBuffer as of when it was last read or
+    saved, and the offset at which its last line begins if that line has no
+    trailing newline (otherwise, the same as the size), along with a sample
+    of the bytes before that offset. NULL if the file has not been read or
+    saved yet. This allows $f_FileBuffer_read_tail to read only what has
+    since been appended to the file, and fb_disk_appended() to check that
+    nothing else has changed.
+
+  SYMBOL: $f_FileBuffer_read_tail
+    Reads whatever has been appended to the file since it was last read,
+    starting from the tail in $p_FileBuffer_disk_extent, and adds it to the
+    end of the buffer; if the last line had no newline, it is re-read and
+    replaced. The change is applied with $f_FileBuffer_raw_edit, since the
+    buffer stays identical to the file and so has nothing to undo. The cost
+    is proportional to the amount appended, not to the size of the file. A
+    streamed buffer instead extends the index of its $p_FileBuffer_stream.
+    This should only be called when the buffer is unmodified and
+    fb_disk_appended() holds.
+ */
+defun($h_FileBuffer_read_tail) {
+  $m_access();
+
+  if ($p_FileBuffer_stream) {
+    if (!sl_extend($p_FileBuffer_stream))
+      tx_rollback_errno($u_FileBuffer);
+    set_disk_extent(sl_size($p_FileBuffer_stream),
+                    sl_size($p_FileBuffer_stream));
+    return;
+  }
+
+  const struct disk_extent* extent = $p_FileBuffer_disk_extent;
+  unsigned long long old_size = extent? extent->size : 0;
+  unsigned long long old_tail = extent? extent->tail : 0;
+
+  FILE* input = fopen(wstrtocstr($w_FileBuffer_filename), "r");
+  if (!input)
+    tx_rollback_errno($u_FileBuffer);
+
+  if (-1 == fseeko(input, old_tail, SEEK_SET)) {
+    int err = errno;
+    fclose(input);
+    errno = err;
+    tx_rollback_errno($u_FileBuffer);
+  }
+
+  dynar_w lines = dynar_new_w();
+  unsigned long long size = old_tail, tail = size;
+  read_lines(input, lines, &size, &tail);
+  fclose(input);
+  // The file may have been truncated since the caller looked at it
+  if (!lines->len) return;
+
+  unsigned replace_last =
+    (old_tail != old_size &&
+     $aw_FileBuffer_contents->len);
+  $M_raw_edit(0,0,
+              $I_FileBuffer_edit_line =
+                $aw_FileBuffer_contents->len - replace_last,
+              $I_FileBuffer_ndeletions = replace_last,
+              $lw_FileBuffer_replacements = NULL,
+              $aw_FileBuffer_bulk_replacements = lines);
+
+  set_disk_extent(size, tail);
+}
+
+/*
+  SYMBOL: $f_FileBuffer_saved
+    Called in the context of a FileBuffer once its contents have been written
+    to its file, whether by $f_FileBuffer_save or an $c_AsyncSave. The default
+    records the new size of the file on disk.
+ */
+defun($h_FileBuffer_saved) {
+  struct stat info;
+  if (-1 != stat(wstrtocstr($w_FileBuffer_filename), &info)) {
+    set_disk_extent(info.st_size, info.st_size);
+    tx_write_through($p_FileBuffer_disk_extent);
+  }
+}
+
 /*
   SYMBOL: $f_FileBuffer_write_autosave
     If this FileBuffer is modified and not memory backed, writes the current
@@ -379,8 +628,9 @@ defun($h_FileBuffer_write_autosave) {
 
 /*
   SYMBOL: $f_FileBuffer_release
-    Releases $ao_FileBuffer_meta and $aw_FileBuffer_contents for this
-    FileBuffer.
+    Releases $ao_FileBuffer_meta and $aw_FileBuffer_contents (or
+    $p_FileBuffer_packed) for this FileBuffer. A streamed buffer closes its
+    $p_FileBuffer_stream, so that the next access indexes the file afresh.
  */
 defun($h_FileBuffer_release) {
   //Can't release a memory-backed buffer
@@ -391,6 +641,151 @@ defun($h_FileBuffer_release) {
 
   $ao_FileBuffer_meta = NULL;
   $aw_FileBuffer_contents = NULL;
+  $p_FileBuffer_packed = NULL;
+  $p_FileBuffer_trigram_index = NULL;
+
+  if ($p_FileBuffer_stream) {
+    sl_close($p_FileBuffer_stream);
+    $p_FileBuffer_stream = NULL;
+    tx_write_through($p_FileBuffer_stream);
+  }
+}
+
+/*
+  SYMBOL: $f_FileBuffer_freeze
+    Makes this FileBuffer cold: its contents are packed into
+    $p_FileBuffer_packed, and $aw_FileBuffer_contents, $ao_FileBuffer_meta and
+    the trigram index are dropped. The next $f_FileBuffer_access unpacks the
+    contents again, which is much cheaper than re-reading and re-decoding the
+    file. Unlike $f_FileBuffer_release, this works for memory-backed buffers as
+    well, and never touches the disk. There is no effect if the buffer is
+    already cold or released.
+ */
+defun($h_FileBuffer_freeze) {
+  if (!$aw_FileBuffer_contents) return;
+
+  $p_FileBuffer_packed = pl_pack($aw_FileBuffer_contents->v,
+                                 $aw_FileBuffer_contents->len);
+  $ao_FileBuffer_meta = NULL;
+  $aw_FileBuffer_contents = NULL;
+  $p_FileBuffer_trigram_index = NULL;
+}
+
+/*
+  SYMBOL: $f_sweep_buffers
+    Freezes every FileBuffer which has not been accessed for
+    $I_FileBuffer_cold_after seconds, then, while the estimated memory held by
+    the contents of all FileBuffers exceeds $I_FileBuffer_memory_budget,
+    releases cold, unmodified, file-backed buffers, least recently accessed
+    first. (Modified buffers would need their autosave file written, which may
+    fail; outside of a transaction, there is nothing to roll back to.) This is
+    run periodically from $f_run_tasks; it is rarely useful to call it
+    directly.
+
+  SYMBOL: $I_FileBuffer_cold_after
+    The number of seconds a FileBuffer must go unaccessed before
+    $f_sweep_buffers freezes it. Zero disables freezing.
+
+  SYMBOL: $I_FileBuffer_memory_budget
+    The number of bytes which the contents of all FileBuffers, warm or cold,
+    may occupy before $f_sweep_buffers starts releasing cold ones to
+    disk. Zero disables the budget.
+ */
+STATIC_INIT_TO($I_FileBuffer_cold_after, 120)
+STATIC_INIT_TO($I_FileBuffer_memory_budget, 64*1024*1024)
+
+// The time() at or after which $f_sweep_buffers next runs.
+static unsigned long long next_sweep;
+
+/* Returns the approximate number of bytes held by the contents of the
+ * FileBuffer in the current context.
+ */
+static size_t buffer_footprint(void) {
+  size_t size = 0;
+  if ($aw_FileBuffer_contents) {
+    size = $aw_FileBuffer_contents->len * sizeof(wstring);
+    for (unsigned i = 0; i < $aw_FileBuffer_contents->len; ++i)
+      size += (wcslen($aw_FileBuffer_contents->v[i]) + 1) * sizeof(wchar_t);
+  } else if ($p_FileBuffer_packed) {
+    size = pl_footprint($p_FileBuffer_packed);
+  }
+
+  return size;
+}
+
+/* Returns whether $f_sweep_buffers may release the FileBuffer in the current
+ * context.
+ */
+static bool is_releasable(void) {
+  return !$aw_FileBuffer_contents && $p_FileBuffer_packed &&
+         !$y_FileBuffer_memory_backed && !$y_FileBuffer_modified;
+}
+
+defun($h_sweep_buffers) {
+  unsigned long long now = time(0);
+  size_t total = 0;
+  unsigned ncold = 0;
+  has_warm_buffers = false;
+
+  REG_EACH(curr, $p_buffers) {
+    $$(curr->obj) {
+      if ($aw_FileBuffer_contents && $I_FileBuffer_cold_after &&
+          now - $I_FileBuffer_last_access >= $I_FileBuffer_cold_after)
+        $m_freeze();
+
+      if ($aw_FileBuffer_contents)
+        has_warm_buffers = true;
+      if (is_releasable())
+        ++ncold;
+      total += buffer_footprint();
+    }
+  }
+
+  if (!$I_FileBuffer_memory_budget || total <= $I_FileBuffer_memory_budget ||
+      !ncold)
+    return;
+
+  object cold[ncold];
+  unsigned n = 0;
+  REG_EACH(curr, $p_buffers)
+    $$(curr->obj)
+      if (is_releasable())
+        cold[n++] = curr->obj;
+
+  int by_access(const void* va, const void* vb) {
+    unsigned long long a = $(*(object*)va, $I_FileBuffer_last_access);
+    unsigned long long b = $(*(object*)vb, $I_FileBuffer_last_access);
+    return (a > b) - (a < b);
+  }
+  qsort(cold, n, sizeof(object), by_access);
+
+  for (unsigned i = 0; i < n && total > $I_FileBuffer_memory_budget; ++i) {
+    $$(cold[i]) {
+      total -= buffer_footprint();
+      $m_release();
+    }
+  }
+}
+
+advise_after($h_run_tasks) {
+  if (!has_warm_buffers || !$I_FileBuffer_cold_after) return;
+
+  unsigned long long now = time(0);
+  if (now >= next_sweep) {
+    unsigned interval = $I_FileBuffer_cold_after / 4;
+    next_sweep = now + (interval? interval : 1);
+    $f_sweep_buffers();
+  }
+
+  // Wake up for the next sweep even if idle, since that is precisely when
+  // buffers go cold.
+  if (has_warm_buffers) {
+    unsigned long long ms = (next_sweep - now) * 1000;
+    if ($y_kernel_poll_infinite || ms < (unsigned)$i_kernel_poll_duration_ms) {
+      $y_kernel_poll_infinite = false;
+      $i_kernel_poll_duration_ms = ms;
+    }
+  }
 }
 
 /*
@@ -426,6 +821,9 @@ STATIC_INIT_TO($I_FileBuffer_default_file_mode, 0644);
     - The autosave file is renamed onto the base file. This is guaranteed by
       POSIX to be atomic.
     - The buffer is set to unmodified.
+    If $y_FileBuffer_save_asynchronously is true, the same steps are instead
+    performed on a worker thread by an $c_AsyncSave, and the buffer is only
+    set to unmodified once they have completed.
 
   SYMBOL: $y_FileBuffer_suppress_backup
     When saving a FileBuffer, don't rename the original file to a backup
@@ -447,6 +845,11 @@ defun($h_FileBuffer_save) {
   if (!$y_FileBuffer_modified || $y_FileBuffer_memory_backed)
     return;
 
+  if ($y_FileBuffer_save_asynchronously) {
+    $c_AsyncSave($o_AsyncSave_buffer = $o_FileBuffer);
+    return;
+  }
+
   wstring wbasename = $w_FileBuffer_filename;
   wstring wbakname = wstrap(wbasename, L"~");
   wstring wasname = wstrap(wbasename, L"#");
@@ -500,17 +903,68 @@ defun($h_FileBuffer_save) {
   $y_FileBuffer_modified = false;
   $I_FileBuffer_saved_undo_offset = $I_FileBuffer_undo_offset;
   tx_write_through($y_FileBuffer_modified);
+  $m_saved();
 }
 
 STATIC_INIT_TO($w_prev_undo_name, L"")
+
+/* The lines inserted by an edit, taken from either
+ * $aw_FileBuffer_bulk_replacements or $lw_FileBuffer_replacements.
+ */
+typedef struct {
+  list_w list;
+  const wstring* array, * end;
+} replacement_source;
+
+static replacement_source replacements_of(dynar_w bulk) {
+  replacement_source src = { .list = NULL, .array = NULL, .end = NULL };
+  if (bulk) {
+    src.array = bulk->v;
+    src.end = bulk->v + bulk->len;
+  } else {
+    src.list = $lw_FileBuffer_replacements;
+  }
+  return src;
+}
+
+static bool has_replacement(const replacement_source* src) {
+  return src->array? src->array != src->end : !!src->list;
+}
+
+static wstring next_replacement(replacement_source* src) {
+  if (src->array)
+    return *src->array++;
+
+  wstring line = src->list->car;
+  src->list = src->list->cdr;
+  return line;
+}
+
+static unsigned count_replacements(replacement_source src) {
+  return src.array? src.end - src.array : llen_w(src.list);
+}
+
+// Moves the next cnt replacements into dst
+static void take_replacements(wstring* dst, replacement_source* src,
+                              unsigned cnt) {
+  if (src->array) {
+    memcpy(dst, src->array, cnt * sizeof(wstring));
+    src->array += cnt;
+  } else {
+    for (unsigned i = 0; i < cnt; ++i)
+      dst[i] = next_replacement(src);
+  }
+}
+
 /*
   SYMBOL: $f_FileBuffer_edit
     Edits the buffer by performing $I_FileBuffer_ndeletions deletions starting
     at $I_FileBuffer_edit_line, then inserting the contents of
-    $lw_FileBuffer_replacements before the first line unaffected by
-    deletion. Inserted and replaced lines have their meta objects reset to
-    empty objects. $y_FileBuffer_continue_undo will be set to false after this
-    call. $f_FileBuffer_access will be called automatically.
+    $lw_FileBuffer_replacements (or $aw_FileBuffer_bulk_replacements) before
+    the first line unaffected by deletion. Inserted and replaced lines have
+    their meta objects reset to empty objects. $y_FileBuffer_continue_undo
+    will be set to false after this call. $f_FileBuffer_access will be called
+    automatically.
 
   SYMBOL: $I_FileBuffer_edit_line
     The line at which edits occur for this FileBuffer.
@@ -526,6 +980,13 @@ STATIC_INIT_TO($w_prev_undo_name, L"")
   SYMBOL: $lw_FileBuffer_replacements
     The lines to insert in a call to $f_FileBuffer_edit.
 
+  SYMBOL: $aw_FileBuffer_bulk_replacements
+    If non-NULL, the lines to insert in a call to $f_FileBuffer_edit or
+    $f_FileBuffer_raw_edit, in place of $lw_FileBuffer_replacements. This is
+    preferable for large insertions, which are then copied straight into the
+    buffer. It is reset to NULL on entry to either function, so that it never
+    leaks into a later edit.
+
   SYMBOL: $I_FileBuffer_undo_offset
     The offset of the most recent undo state for this FileBuffer, or 0 if there
     is no undo information.
@@ -534,6 +995,9 @@ STATIC_INIT_TO($w_prev_undo_name, L"")
     The last filename written in an undo record header.
  */
 defun($h_FileBuffer_edit) {
+  dynar_w bulk = $aw_FileBuffer_bulk_replacements;
+  $aw_FileBuffer_bulk_replacements = NULL;
+
   $m_require_writable();
   $m_access();
 
@@ -556,8 +1020,6 @@ defun($h_FileBuffer_edit) {
     tx_rollback();
   }
 
-  list_w insertions = $lw_FileBuffer_replacements;
-
   unsigned long long now = time(0);
   unsigned prev_undo = $I_FileBuffer_undo_offset;
 
@@ -588,12 +1050,14 @@ defun($h_FileBuffer_edit) {
       tx_rollback_errno($u_FileBuffer);
 
   //Write insertions
-  for (list_w curr = insertions; curr; curr = curr->cdr)
-    if (-1 == fprintf($p_shared_undo_log, "+%ls\n", curr->car))
+  for (replacement_source src = replacements_of(bulk);
+       has_replacement(&src);)
+    if (-1 == fprintf($p_shared_undo_log, "+%ls\n", next_replacement(&src)))
       tx_rollback_errno($u_FileBuffer);
 
   $y_FileBuffer_modified = true;
 
+  $aw_FileBuffer_bulk_replacements = bulk;
   $m_raw_edit();
 }
 
@@ -761,46 +1225,56 @@ defun($h_FileBuffer_redo) {
     without writing to the undo log.
  */
 defun($h_FileBuffer_raw_edit) {
+  replacement_source insertions =
+    replacements_of($aw_FileBuffer_bulk_replacements);
+  $aw_FileBuffer_bulk_replacements = NULL;
+
   $m_access();
 
   unsigned ndeletions = $I_FileBuffer_ndeletions;
-  unsigned ninsertions = llen_w($lw_FileBuffer_replacements);
+  unsigned ninsertions = count_replacements(insertions);
   unsigned nreplacements =
     ndeletions > ninsertions? ninsertions : ndeletions;
-  list_w insertions = $lw_FileBuffer_replacements;
+
+  trigram_index* index = $p_FileBuffer_trigram_index;
 
   //Make the changes
   for (unsigned i = 0;
-       insertions && i < ndeletions;
-       ++i, insertions = insertions->cdr) {
+       has_replacement(&insertions) && i < ndeletions;
+       ++i) {
     unsigned line = i + $I_FileBuffer_edit_line;
-    $aw_FileBuffer_contents->v[line] = insertions->car;
+    $aw_FileBuffer_contents->v[line] = next_replacement(&insertions);
     $ao_FileBuffer_meta->v[line] = new_meta();
+    if (index)
+      tgi_replace(index, line, $aw_FileBuffer_contents->v[line]);
   }
 
-  if (insertions) {
+  if (has_replacement(&insertions)) {
+    // Open a gap of the right size in each dynar and fill it in place, so
+    // that even huge insertions need no temporary storage.
     unsigned line = $I_FileBuffer_edit_line + ndeletions;
     unsigned cnt = ninsertions - ndeletions;
-    wstring tail[cnt];
-    object meta[cnt];
-    unsigned ix = 0;
-    each_w(insertions, lambdav((wstring s), tail[ix++] = s));
-    dynar_ins_w($aw_FileBuffer_contents, line, tail, cnt);
+    wstring* tail = dynar_open_w($aw_FileBuffer_contents, line, cnt);
+    take_replacements(tail, &insertions, cnt);
+    if (index)
+      tgi_insert(index, line, tail, cnt);
 
+    object* meta = dynar_open_o($ao_FileBuffer_meta, line, cnt);
     for (unsigned i = 0; i < cnt; ++i)
       meta[i] = new_meta();
-    dynar_ins_o($ao_FileBuffer_meta, line, meta, cnt);
   } else if (ndeletions > ninsertions) {
     unsigned line = $I_FileBuffer_edit_line + ninsertions;
     unsigned cnt = ndeletions - ninsertions;
 
     dynar_erase_w($aw_FileBuffer_contents, line, cnt);
     dynar_erase_o($ao_FileBuffer_meta, line, cnt);
+    if (index)
+      tgi_erase(index, line, cnt);
   }
 
   // Update cursors as necessary
-  for (list_o curr = $lo_FileBuffer_cursors; curr; curr = curr->cdr) {
-    object cursor = curr->car;
+  REG_EACH(curr, $p_FileBuffer_cursors) {
+    object cursor = curr->obj;
     unsigned where = $(cursor, $I_FileBufferCursor_line_number);
     unsigned window = $(cursor, $I_FileBufferCursor_window);
 
@@ -855,3 +1329,89 @@ defun($h_FileBuffer_raw_edit) {
        i < $aw_FileBuffer_contents->len; ++i)
     $F_LineMeta_clobber(0, $ao_FileBuffer_meta->v[i]);
 }
+
+/*
+  SYMBOL: $f_FileBuffer_build_trigram_index
+    Accesses this FileBuffer, then builds $p_FileBuffer_trigram_index if it
+    does not exist and the buffer has at least
+    $I_FileBuffer_trigram_index_threshold lines. Once built, the index is kept
+    up to date by $f_FileBuffer_raw_edit(), and dropped when the buffer is
+    released. Streamed buffers are never indexed.
+
+  SYMBOL: $p_FileBuffer_trigram_index
+    A trigram_index* over $aw_FileBuffer_contents, or NULL if the buffer is not
+    currently indexed.
+
+  SYMBOL: $I_FileBuffer_trigram_index_threshold
+    The minimum number of lines a FileBuffer must have for
+    $f_FileBuffer_build_trigram_index() to index it. Smaller buffers are
+    searched quickly enough without the index to not be worth the memory.
+ */
+STATIC_INIT_TO($I_FileBuffer_trigram_index_threshold, 4096)
+defun($h_FileBuffer_build_trigram_index) {
+  $m_access();
+
+  if (!$p_FileBuffer_trigram_index && $aw_FileBuffer_contents &&
+      $aw_FileBuffer_contents->len >= $I_FileBuffer_trigram_index_threshold)
+    $p_FileBuffer_trigram_index =
+      tgi_new($aw_FileBuffer_contents->v, $aw_FileBuffer_contents->len);
+}
+
+/* Measures dropping a FileBuffer of the given number of lines from memory
+ * (releasing it, or freezing it if freeze is true) and then accessing it
+ * again.
+ */
+static void bench_reaccess(unsigned iterations, unsigned lines,
+                           bool streamed, bool freeze) {
+  string filename = bench_write_file(lines);
+  object buffer = $c_FileBuffer($w_FileBuffer_filename = cstrtowstr(filename),
+                                $y_FileBuffer_streamed = streamed);
+
+  bench_start();
+  for (unsigned i = 0; i < iterations; ++i) {
+    if (freeze)
+      $M_freeze(0, buffer);
+    else
+      $M_release(0, buffer);
+    $M_access(0, buffer);
+  }
+  bench_stop();
+
+  $M_destroy(0, buffer);
+  unlink(filename);
+}
+
+defbench(file_load, "Reload a 20000-line file from disk") {
+  bench_reaccess(iterations, 20000, false, false);
+}
+
+defbench(streamed_open, "Open and index a 200000-line file for streaming") {
+  bench_reaccess(iterations, 200000, true, false);
+}
+
+defbench(cold_access, "Freeze and re-access a 20000-line file buffer") {
+  bench_reaccess(iterations, 20000, false, true);
+}
+
+defbench(bulk_insert, "Insert, then delete, 100000 lines in one edit each") {
+  object buffer = bench_buffer(100);
+  dynar_w lines = dynar_new_w();
+  for (unsigned i = 0; i < 100000; ++i)
+    dynar_push_w(lines, L"A pasted line of text");
+
+  bench_start();
+  for (unsigned i = 0; i < iterations; ++i) {
+    $M_raw_edit(0, buffer,
+                $I_FileBuffer_edit_line = 50,
+                $I_FileBuffer_ndeletions = 0,
+                $lw_FileBuffer_replacements = NULL,
+                $aw_FileBuffer_bulk_replacements = lines);
+    $M_raw_edit(0, buffer,
+                $I_FileBuffer_edit_line = 50,
+                $I_FileBuffer_ndeletions = lines->len,
+                $lw_FileBuffer_replacements = NULL);
+  }
+  bench_stop();
+
+  $M_destroy(0, buffer);
+}
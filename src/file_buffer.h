@@ -0,0 +1,65 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef FILE_BUFFER_H_
+#define FILE_BUFFER_H_
+
+/**
+ * Returns the number of lines in the FileBuffer in the current context, which
+ * must have been loaded with $f_FileBuffer_access(). Together with
+ * fb_line(), this works whether the buffer holds its contents in
+ * $aw_FileBuffer_contents or streams them from disk (see
+ * $y_FileBuffer_streamed), so code which only reads buffers should use these
+ * rather than $aw_FileBuffer_contents.
+ */
+unsigned fb_len(void);
+
+/**
+ * Returns the line at the given index, which must be less than fb_len(), of
+ * the FileBuffer in the current context.
+ */
+wstring fb_line(unsigned);
+
+/**
+ * Returns whether the file behind the FileBuffer in the current context, now
+ * of the given size in bytes, appears to have only been appended to since it
+ * was last read or saved; that is, it is no shorter than it was, and the
+ * bytes just before the tail in $p_FileBuffer_disk_extent are unchanged.
+ */
+bool fb_disk_appended(unsigned long long size);
+
+#define DISK_EXTENT_SAMPLE 256
+
+/**
+ * The size in bytes of the file behind a FileBuffer, and the offset at which
+ * its last line begins; see $p_FileBuffer_disk_extent. These are kept apart
+ * from the FileBuffer since files may exceed what an $I symbol can hold. The
+ * up to DISK_EXTENT_SAMPLE bytes of the file which end at the tail are kept
+ * in sample, so that a rewrite can be told apart from an append; sampled is
+ * false if they could not be read. An extent is never modified once created;
+ * a new one replaces it instead, so that rolling a transaction back restores
+ * the old one.
+ */
+struct disk_extent {
+  unsigned long long size, tail;
+  bool sampled;
+  unsigned sample_len;
+  unsigned char sample[DISK_EXTENT_SAMPLE];
+};
+
+#endif /* FILE_BUFFER_H_ */
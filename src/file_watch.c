@@ -0,0 +1,284 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "file_watch.slc"
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#include "registry.h"
+#include "file_buffer.h"
+
+/*
+  TITLE: On-Disk Change Detection
+  OVERVIEW: Watches the files behind FileBuffers with inotify, so that changes
+    made by other programs are picked up as they happen. If an unmodified
+    buffer's file grows and the bytes before its old end are unchanged, this
+    is taken to be an append (as by a process writing a log), and only the
+    new bytes are read (see $f_FileBuffer_read_tail), so that following even
+    a huge, growing file costs time proportional to what was added; a
+    streamed buffer likewise only indexes the new bytes. Any other change,
+    including a rewrite in place, causes an unmodified buffer to be reloaded.
+    Modified buffers are never touched; $y_FileBuffer_changed_on_disk records
+    that the file changed underneath them instead.
+    --
+    On systems without inotify, files are simply not watched.
+*/
+
+#ifdef HAVE_SYS_INOTIFY_H
+#define WATCH_MASK (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+#endif
+
+/*
+  SYMBOL: $c_FileWatcher
+    Consumer which reads inotify events and dispatches them to the FileBuffers
+    they concern. There is only ever one, $o_file_watcher, created the first
+    time a FileBuffer is watched.
+
+  SYMBOL: $o_file_watcher
+    The FileWatcher, or NULL if none has been created yet.
+
+  SYMBOL: $mp_FileWatcher_buffers
+    Maps inotify watch descriptors (cast to void*) to the FileBuffers using
+    them. If two FileBuffers somehow refer to the same file, only the most
+    recently watched one is kept up to date.
+
+  SYMBOL: $y_watch_files
+    If true (the default), FileBuffers watch their files for changes. Only
+    affects FileBuffers created or saved after it is changed.
+ */
+subclass($c_Consumer, $c_FileWatcher)
+STATIC_INIT_TO($y_watch_files, true)
+
+defun($h_FileWatcher) {
+#ifdef HAVE_SYS_INOTIFY_H
+  $i_Consumer_fd = inotify_init();
+  if (-1 == $i_Consumer_fd)
+    tx_rollback_errno($u_FileWatcher);
+  fcntl($i_Consumer_fd, F_SETFL, O_NONBLOCK);
+#endif
+  $mp_FileWatcher_buffers = hashmap_new_p();
+}
+
+/* Returns the FileWatcher, creating it if necessary, or NULL if files cannot
+ * be watched.
+ */
+static object file_watcher(void) {
+#ifdef HAVE_SYS_INOTIFY_H
+  if (!$o_file_watcher)
+    $o_file_watcher = $c_FileWatcher();
+  return $o_file_watcher;
+#else
+  return NULL;
+#endif
+}
+
+static void* wd_key(int wd) {
+  return (void*)(size_t)wd;
+}
+
+/*
+  SYMBOL: $f_FileBuffer_watch
+    Starts watching the file behind this FileBuffer, or, if it is already
+    watched, makes sure that the watch is on whatever file currently has its
+    name (which may have changed if the file was replaced). Has no effect for
+    memory-backed buffers, if $y_watch_files is false, or if the file does
+    not exist.
+
+  SYMBOL: $f_FileBuffer_unwatch
+    Stops watching the file behind this FileBuffer.
+
+  SYMBOL: $i_FileBuffer_watch
+    The inotify watch descriptor for the file of this FileBuffer, or 0 if it
+    is not being watched.
+
+  SYMBOL: $y_FileBuffer_changed_on_disk
+    Set to true when the file behind this FileBuffer changes while the buffer
+    is modified, such that the change could not be applied. Cleared when the
+    buffer is saved.
+ */
+defun($h_FileBuffer_watch) {
+#ifdef HAVE_SYS_INOTIFY_H
+  if ($y_FileBuffer_memory_backed || !$y_watch_files) return;
+
+  object watcher = file_watcher();
+  int fd = $(watcher, $i_Consumer_fd);
+  hashmap_p buffers = $(watcher, $mp_FileWatcher_buffers);
+
+  // If the name still refers to the same file, this returns the same
+  // descriptor.
+  int wd = inotify_add_watch(fd, wstrtocstr($w_FileBuffer_filename),
+                             WATCH_MASK);
+  if (wd == $i_FileBuffer_watch) return;
+
+  if (wd > 0)
+    hashmap_put_p(buffers, wd_key(wd), $o_FileBuffer);
+  $m_unwatch();
+  $i_FileBuffer_watch = wd > 0? wd : 0;
+#endif
+}
+
+defun($h_FileBuffer_unwatch) {
+#ifdef HAVE_SYS_INOTIFY_H
+  if (!$i_FileBuffer_watch) return;
+
+  object watcher = $o_file_watcher;
+  hashmap_p buffers = $(watcher, $mp_FileWatcher_buffers);
+  void** owner = hashmap_get_p(buffers, wd_key($i_FileBuffer_watch));
+  if (owner && *owner == $o_FileBuffer) {
+    hashmap_del_p(buffers, wd_key($i_FileBuffer_watch));
+    // Fails harmlessly if the file is already gone
+    inotify_rm_watch($(watcher, $i_Consumer_fd), $i_FileBuffer_watch);
+  }
+  $i_FileBuffer_watch = 0;
+#endif
+}
+
+advise_after($h_FileBuffer) {
+  $m_watch();
+}
+
+advise_before($h_FileBuffer_destroy) {
+  $m_unwatch();
+}
+
+advise_after($h_FileBuffer_saved) {
+  // Saving replaces the file, so the old watch is on the backup, if anything
+  $m_watch();
+  $y_FileBuffer_changed_on_disk = false;
+}
+
+/*
+  SYMBOL: $f_FileBuffer_disk_changed
+    Called by the FileWatcher when the file behind this FileBuffer may have
+    changed. If $y_FileBuffer_disk_replaced, the name may now refer to a
+    different file (or none), so the watch is renewed first. Applies the
+    change to the buffer as described in the OVERVIEW; the transaction is
+    rolled back if that fails.
+
+  SYMBOL: $y_FileBuffer_disk_replaced
+    Parameter to $f_FileBuffer_disk_changed.
+ */
+defun($h_FileBuffer_disk_changed) {
+  struct stat info;
+  int prev_watch = $i_FileBuffer_watch;
+  const struct disk_extent* extent = $p_FileBuffer_disk_extent;
+
+  // If the name still refers to the same file, this leaves the watch as it
+  // was, and the file is examined like any other change.
+  if ($y_FileBuffer_disk_replaced)
+    $m_watch();
+
+  if ($y_FileBuffer_modified) {
+    $y_FileBuffer_changed_on_disk = true;
+    return;
+  }
+
+  if (-1 == stat(wstrtocstr($w_FileBuffer_filename), &info)) {
+    // Deleted; keep what we have
+    $y_FileBuffer_changed_on_disk = true;
+    return;
+  }
+
+  if (!$aw_FileBuffer_contents && !$p_FileBuffer_stream) {
+    // Released or cold; just make sure that the next access sees the new
+    // contents.
+    $m_release();
+  } else if (prev_watch == $i_FileBuffer_watch &&
+             fb_disk_appended(info.st_size)) {
+    // Also covers events which leave the file as it was, such as touch(1)
+    if ((unsigned long long)info.st_size > extent->size)
+      $m_read_tail();
+  } else {
+    $m_release();
+    $m_access();
+  }
+}
+
+/* Runs $f_FileBuffer_disk_changed on the given buffer in its own transaction,
+ * reporting any failure as an error message on every Terminal, since the
+ * FileWatcher itself runs outside of any Workspace.
+ */
+static void apply_change(object buffer, bool replaced) {
+  __label__ error;
+  void on_rollback(void) {
+    goto error;
+  }
+
+  tx_start(on_rollback);
+  $M_disk_changed(0, buffer, $y_FileBuffer_disk_replaced = replaced);
+  tx_commit();
+  if (false) {
+    error:;
+    wstring message = cstrtowstr($s_rollback_reason);
+    REG_EACH(curr, $p_terminals) {
+      $$(curr->obj) {
+        $$($o_Terminal_current_view) {
+          $$($o_View_workspace) {
+            $$($o_Workspace_backing) {
+              $F_message_error(0,0, $w_message_text = message);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+/*
+  SYMBOL: $f_FileWatcher_read
+    Reads all pending inotify events and applies them to the FileBuffers they
+    concern. If the event queue overflowed, every watched FileBuffer is
+    checked.
+ */
+defun($h_FileWatcher_read) {
+#ifdef HAVE_SYS_INOTIFY_H
+  char events[4096]
+    __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+
+  while (0 < (len = read($i_Consumer_fd, events, sizeof(events)))) {
+    const struct inotify_event* event;
+    for (char* curr = events; curr < events + len;
+         curr += sizeof(struct inotify_event) + event->len) {
+      event = (const struct inotify_event*)curr;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        REG_EACH(buff, $p_buffers)
+          if ($(buff->obj, $i_FileBuffer_watch))
+            apply_change(buff->obj, true);
+        continue;
+      }
+
+      void** buffer = hashmap_get_p($mp_FileWatcher_buffers,
+                                    wd_key(event->wd));
+      // Events may still arrive for watches which have since been removed
+      if (!buffer || $(*buffer, $i_FileBuffer_watch) != event->wd)
+        continue;
+
+      apply_change(*buffer, !(event->mask & IN_MODIFY));
+    }
+  }
+#endif
+}
@@ -0,0 +1,119 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "gap_buffer.slc"
+
+#include "gap_buffer.h"
+
+/*
+  TITLE: Gap Buffer
+  OVERVIEW: Provides the gap_buffer, a text representation which keeps its
+    free space at the position currently being edited, so that typing,
+    deleting or pasting there does not need to move the rest of the text.
+*/
+
+gap_buffer* gb_new(const wchar_t* text, unsigned cnt) {
+  gap_buffer* this = new(gap_buffer);
+  this->size = cnt < 16? 16 : cnt;
+  this->v = gcalloc(this->size * sizeof(wchar_t));
+  if (cnt)
+    wmemcpy(this->v, text, cnt);
+  this->gap_begin = cnt;
+  this->gap_end = this->size;
+  return this;
+}
+
+void gb_copy(wchar_t* dst, const gap_buffer* this,
+             unsigned off, unsigned cnt) {
+  if (off < this->gap_begin) {
+    unsigned before = this->gap_begin - off;
+    if (before > cnt) before = cnt;
+    wmemcpy(dst, this->v + off, before);
+    dst += before;
+    off += before;
+    cnt -= before;
+  }
+
+  if (cnt)
+    wmemcpy(dst, this->v + off + (this->gap_end - this->gap_begin), cnt);
+}
+
+wchar_t* gb_text(const gap_buffer* this) {
+  unsigned len = gb_len(this);
+  wchar_t* dst = wcalloc(len + 1);
+  gb_copy(dst, this, 0, len);
+  return dst;
+}
+
+static void gb_move_gap(gap_buffer* this, unsigned to) {
+  unsigned gap = this->gap_end - this->gap_begin;
+
+  if (to < this->gap_begin)
+    wmemmove(this->v + to + gap, this->v + to, this->gap_begin - to);
+  else if (to > this->gap_begin)
+    wmemmove(this->v + this->gap_begin, this->v + this->gap_end,
+             to - this->gap_begin);
+
+  this->gap_begin = to;
+  this->gap_end = to + gap;
+}
+
+static void gb_reserve(gap_buffer* this, unsigned cnt) {
+  unsigned gap = this->gap_end - this->gap_begin, tail, old_size;
+  if (gap >= cnt) return;
+
+  old_size = this->size;
+  tail = old_size - this->gap_end;
+  this->size *= 2;
+  if (this->size - old_size + gap < cnt)
+    this->size = old_size - gap + cnt;
+
+  this->v = gcrealloc(this->v, this->size * sizeof(wchar_t));
+  wmemmove(this->v + this->size - tail, this->v + this->gap_end, tail);
+  this->gap_end = this->size - tail;
+}
+
+void gb_replace(gap_buffer* this, unsigned off, unsigned nremove,
+                const wchar_t* ins, unsigned nins) {
+  gb_move_gap(this, off);
+  this->gap_end += nremove;
+  gb_reserve(this, nins);
+  if (nins)
+    wmemcpy(this->v + this->gap_begin, ins, nins);
+  this->gap_begin += nins;
+}
+
+deftest(gap_buffer_edits) {
+  gap_buffer* gb = gb_new(L"hello world", 11);
+
+  gb_replace(gb, 5, 0, L",", 1);
+  gb_replace(gb, 0, 1, L"J", 1);
+  gb_replace(gb, 12, 0, L"!", 1);
+  assert(!wcscmp(L"Jello, world!", gb_text(gb)));
+
+  // Force the buffer to grow with the gap in the middle
+  for (unsigned i = 0; i < 100; ++i)
+    gb_replace(gb, 6, 0, L"-", 1);
+  assert(113 == gb_len(gb));
+  assert(L',' == gb_at(gb, 5));
+  assert(L'-' == gb_at(gb, 105));
+  assert(L' ' == gb_at(gb, 106));
+
+  gb_replace(gb, 6, 100, NULL, 0);
+  assert(!wcscmp(L"Jello, world!", gb_text(gb)));
+}
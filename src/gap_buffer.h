@@ -0,0 +1,76 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef GAP_BUFFER_H_
+#define GAP_BUFFER_H_
+
+/**
+ * A growable array of wchar_ts with a movable gap, suitable for text which is
+ * edited mostly near a single position (such as the point of a LineEditor).
+ * Insertions and deletions at the gap are O(1) amortised; moving the gap
+ * costs time proportional to the distance moved.
+ *
+ * The text is split into two runs: v[0..gap_begin) and v[gap_end..size).
+ * Instances are allocated on the heap with the GC.
+ */
+typedef struct gap_buffer {
+  wchar_t* v;
+  unsigned size, gap_begin, gap_end;
+} gap_buffer;
+
+/**
+ * Creates a new gap_buffer containing the first cnt characters of text (which
+ * may be NULL if cnt is zero).
+ */
+gap_buffer* gb_new(const wchar_t* text, unsigned cnt);
+
+/**
+ * Returns the number of characters in the gap_buffer.
+ */
+static inline unsigned gb_len(const gap_buffer* this) {
+  return this->size - (this->gap_end - this->gap_begin);
+}
+
+/**
+ * Returns the character at the given index, which must be less than
+ * gb_len().
+ */
+static inline wchar_t gb_at(const gap_buffer* this, unsigned ix) {
+  return this->v[ix < this->gap_begin? ix :
+                 ix + (this->gap_end - this->gap_begin)];
+}
+
+/**
+ * Copies cnt characters beginning at off into dst, without moving the gap.
+ */
+void gb_copy(wchar_t* dst, const gap_buffer*, unsigned off, unsigned cnt);
+
+/**
+ * Returns a newly-allocated NUL-terminated copy of the entire text.
+ */
+wchar_t* gb_text(const gap_buffer*);
+
+/**
+ * Replaces nremove characters beginning at off with the first nins characters
+ * of ins (which may be NULL if nins is zero). The gap is left immediately
+ * after the inserted text.
+ */
+void gb_replace(gap_buffer*, unsigned off, unsigned nremove,
+                const wchar_t* ins, unsigned nins);
+
+#endif /* GAP_BUFFER_H_ */
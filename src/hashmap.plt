@@ -0,0 +1,141 @@
+#ifndef HAVE_DEFINED_HASHMAP_HUNG
+#define HAVE_DEFINED_HASHMAP_HUNG
+
+struct hashmap_entry_HUNG {
+  typeof(CTYPE) key, value;
+  bool used;
+};
+
+typedef struct hashmap_HUNG {
+  size_t len, size;
+  struct hashmap_entry_HUNG* v;
+}* hashmap_HUNG;
+
+static inline size_t hashmap_hash_HUNG(typeof(CTYPE) key) {
+  unsigned long long bits = 0;
+  memcpy(&bits, &key,
+         sizeof(CTYPE) < sizeof(bits)? sizeof(CTYPE) : sizeof(bits));
+  // Fibonacci hashing; the high bits of the product are the best mixed, which
+  // matters for keys such as pointers whose low bits are always zero.
+  bits *= 0x9E3779B97F4A7C15ULL;
+  return bits >> 32;
+}
+
+/* Returns the entry holding key, or the unused entry where it would be
+ * inserted.
+ */
+static inline struct hashmap_entry_HUNG* hashmap_slot_HUNG(
+  hashmap_HUNG this, typeof(CTYPE) key
+) {
+  size_t mask = this->size - 1;
+  size_t ix = hashmap_hash_HUNG(key) & mask;
+  while (this->v[ix].used && this->v[ix].key != key)
+    ix = (ix + 1) & mask;
+
+  return this->v + ix;
+}
+
+static inline hashmap_HUNG hashmap_new_HUNG(void) {
+  hashmap_HUNG this = new(struct hashmap_HUNG);
+  this->size = 8;
+  this->v = gcalloc(this->size * sizeof(struct hashmap_entry_HUNG));
+  return this;
+}
+
+static inline typeof(CTYPE)* hashmap_get_HUNG(hashmap_HUNG this,
+                                              typeof(CTYPE) key) {
+  struct hashmap_entry_HUNG* entry = hashmap_slot_HUNG(this, key);
+  return entry->used? &entry->value : NULL;
+}
+
+static inline void hashmap_store_HUNG(hashmap_HUNG this,
+                                      typeof(CTYPE) key,
+                                      typeof(CTYPE) value) {
+  struct hashmap_entry_HUNG* entry = hashmap_slot_HUNG(this, key);
+  if (!entry->used) {
+    // Keep the load factor at or below 3/4
+    if ((this->len + 1) * 4 > this->size * 3) {
+      struct hashmap_entry_HUNG* old = this->v;
+      size_t old_size = this->size;
+      this->size *= 2;
+      this->v = gcalloc(this->size * sizeof(struct hashmap_entry_HUNG));
+      for (size_t i = 0; i < old_size; ++i)
+        if (old[i].used)
+          *hashmap_slot_HUNG(this, old[i].key) = old[i];
+
+      entry = hashmap_slot_HUNG(this, key);
+    }
+
+    entry->used = true;
+    entry->key = key;
+    ++this->len;
+  }
+
+  entry->value = value;
+}
+
+static inline bool hashmap_remove_HUNG(hashmap_HUNG this,
+                                       typeof(CTYPE) key) {
+  size_t mask = this->size - 1;
+  struct hashmap_entry_HUNG* entry = hashmap_slot_HUNG(this, key);
+  if (!entry->used) return false;
+
+  // Shift following entries of the same probe run back into the hole, so that
+  // lookups never need tombstones.
+  size_t hole = entry - this->v;
+  for (size_t ix = (hole + 1) & mask; this->v[ix].used; ix = (ix + 1) & mask) {
+    size_t home = hashmap_hash_HUNG(this->v[ix].key) & mask;
+    if (((ix - home) & mask) >= ((ix - hole) & mask)) {
+      this->v[hole] = this->v[ix];
+      hole = ix;
+    }
+  }
+
+  memset(this->v + hole, 0, sizeof(struct hashmap_entry_HUNG));
+  --this->len;
+  return true;
+}
+
+/* The state of one key before a modification, which rolling the transaction
+ * back restores.
+ */
+struct hashmap_undo_HUNG {
+  hashmap_HUNG map;
+  typeof(CTYPE) key, value;
+  bool used;
+};
+
+static inline void hashmap_undo_HUNG(void* vundo) {
+  struct hashmap_undo_HUNG* undo = vundo;
+  if (undo->used)
+    hashmap_store_HUNG(undo->map, undo->key, undo->value);
+  else
+    hashmap_remove_HUNG(undo->map, undo->key);
+}
+
+static inline void hashmap_record_HUNG(hashmap_HUNG this,
+                                       typeof(CTYPE) key) {
+  struct hashmap_entry_HUNG* entry = hashmap_slot_HUNG(this, key);
+  struct hashmap_undo_HUNG* undo = new(struct hashmap_undo_HUNG);
+  undo->map = this;
+  undo->key = key;
+  undo->value = entry->value;
+  undo->used = entry->used;
+  tx_push_undo(hashmap_undo_HUNG, undo);
+}
+
+static inline void hashmap_put_HUNG(hashmap_HUNG this,
+                                    typeof(CTYPE) key,
+                                    typeof(CTYPE) value) {
+  hashmap_record_HUNG(this, key);
+  hashmap_store_HUNG(this, key, value);
+}
+
+static inline bool hashmap_del_HUNG(hashmap_HUNG this, typeof(CTYPE) key) {
+  if (!hashmap_get_HUNG(this, key)) return false;
+
+  hashmap_record_HUNG(this, key);
+  return hashmap_remove_HUNG(this, key);
+}
+
+#endif /* HAVE_DEFINED_HASHMAP_HUNG */
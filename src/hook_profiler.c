@@ -0,0 +1,180 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  TITLE: Hook Profiler
+  OVERVIEW: Reports the counts and timings collected by the hook profiler in
+    common.c, which attributes time to individual hook points and hooked
+    functions rather than to invoke_hook() as a whole.
+*/
+
+#include "hook_profiler.slc"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#ifdef HAVE_EXECINFO_H
+#include <execinfo.h>
+#endif
+
+#include "key_dispatch.h"
+#include "cmdline.h"
+
+/*
+  SYMBOL: $s_hook_profile_file
+    The file to which hook profiles are written. Defaults to "sol-hooks.prof"
+    in the current directory, and can be changed with --profile-hooks.
+ */
+STATIC_INIT_TO($s_hook_profile_file, "sol-hooks.prof")
+
+static struct timespec profile_started;
+
+static int by_exclusive_time(const void* va, const void* vb) {
+  const hook_profile_entry* a = *(const hook_profile_entry*const*)va;
+  const hook_profile_entry* b = *(const hook_profile_entry*const*)vb;
+  return (a->exclusive_ns < b->exclusive_ns) -
+         (a->exclusive_ns > b->exclusive_ns);
+}
+
+static int by_calls(const void* va, const void* vb) {
+  const hook_profile_entry* a = *(const hook_profile_entry*const*)va;
+  const hook_profile_entry* b = *(const hook_profile_entry*const*)vb;
+  return (a->calls < b->calls) - (a->calls > b->calls);
+}
+
+/* Returns a printable name for a hooked function. Most hooked functions are
+ * static, so where the platform allows this gives an offset within the
+ * executable which can be resolved with addr2line.
+ */
+static string function_name(hook_function fun) {
+  static char buffer[256];
+#ifdef HAVE_EXECINFO_H
+  void* address = (void*)fun;
+  char** names = backtrace_symbols(&address, 1);
+  if (names) {
+    snprintf(buffer, sizeof(buffer), "%s", names[0]);
+    free(names);
+    return buffer;
+  }
+#endif
+  snprintf(buffer, sizeof(buffer), "%p", (void*)fun);
+  return buffer;
+}
+
+static void write_report(FILE* out) {
+  unsigned count;
+  hook_profile_entry** entries = hook_profile_entries(&count);
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  fprintf(out, "Hook profile covering %.3f seconds.\n\n",
+          (now.tv_sec - profile_started.tv_sec) +
+          (now.tv_nsec - profile_started.tv_nsec) / 1.0e9);
+
+  qsort(entries, count, sizeof(hook_profile_entry*), by_exclusive_time);
+  fprintf(out, "Hook points and hooked functions, by exclusive time:\n");
+  fprintf(out, "%12s %12s %12s  %s\n", "calls", "incl ms", "excl ms", "name");
+  for (unsigned i = 0; i < count; ++i) {
+    const hook_profile_entry* e = entries[i];
+    if (e->kind == HookProfileClass) continue;
+
+    fprintf(out, "%12llu %12.3f %12.3f  ", e->calls,
+            e->inclusive_ns / 1.0e6, e->exclusive_ns / 1.0e6);
+    if (e->kind == HookProfileHook)
+      fprintf(out, "%s\n", e->name ?: "(unnamed hook)");
+    else
+      fprintf(out, "  %s: %s\n", e->name ?: "(unnamed hook)",
+              function_name(e->fun));
+  }
+
+  qsort(entries, count, sizeof(hook_profile_entry*), by_calls);
+  fprintf(out, "\nContext switches, by class:\n");
+  fprintf(out, "%12s %12s  %s\n", "switches", "symbols", "class");
+  for (unsigned i = 0; i < count; ++i) {
+    const hook_profile_entry* e = entries[i];
+    if (e->kind != HookProfileClass) continue;
+
+    fprintf(out, "%12llu %12llu  %s\n", e->calls, e->symbols,
+            e->name ?: "(no class)");
+  }
+}
+
+/* Writes the current profile to $s_hook_profile_file, returning whether that
+ * succeeded.
+ */
+static bool save_report(void) {
+  FILE* out = fopen($s_hook_profile_file, "w");
+  if (!out) return false;
+
+  write_report(out);
+  return !fclose(out);
+}
+
+static void save_report_at_exit(void) {
+  if (!hook_profiling) return;
+
+  hook_profile_stop();
+  if (!save_report())
+    perror($s_hook_profile_file);
+}
+
+static void start_profiling(void) {
+  static bool registered_atexit = false;
+  if (!registered_atexit) {
+    atexit(save_report_at_exit);
+    registered_atexit = true;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &profile_started);
+  hook_profile_start();
+}
+
+def_cmdline_arg(-, profile_hooks, file,
+                "Profile hooks from startup, writing the report to <file> on "
+                "exit.") {
+  $s_hook_profile_file = file;
+  start_profiling();
+}
+
+/*
+  SYMBOL: $f_hook_profile_toggle
+    If the hook profiler is not running, discards any previous profile and
+    starts it. Otherwise, stops it and writes the report to
+    $s_hook_profile_file.
+ */
+defun($h_hook_profile_toggle) {
+  if (!hook_profiling) {
+    start_profiling();
+    $F_message_notice(0,0, $w_message_text = L"Hook profiling started");
+  } else {
+    hook_profile_stop();
+    if (!save_report())
+      tx_rollback_errno($u_hook_profile_toggle);
+
+    $F_message_notice(0,0, $w_message_text =
+                        wstrap(L"Hook profile written to ",
+                               cstrtowstr($s_hook_profile_file)));
+  }
+}
+
+class_keymap($c_Workspace, $$lp_hook_profiler_keymap, $llp_Workspace_keymap)
+ATSINIT {
+  bind_char($$lp_hook_profiler_keymap, $u_extended, CONTROL_P, $u_ground,
+            $f_hook_profile_toggle);
+}
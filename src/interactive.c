@@ -18,6 +18,7 @@
 */
 #include "interactive.slc"
 #include "key_dispatch.h"
+#include "registry.h"
 
 /*
   TITLE: Interactive Command Framework
@@ -112,8 +113,8 @@ defun($h_invoke_interactive) {
     if (!view) {
       object terminal = $o_Terminal;
       if (!terminal) {
-        if ($lo_terminals) {
-          terminal = $lo_terminals->car;
+        if (reg_first($p_terminals)) {
+          terminal = reg_first($p_terminals);
         } else {
           // Last resort: Pick an arbitrary workspace (we're currently headless,
           // so just pick a workspace arbitrarily.)
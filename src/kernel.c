@@ -26,12 +26,15 @@
 
 #include "kernel.slc"
 
+#include "registry.h"
+
 #include <signal.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <poll.h>
 #include <errno.h>
+#include <time.h>
 
 static void handle_sigchld(int, siginfo_t*, void*);
 static void handle_quit(int);
@@ -182,15 +185,20 @@ static void handle_fatal(int which) {
     is available.
 
   SYMBOL: $f_Consumer_destroy
-    Removes the Consumer from the consumer list.
+    Removes the Consumer from the consumer registry.
+
+  SYMBOL: $p_Consumer_registration
+    The registry_node of this Consumer within the consumer registry.
  */
+STATIC_INIT_TO($$p_consumers, reg_new())
+STATIC_INIT_TO($$p_producers, reg_new())
 
 defun($h_Consumer) {
-  $$lo_consumers = cons_o($o_Consumer, $$lo_consumers);
+  $p_Consumer_registration = reg_add($$p_consumers, $o_Consumer);
 }
 
 defun($h_Consumer_destroy) {
-  $$lo_consumers = lrm_o($$lo_consumers, $o_Consumer);
+  reg_remove($p_Consumer_registration);
 }
 
 /*
@@ -207,15 +215,18 @@ defun($h_Consumer_destroy) {
     POLLHUP, and POLLERR for the Producer's file descriptor. (See poll(2).)
 
   SYMBOL: $f_Producer_destroy
-    Removes the Producer from the producer list.
+    Removes the Producer from the producer registry.
+
+  SYMBOL: $p_Producer_registration
+    The registry_node of this Producer within the producer registry.
  */
 
 defun($h_Producer) {
-  $$lo_producers = cons_o($o_Producer, $$lo_producers);
+  $p_Producer_registration = reg_add($$p_producers, $o_Producer);
 }
 
 defun($h_Producer_destroy) {
-  $$lo_producers = lrm_o($$lo_producers, $o_Producer);
+  reg_remove($p_Producer_registration);
 }
 
 /*
@@ -226,6 +237,37 @@ advise_before($h_kernel_main) {
   $y_keep_running = true;
 }
 
+/*
+  SYMBOL: $y_gc_incremental
+    If true (the default), the garbage collector is switched to incremental
+    (and, where the platform supports it, generational) mode when the kernel
+    starts, so that collections triggered by allocation are split into short
+    slices instead of stopping the world for a full mark. Changes after
+    $f_kernel_main has begun have no effect.
+
+  SYMBOL: $I_gc_free_space_divisor
+    Controls how eagerly the heap grows instead of collecting; see
+    GC_set_free_space_divisor(). Larger values collect more often and keep the
+    heap smaller; smaller values grow the heap and collect less often. Applied
+    when the kernel starts. Zero leaves the collector's default in place.
+
+  SYMBOL: $I_gc_idle_collect_ms
+    If non-zero, once there has been no I/O activity for this many
+    milliseconds, and anything has been allocated since the last collection,
+    the kernel performs one full collection while it would otherwise be
+    waiting for input.
+ */
+STATIC_INIT_TO($y_gc_incremental, true)
+STATIC_INIT_TO($I_gc_idle_collect_ms, 2000)
+advise_before($h_kernel_main) {
+  if ($I_gc_free_space_divisor)
+    GC_set_free_space_divisor($I_gc_free_space_divisor);
+  // This must happen after our own SIGSEGV handler is installed, since the
+  // collector may chain to it for its write barrier.
+  if ($y_gc_incremental)
+    GC_enable_incremental();
+}
+
 /*
   SYMBOL: $f_kernel_main
     The main loop of the kernel. Typically called once for the whole program.
@@ -255,7 +297,64 @@ defun($h_kernel_main) {
     the next kernel cycle will begin in approximately
     $i_kernel_poll_duration_ms milliseconds or after the next I/O event,
     whichever comes first.
+    --
+    Garbage collection work is only done when the cycle would otherwise block
+    waiting for I/O; see $y_gc_incremental and $I_gc_idle_collect_ms. The
+    transient arena (see arena_alloc() in common.h) is reset at the end of
+    each cycle.
  */
+/*
+  SYMBOL: $I_gc_pause_count $I_gc_pause_last_us $I_gc_pause_max_us
+    Statistics on the collector work done by the kernel while idle: the number
+    of slices or idle collections performed, and the duration of the most
+    recent and the longest, in microseconds.
+ */
+static void gc_pause_end(unsigned long long start) {
+  unsigned pause = now_us() - start;
+  ++$I_gc_pause_count;
+  $I_gc_pause_last_us = pause;
+  if (pause > $I_gc_pause_max_us)
+    $I_gc_pause_max_us = pause;
+}
+
+// Time (per now_us()) of the most recent I/O activity, and whether the idle
+// collection has been performed since then.
+static unsigned long long last_activity_us;
+static bool has_collected_since_activity;
+
+/* Performs some garbage collection work, given that the kernel is about to
+ * block for up to *timeout_ms (or indefinitely if *infinite). Returns whether
+ * more work remains which should be done before blocking; otherwise, the
+ * timeout may be reduced so that the idle collection happens on time.
+ */
+static bool collect_while_idle(int* timeout_ms, bool* infinite) {
+  unsigned long long start = now_us(), idle_ms;
+  bool more;
+
+  more = GC_collect_a_little();
+  gc_pause_end(start);
+  if (more) return true;
+
+  if (!$I_gc_idle_collect_ms || has_collected_since_activity)
+    return false;
+
+  idle_ms = (start - last_activity_us) / 1000;
+  if (idle_ms >= $I_gc_idle_collect_ms) {
+    if (GC_get_bytes_since_gc()) {
+      start = now_us();
+      GC_gcollect();
+      gc_pause_end(start);
+    }
+    has_collected_since_activity = true;
+  } else if (*infinite ||
+             *timeout_ms > (int)($I_gc_idle_collect_ms - idle_ms)) {
+    *infinite = false;
+    *timeout_ms = $I_gc_idle_collect_ms - idle_ms;
+  }
+
+  return false;
+}
+
 defun($h_kernel_cycle) {
   // Reset poll duration variables, then run one cycle for all tasks. If any
   // need to altern the poll duration, they can do so.
@@ -263,73 +362,86 @@ defun($h_kernel_cycle) {
   $y_kernel_poll_infinite = true;
   $f_run_tasks();
 
-  if (GC_collect_a_little()) {
-    $y_kernel_poll_infinite = false;
-    $i_kernel_poll_duration_ms = 0;
-  }
-
-  unsigned fdcount = llen_o($$lo_producers) + llen_o($$lo_consumers);
+  registry* consumers = $$p_consumers, * producers = $$p_producers;
+  unsigned nconsumers = consumers->len;
+  unsigned fdcount = nconsumers + producers->len;
   {
     struct pollfd fds[fdcount];
+    // The Consumers and Producers polled, in the same order as fds, so that
+    // those which register or deregister while dispatching do not disturb the
+    // correspondence.
+    object polled[fdcount];
     unsigned ix = 0;
-    void inputfd(object obj) {
-      fds[ix].fd = $(obj, $i_Consumer_fd);
+    REG_EACH(curr, consumers) {
+      polled[ix] = curr->obj;
+      fds[ix].fd = $(curr->obj, $i_Consumer_fd);
       fds[ix].events = POLLIN | POLLPRI;
       ++ix;
     }
-    each_o($$lo_consumers, inputfd);
-
-    void outputfd(object obj) {
-      fds[ix].fd = $(obj, $i_Producer_fd);
+    REG_EACH(curr, producers) {
+      polled[ix] = curr->obj;
+      fds[ix].fd = $(curr->obj, $i_Producer_fd);
       fds[ix].events = POLLOUT;
+      ++ix;
     }
-    each_o($$lo_producers, outputfd);
 
-    sigset_t allow_all;
-    sigemptyset(&allow_all);
+    int do_poll(int timeout_ms, bool infinite) {
+      sigset_t allow_all;
+      sigemptyset(&allow_all);
 #ifdef HAVE_PPOLL
-    struct timespec timeout = {
-      .tv_sec = $i_kernel_poll_duration_ms / 1000,
-      .tv_nsec = ($i_kernel_poll_duration_ms % 1000) * 1000000L,
-    };
-
-    int ret = ppoll(fds, fdcount,
-                    $y_kernel_poll_infinite? NULL : &timeout,
-                    &allow_all);
+      struct timespec timeout = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_nsec = (timeout_ms % 1000) * 1000000L,
+      };
+
+      return ppoll(fds, fdcount, infinite? NULL : &timeout, &allow_all);
 #else
-    // Race condition, but at worst will stall things until the next keystroke
-    sigset_t oldsigset;
-    sigprocmask(SIG_SETMASK, &allow_all, &oldsigset);
-    int ret = poll(fds, fdcount,
-                   $y_kernel_poll_infinite? -1 : $i_kernel_poll_duration_ms);
-    sigprocmask(SIG_SETMASK, &oldsigset, NULL);
+      // Race condition, but at worst will stall things until the next
+      // keystroke
+      sigset_t oldsigset;
+      sigprocmask(SIG_SETMASK, &allow_all, &oldsigset);
+      int ret = poll(fds, fdcount, infinite? -1 : timeout_ms);
+      sigprocmask(SIG_SETMASK, &oldsigset, NULL);
+      return ret;
 #endif
+    }
+
+    // Garbage collection only happens when there is nothing else to do, so
+    // that it never delays the response to input which is already waiting.
+    int timeout_ms = $i_kernel_poll_duration_ms;
+    bool infinite = $y_kernel_poll_infinite;
+    int ret = do_poll(0, false);
+    if (0 == ret && (infinite || timeout_ms > 0)) {
+      if (!collect_while_idle(&timeout_ms, &infinite))
+        ret = do_poll(timeout_ms, infinite);
+      // Otherwise, return without blocking so the next cycle can continue
+      // collecting (after checking for input again).
+    }
 
     if (ret == -1) {
       //Error
       if (errno != EINTR)
         perror("poll");
     } else if (ret) {
+      last_activity_us = now_us();
+      has_collected_since_activity = false;
+
       //One or more input sources ready
-      ix = 0;
-      void pr_input(object obj) {
+      for (ix = 0; ix < nconsumers; ++ix)
         if (fds[ix].revents)
-          $M_read(0, obj,
+          $M_read(0, polled[ix],
                   $y_Consumer_has_priority =
                       (fds[ix].revents & POLLPRI));
-        ++ix;
-      }
-      each_o($$lo_consumers, pr_input);
 
-      void pr_output(object obj) {
+      for (; ix < fdcount; ++ix)
         if (fds[ix].revents)
-          $M_write(0, obj,
+          $M_write(0, polled[ix],
                    $y_Producer_ready = (fds[ix].revents & POLLOUT),
                    $y_Producer_hungup = (fds[ix].revents & POLLHUP),
                    $y_Producer_error = (fds[ix].revents & POLLERR));
-        ++ix;
-      }
-      each_o($$lo_producers, pr_output);
     }
   }
+
+  // Everything allocated for this cycle's keystrokes and frames is now dead
+  arena_reset();
 }
@@ -139,6 +139,12 @@ static bool search(list_lp list, qchar key) {
     will be changed to what the keybinding requests if not NULL, so mode
     switches should not be combined with functions which may potentially set
     this to true.
+
+  SYMBOL: $y_key_dispatch_timed $I_key_dispatch_command_us
+    If $y_key_dispatch_timed is true, the time spent running bound commands
+    (including the commit or rollback of their transactions) is added to
+    $I_key_dispatch_command_us, in microseconds. Used by keystroke replay (see
+    keystroke_log.c).
  */
 static bool search_one(list_lp llst, qchar key) {
   for (list_lp llcurr = llst; llcurr; llcurr = llcurr->cdr) {
@@ -152,6 +158,7 @@ static bool search_one(list_lp llst, qchar key) {
           void on_rollback(void) {
             goto error;
           }
+          unsigned long long start = $y_key_dispatch_timed? now_us() : 0;
           tx_start(on_rollback);
           kb->function();
           tx_commit();
@@ -164,6 +171,8 @@ static bool search_one(list_lp llst, qchar key) {
             let($w_message_text, str);
             $f_message_error();
           }
+          if ($y_key_dispatch_timed)
+            $I_key_dispatch_command_us += now_us() - start;
         } else {
           // Nothing is being run; move the previous command back to the
           // current
@@ -193,25 +202,20 @@ keybinding* mk_keybinding(qchar qch, identity mode, identity newmode,
 }
 
 /*
-  SYMBOL: $lp_mode_names
+  SYMBOL: $mp_mode_names
     A indentity-wstring map which names the values stored in
     $v_Terminal_key_mode.
  */
 ATSINIT {
-  $lp_mode_names =
-    lmput_p(
-      lmput_p(
-        lmput_p(
-          $lp_mode_names,
-          $u_meta, L"M-"),
-        $u_extended, L"^X "),
-      $u_extended_meta, L"^X M-");
+  $mp_mode_names = hashmap_new_p();
+  hashmap_put_p($mp_mode_names, $u_meta, L"M-");
+  hashmap_put_p($mp_mode_names, $u_extended, L"^X ");
+  hashmap_put_p($mp_mode_names, $u_extended_meta, L"^X M-");
 }
 
 defun($h_key_undefined) {
-  list_p lprefix = lmget_p($lp_mode_names,
-                           $v_Terminal_key_mode);
-  wstring prefix = (lprefix? lprefix->car : L"");
+  void** pprefix = hashmap_get_p($mp_mode_names, $v_Terminal_key_mode);
+  wstring prefix = (pprefix? *pprefix : L"");
 
   wstring wkeyname;
 
@@ -0,0 +1,323 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  TITLE: Keystroke Recording and Replay
+  OVERVIEW: Records the raw keystrokes read by Terminals, with their timing, to
+    a compact binary file; and replays such files, reporting how long each
+    phase of processing every keystroke took. This allows slow real-world
+    sessions to be reproduced and attached to bug reports.
+*/
+
+#include "keystroke_log.slc"
+#include "registry.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cmdline.h"
+
+/*
+  The file format is the 8-byte magic string below, followed by one record per
+  keystroke. Each record is two unsigned LEB128 integers: the number of
+  microseconds since the previous keystroke (or since recording began), and
+  the raw $x_Terminal_input_value, before keyboard layout translation. A
+  typical keystroke thus takes three or four bytes.
+ */
+static const char magic[8] = "SOLKEYS1";
+
+static void put_varint(FILE* out, unsigned long long value) {
+  while (value >= 0x80) {
+    fputc(0x80 | (value & 0x7F), out);
+    value >>= 7;
+  }
+  fputc(value, out);
+}
+
+static bool get_varint(FILE* in, unsigned long long* value) {
+  *value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    int byte = fgetc(in);
+    if (EOF == byte) return false;
+
+    *value |= (unsigned long long)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+
+  return false;
+}
+
+/*
+  SYMBOL: $p_keystroke_record_file
+    If non-NULL, a FILE* to which every keystroke read by any Terminal is
+    recorded. Set by the --record command-line argument.
+
+  SYMBOL: $u_keystroke_recorder
+    Identifies the recorder's advice on $h_Terminal_getch. It runs before
+    keyboard layout translation ($u_kb_xlate), so that replayed keystrokes are
+    translated just as the originals were.
+ */
+static unsigned long long last_keystroke_us;
+
+def_cmdline_arg(-, record, file,
+                "Record all keystrokes, with their timing, to <file>.") {
+  if (!($p_keystroke_record_file = fopen(file, "wb")) ||
+      1 != fwrite(magic, sizeof(magic), 1, $p_keystroke_record_file)) {
+    perror(file);
+    exit(1);
+  }
+
+  last_keystroke_us = now_us();
+}
+
+static void record_keystroke(void) {
+  if (!$p_keystroke_record_file) return;
+
+  unsigned long long now = now_us();
+  put_varint($p_keystroke_record_file, now - last_keystroke_us);
+  put_varint($p_keystroke_record_file, $x_Terminal_input_value);
+  // Flush every time so that the trace survives a crash; this costs one
+  // write() per keystroke, which is nothing at human typing speeds.
+  fflush($p_keystroke_record_file);
+  last_keystroke_us = now;
+}
+
+static hook_constraint before_kb_xlate(identity this_id, identity this_class,
+                                       identity that_id,
+                                       identity that_class) {
+  if (that_id == $u_kb_xlate)
+    return HookConstraintBefore;
+  return HookConstraintNone;
+}
+
+ATSTART(install_keystroke_recorder, ADVICE_INSTALLATION_PRIORITY) {
+  add_hook(&$h_Terminal_getch, HOOK_BEFORE,
+           $u_keystroke_recorder, NULL,
+           record_keystroke, before_kb_xlate);
+}
+
+/*
+  SYMBOL: $y_keystroke_replay_paced
+    If true, replayed keystrokes are delivered with the same delays between
+    them as when they were recorded. Otherwise, each is delivered as soon as
+    the kernel has finished with the previous one. Set by the --replay-paced
+    command-line argument.
+ */
+typedef struct {
+  unsigned long long delay_us;
+  qchar value;
+} keystroke;
+
+static keystroke* replay_keys;
+static unsigned replay_len, replay_next;
+static unsigned long long replay_due_us;
+static bool replaying;
+
+/* Histograms have power-of-two buckets: bucket 0 counts times under 2us, and
+ * bucket N times in [2**N, 2**(N+1)) us; the last is open-ended.
+ */
+#define NBUCKETS 24
+typedef struct {
+  string name, description;
+  unsigned long long total_us, max_us;
+  unsigned counts[NBUCKETS];
+} phase;
+
+static phase phase_dispatch = {
+  "dispatch", "the whole keystroke, including the following two" };
+static phase phase_transaction = {
+  "transaction", "the bound command, including commit or rollback" };
+static phase phase_render = {
+  "render", "painting lines and the echo area" };
+static phase phase_refresh = {
+  "refresh", "sending the frame to the terminal" };
+
+static void add_sample(phase* p, unsigned long long us) {
+  unsigned bucket = 0;
+  while (bucket < NBUCKETS-1 && us >> (bucket+1))
+    ++bucket;
+
+  ++p->counts[bucket];
+  p->total_us += us;
+  if (us > p->max_us)
+    p->max_us = us;
+}
+
+/* Returns the upper bound of the bucket containing the given fraction of
+ * samples.
+ */
+static unsigned long long percentile(const phase* p, double fraction) {
+  unsigned target = (unsigned)(replay_next * fraction), seen = 0;
+  for (unsigned i = 0; i < NBUCKETS; ++i) {
+    seen += p->counts[i];
+    if (seen > target)
+      return 2ULL << i;
+  }
+
+  return p->max_us;
+}
+
+static void print_phase(const phase* p) {
+  unsigned most = 1;
+  for (unsigned i = 0; i < NBUCKETS; ++i)
+    if (p->counts[i] > most)
+      most = p->counts[i];
+
+  printf("%s (%s):\n", p->name, p->description);
+  printf("  mean %.1fus, p50 < %lluus, p99 < %lluus, max %lluus\n",
+         replay_next? p->total_us / (double)replay_next : 0.0,
+         percentile(p, 0.5), percentile(p, 0.99), p->max_us);
+  for (unsigned i = 0; i < NBUCKETS; ++i) {
+    if (!p->counts[i]) continue;
+
+    printf("  %9lluus %8u ", 2ULL << i, p->counts[i]);
+    for (unsigned j = 0; j < p->counts[i] * 50 / most; ++j)
+      putchar('#');
+    putchar('\n');
+  }
+}
+
+static void print_replay_report(void) {
+  printf("Replayed %u of %u keystrokes%s.\n", replay_next, replay_len,
+         $y_keystroke_replay_paced? " at recorded pace" : "");
+  printf("Times are inclusive; bucket labels are exclusive upper bounds.\n");
+  print_phase(&phase_dispatch);
+  print_phase(&phase_transaction);
+  print_phase(&phase_render);
+  print_phase(&phase_refresh);
+}
+
+def_cmdline_arg(-, replay, file,
+                "Replay the keystrokes recorded in <file> (see --record), "
+                "print how long they took to process, and exit.") {
+  FILE* in = fopen(file, "rb");
+  char header[sizeof(magic)];
+  if (!in) {
+    perror(file);
+    exit(1);
+  }
+  if (1 != fread(header, sizeof(header), 1, in) ||
+      memcmp(header, magic, sizeof(magic))) {
+    fprintf(stderr, "%s: not a keystroke recording\n", file);
+    exit(1);
+  }
+
+  unsigned capacity = 256;
+  unsigned long long delay, value;
+  replay_keys = gcalloc(capacity * sizeof(keystroke));
+  while (get_varint(in, &delay) && get_varint(in, &value)) {
+    if (replay_len == capacity) {
+      capacity *= 2;
+      replay_keys = gcrealloc(replay_keys, capacity * sizeof(keystroke));
+    }
+
+    replay_keys[replay_len].delay_us = delay;
+    replay_keys[replay_len].value = value;
+    ++replay_len;
+  }
+  fclose(in);
+
+  if (!isatty(STDOUT_FILENO))
+    $y_Terminal_headless = true;
+
+  replaying = true;
+  $y_key_dispatch_timed = true;
+  atexit(print_replay_report);
+}
+
+def_cmdline_arg(-, replay_paced, none,
+                "With --replay, deliver keystrokes at the pace at which they "
+                "were recorded.") {
+  $y_keystroke_replay_paced = true;
+}
+
+static unsigned long long render_start_us, render_us;
+static unsigned render_depth;
+
+static void render_begin(void) {
+  if (replaying && !render_depth++)
+    render_start_us = now_us();
+}
+
+static void render_end(void) {
+  if (replaying && render_depth && !--render_depth)
+    render_us += now_us() - render_start_us;
+}
+
+advise_before($h_View_paint_line) { render_begin(); }
+advise_after($h_View_paint_line) { render_end(); }
+advise_before($h_Workspace_draw_echo_area) { render_begin(); }
+advise_after($h_Workspace_draw_echo_area) { render_end(); }
+
+static void replay_one(const keystroke* key) {
+  object terminal = reg_first($p_terminals);
+  unsigned long long command_us = $I_key_dispatch_command_us;
+  render_us = 0;
+  render_depth = 0;
+
+  unsigned long long start = now_us();
+  $$(terminal) {
+    $x_Terminal_input_value = key->value;
+    $f_Terminal_getch();
+  }
+  unsigned long long dispatched = now_us();
+  $M_flush(0, terminal);
+  unsigned long long refreshed = now_us();
+
+  add_sample(&phase_dispatch, dispatched - start);
+  add_sample(&phase_transaction, $I_key_dispatch_command_us - command_us);
+  add_sample(&phase_render, render_us);
+  add_sample(&phase_refresh, refreshed - dispatched);
+}
+
+advise($h_run_tasks) {
+  if (!replaying || !reg_first($p_terminals)) return;
+
+  if (replay_next == replay_len) {
+    replaying = false;
+    $y_keep_running = false;
+    // Don't block waiting for input that will never come
+    $y_kernel_poll_infinite = false;
+    $i_kernel_poll_duration_ms = 0;
+    return;
+  }
+
+  unsigned long long now = now_us();
+  if (!replay_next)
+    replay_due_us = now + replay_keys[0].delay_us;
+
+  if ($y_keystroke_replay_paced && now < replay_due_us) {
+    int wait_ms = (replay_due_us - now + 999) / 1000;
+    if ($y_kernel_poll_infinite || $i_kernel_poll_duration_ms > wait_ms) {
+      $y_kernel_poll_infinite = false;
+      $i_kernel_poll_duration_ms = wait_ms;
+    }
+    return;
+  }
+
+  replay_one(&replay_keys[replay_next++]);
+  if (replay_next < replay_len)
+    replay_due_us += replay_keys[replay_next].delay_us;
+
+  // Come back as soon as the kernel has dealt with anything else that is
+  // ready, instead of waiting for input.
+  $y_kernel_poll_infinite = false;
+  $i_kernel_poll_duration_ms = 0;
+}
@@ -91,9 +91,11 @@ advise_id_after($u_line_format_adapter, $h_LineEditor_get_echo_area_contents) {
   $f_line_format_check();
 
   if ($y_line_format_change) {
-    $Q_line_format = qcalloc($I_line_format_size+1);
+    // The echo area is redrawn from scratch every frame, so these are
+    // transient
+    $Q_line_format = arena_qcalloc($I_line_format_size+1);
     if ($y_line_format_needs_back_buffer)
-      $Q_line_format_back = qcalloc($I_line_format_size+1);
+      $Q_line_format_back = arena_qcalloc($I_line_format_size+1);
     qstrlcpy($Q_line_format, $q_line_format, $I_line_format_size+1);
     $f_line_format_move();
     $q_Workspace_echo_area_contents = $Q_line_format;
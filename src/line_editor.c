@@ -22,6 +22,8 @@
 #include <wctype.h>
 #include "key_dispatch.h"
 #include "interactive.h"
+#include "gap_buffer.h"
+#include "bench.h"
 
 /*
   TITLE: Line Editor Abstract Class
@@ -64,9 +66,12 @@ STATIC_INIT_TO($v_Workspace_echo_mode, $u_echo_on)
     If non-NULL, the initial text for the LineEditor when it is
     constructed. Otherwise, the initial text is the empty string.
 
-  SYMBOL: $az_LineEditor_buffer
-    An array of integers (wchar_ts) which comprise the current text of the
-    LineEditor.
+  SYMBOL: $p_LineEditor_buffer
+    A gap_buffer* (see gap_buffer.h) holding the current text of the
+    LineEditor. Edits happen at the gap, which therefore generally sits at
+    point, so typing, deleting and yanking there take constant amortised time
+    regardless of the length of the line. Use gb_len() and gb_at() to read
+    it, and gb_text() to obtain a contiguous copy.
 
   SYMBOL: $v_LineEditor_echo_mode
     The echo mode specific to this LineEditor. If NULL, it is inherited from
@@ -76,17 +81,14 @@ STATIC_INIT_TO($i_LineEditor_point, -1)
 
 defun($h_LineEditor) {
   if (!$w_LineEditor_text)
-    $az_LineEditor_buffer = dynar_new_z();
-  else {
-    $az_LineEditor_buffer = dynar_new_z();
-    dynar_expand_by_z($az_LineEditor_buffer, wcslen($w_LineEditor_text));
-    for (unsigned i = 0; $w_LineEditor_text[i]; ++i)
-      $az_LineEditor_buffer->v[i] = $w_LineEditor_text[i];
-  }
+    $p_LineEditor_buffer = gb_new(NULL, 0);
+  else
+    $p_LineEditor_buffer = gb_new($w_LineEditor_text,
+                                  wcslen($w_LineEditor_text));
 
   if (-1 == $i_LineEditor_point ||
-      $i_LineEditor_point > $az_LineEditor_buffer->len)
-    $i_LineEditor_point = $az_LineEditor_buffer->len;
+      $i_LineEditor_point > gb_len($p_LineEditor_buffer))
+    $i_LineEditor_point = gb_len($p_LineEditor_buffer);
 }
 
 /*
@@ -99,24 +101,32 @@ defun($h_LineEditor_destroy) {
 
 /*
   SYMBOL: $f_LineEditor_push_undo
-    Pushes a copy of the current edit buffer onto the undo stack, and clears
-    the redo stack. The current top of the undo stack will be preserved if
+    Marks the beginning of a new undo step and clears the redo stack. Edits
+    made via $f_LineEditor_edit() after this call are undone together. The
+    current undo step will instead be continued if
     $y_LineEditor_edit_is_minor is true,
     $y_LineEditor_previous_edit_was_minor is true, and
     $i_LineEditor_last_edit is still equal to time(0).
 
-  SYMBOL: $laz_LineEditor_undo
-    A list of copies of former values of $az_LineEditor_buffer, representing
-    states that the user can undo back to.
+  SYMBOL: $lp_LineEditor_undo
+    A list of undo steps (of type struct undo_step*, private to
+    line_editor.c), most recent first, representing changes that the user can
+    undo. Each step records the deltas that were applied to
+    $p_LineEditor_buffer rather than a copy of it, so memory use is
+    proportional to the amount of text changed.
 
-  SYMBOL: $laz_LineEditor_redo
-    A list of copies of former values of $az_LineEditor_buffer, representing
-    states that the user moved away from by using undo.
+  SYMBOL: $lp_LineEditor_redo
+    A list of undo steps (see $lp_LineEditor_undo) representing changes that
+    the user moved away from by using undo.
+
+  SYMBOL: $y_LineEditor_undo_boundary
+    If true, the next call to $f_LineEditor_edit() begins a new undo step
+    instead of extending the one at the top of $lp_LineEditor_undo.
 
   SYMBOL: $y_LineEditor_edit_is_minor
     Indicates whether the current edit to the LineEditor buffer is
-    "minor". Consecutive minor edits made in short succession will not push
-    multiple states onto the undo stack. This is reset to false after calls to
+    "minor". Consecutive minor edits made in short succession are grouped into
+    a single undo step. This is reset to false after calls to
     $f_LineEditor_push_undo().
 
   SYMBOL: $y_LineEditor_previous_edit_was_minor
@@ -130,18 +140,121 @@ defun($h_LineEditor_push_undo) {
   if (!$y_LineEditor_edit_is_minor ||
       !$y_LineEditor_previous_edit_was_minor ||
       time(0) != $i_LineEditor_last_edit)
-    lpush_az($laz_LineEditor_undo, dynar_clone_z($az_LineEditor_buffer));
+    $y_LineEditor_undo_boundary = true;
 
   $y_LineEditor_previous_edit_was_minor = $y_LineEditor_edit_is_minor;
   $i_LineEditor_last_edit = time(0);
 
-  $laz_LineEditor_redo = NULL;
+  $lp_LineEditor_redo = NULL;
   $y_LineEditor_edit_is_minor = false;
 }
 
+/* A single change to a LineEditor buffer: the nremoved characters in
+ * removed, beginning at off, were replaced by the ninserted characters in
+ * inserted. The strings are not NUL-terminated, since the buffer may contain
+ * arbitrary control characters.
+ */
+typedef struct undo_delta {
+  unsigned off, nremoved, ninserted;
+  wchar_t* removed, * inserted;
+  struct undo_delta* prev, * next;
+} undo_delta;
+
+/* A group of deltas which are undone and redone together. */
+typedef struct undo_step {
+  undo_delta* first, * last;
+} undo_step;
+
+static wchar_t* wmemcat(const wchar_t* a, unsigned na,
+                        const wchar_t* b, unsigned nb) {
+  wchar_t* dst = wcalloc(na + nb + 1);
+  wmemcpy(dst, a, na);
+  wmemcpy(dst + na, b, nb);
+  return dst;
+}
+
+static void apply_delta(unsigned off, unsigned nremove,
+                        const wchar_t* ins, unsigned nins) {
+  gb_replace($p_LineEditor_buffer, off, nremove, ins, nins);
+}
+
+static void edit(unsigned off, unsigned nremove,
+                 const wchar_t* ins, unsigned nins) {
+  wchar_t* removed = wcalloc(nremove + 1);
+  undo_step* step;
+  undo_delta* last;
+
+  gb_copy(removed, $p_LineEditor_buffer, off, nremove);
+
+  if ($y_LineEditor_undo_boundary || !$lp_LineEditor_undo) {
+    lpush_p($lp_LineEditor_undo, new(undo_step));
+    $y_LineEditor_undo_boundary = false;
+  }
+
+  step = $lp_LineEditor_undo->car;
+  last = step->last;
+
+  if (last && off == last->off + last->ninserted) {
+    // Continues forward from the previous delta (eg, typing)
+    last->removed = wmemcat(last->removed, last->nremoved, removed, nremove);
+    last->inserted = wmemcat(last->inserted, last->ninserted, ins, nins);
+    last->nremoved += nremove;
+    last->ninserted += nins;
+  } else if (last && !nins && !last->ninserted &&
+             off + nremove == last->off) {
+    // Continues a deletion backward (eg, repeated backspace)
+    last->removed = wmemcat(removed, nremove, last->removed, last->nremoved);
+    last->nremoved += nremove;
+    last->off = off;
+  } else {
+    undo_delta* delta = new(undo_delta);
+    delta->off = off;
+    delta->nremoved = nremove;
+    delta->ninserted = nins;
+    delta->removed = removed;
+    delta->inserted = wmemcat(ins, nins, NULL, 0);
+    delta->prev = last;
+    if (last)
+      last->next = delta;
+    else
+      step->first = delta;
+    step->last = delta;
+  }
+
+  apply_delta(off, nremove, ins, nins);
+}
+
+/*
+  SYMBOL: $f_LineEditor_edit
+    Replaces $I_LineEditor_edit_length characters of $p_LineEditor_buffer,
+    beginning at $I_LineEditor_edit_offset, with the first
+    $I_LineEditor_edit_insertion_length characters of
+    $w_LineEditor_edit_insertion, recording the change in the current undo
+    step. Callers should call $f_LineEditor_push_undo() before beginning a
+    logical change. Neither point nor the echo area is updated.
+
+  SYMBOL: $I_LineEditor_edit_offset
+    The index of the first character to replace in $f_LineEditor_edit().
+
+  SYMBOL: $I_LineEditor_edit_length
+    The number of characters to remove in $f_LineEditor_edit().
+
+  SYMBOL: $w_LineEditor_edit_insertion
+    The text to insert in $f_LineEditor_edit(). It need not be NUL-terminated,
+    and may be NULL if $I_LineEditor_edit_insertion_length is zero.
+
+  SYMBOL: $I_LineEditor_edit_insertion_length
+    The number of characters from $w_LineEditor_edit_insertion to insert in
+    $f_LineEditor_edit().
+ */
+defun($h_LineEditor_edit) {
+  edit($I_LineEditor_edit_offset, $I_LineEditor_edit_length,
+       $w_LineEditor_edit_insertion, $I_LineEditor_edit_insertion_length);
+}
+
 /*
   SYMBOL: $f_LineEditor_self_insert
-    Inserts $x_Terminal_input_value into $az_LineEditor_buffer at
+    Inserts $x_Terminal_input_value into $p_LineEditor_buffer at
     $i_LineEditor_point, then increments point. If
     $x_Terminal_input_value is not a non-control character, the function sets
     $y_key_dispatch_continue to true and returns without taking action.
@@ -156,8 +269,7 @@ defun($h_LineEditor_self_insert) {
   let($y_LineEditor_edit_is_minor, true);
   $m_push_undo();
   wchar_t input = (wchar_t)$x_Terminal_input_value;
-  dynar_ins_z($az_LineEditor_buffer, $i_LineEditor_point++,
-              &input, 1);
+  edit($i_LineEditor_point++, 0, &input, 1);
 
   $m_changed();
 }
@@ -176,14 +288,13 @@ defun($h_LineEditor_insert_control) {
   let($y_LineEditor_edit_is_minor, true);
   $m_push_undo();
   wchar_t input = (wchar_t)$x_Terminal_input_value;
-  dynar_ins_z($az_LineEditor_buffer, $i_LineEditor_point++,
-              &input, 1);
+  edit($i_LineEditor_point++, 0, &input, 1);
   $m_changed();
 }
 
 /*
   SYMBOL: $f_LineEditor_changed
-    Called after modifications to $az_LineEditor_buffer have occurred, so that
+    Called after modifications to $p_LineEditor_buffer have occurred, so that
     the echo area can be updated as needed, etc. This must be called within the
     context of the current Workspace. Besides repainting the echo area, it also
     ensures that point is within allowable boundaries.
@@ -191,8 +302,8 @@ defun($h_LineEditor_insert_control) {
 defun($h_LineEditor_changed) {
   if ($i_LineEditor_point < 0)
     $i_LineEditor_point = 0;
-  else if ($i_LineEditor_point > $az_LineEditor_buffer->len)
-    $i_LineEditor_point = $az_LineEditor_buffer->len;
+  else if ($i_LineEditor_point > gb_len($p_LineEditor_buffer))
+    $i_LineEditor_point = gb_len($p_LineEditor_buffer);
 
   $f_Workspace_update_echo_area();
 }
@@ -228,13 +339,20 @@ defun($h_LineEditor_rotate_echo_mode) {
 /*
   SYMBOL: $f_LineEditor_get_echo_area_contents
     Converts the LineEditor buffer into an unformatted qstring and sets the
-    point position therein (see $m_get_echo_area_contents).
+    point position therein (see $m_get_echo_area_contents). The qstring is
+    allocated from the transient arena, so it is only valid until the end of
+    the current kernel cycle.
  */
 defun($h_LineEditor_get_echo_area_contents) {
-  mqstring result = qcalloc(1+$az_LineEditor_buffer->len);
-  for (unsigned i = 0; i < $az_LineEditor_buffer->len; ++i)
-    result[i] = (qchar)$az_LineEditor_buffer->v[i];
-  result[$az_LineEditor_buffer->len] = 0;
+  const gap_buffer* buffer = $p_LineEditor_buffer;
+  unsigned len = gb_len(buffer);
+  mqstring result = arena_qcalloc(1+len);
+  // Read the two runs directly so that rendering never moves the gap
+  for (unsigned i = 0; i < buffer->gap_begin; ++i)
+    result[i] = (qchar)buffer->v[i];
+  for (unsigned i = buffer->gap_begin; i < len; ++i)
+    result[i] = (qchar)buffer->v[i + buffer->gap_end - buffer->gap_begin];
+  result[len] = 0;
 
   $q_Workspace_echo_area_contents = result;
 
@@ -249,9 +367,7 @@ defun($h_LineEditor_get_echo_area_contents) {
     Sets $w_LineEditor_text to the current contents of the LineEditor.
  */
 defun($h_LineEditor_get_text) {
-  mwstring dst = wcalloc(1 + $az_LineEditor_buffer->len);
-  wmemcpy(dst, $az_LineEditor_buffer->v, $az_LineEditor_buffer->len);
-  $w_LineEditor_text = dst;
+  $w_LineEditor_text = gb_text($p_LineEditor_buffer);
 }
 
 /*
@@ -263,7 +379,7 @@ defun($h_LineEditor_delete_backward_char) {
     let($y_LineEditor_edit_is_minor, true);
     $f_LineEditor_push_undo();
     --$i_LineEditor_point;
-    dynar_erase_z($az_LineEditor_buffer, $i_LineEditor_point, 1);
+    edit($i_LineEditor_point, 1, NULL, 0);
 
     $m_changed();
   }
@@ -274,10 +390,10 @@ defun($h_LineEditor_delete_backward_char) {
     Delete the character immediately after point.
  */
 defun($h_LineEditor_delete_forward_char) {
-  if ($i_LineEditor_point != $az_LineEditor_buffer->len) {
+  if ($i_LineEditor_point != gb_len($p_LineEditor_buffer)) {
     let($y_LineEditor_edit_is_minor, true);
     $f_LineEditor_push_undo();
-    dynar_erase_z($az_LineEditor_buffer, $i_LineEditor_point, 1);
+    edit($i_LineEditor_point, 1, NULL, 0);
 
     $m_changed();
   }
@@ -294,7 +410,7 @@ defun($h_LineEditor_delete_forward_char) {
 defun($h_LineEditor_move_forward_char) {
   unsigned dist = accelerate_max(
     &$I_LastCommand_forward_char,
-    $az_LineEditor_buffer->len - $i_LineEditor_point);
+    gb_len($p_LineEditor_buffer) - $i_LineEditor_point);
 
   $i_LineEditor_point += dist;
   $m_changed();
@@ -321,16 +437,16 @@ defun($h_LineEditor_move_backward_char) {
     Moves point forward one word, as defined by is_word_boundary().
  */
 defun($h_LineEditor_move_forward_word) {
-  if ($i_LineEditor_point == $az_LineEditor_buffer->len)
+  if ($i_LineEditor_point == gb_len($p_LineEditor_buffer))
     // Already at end
     return;
 
   do {
     ++$i_LineEditor_point;
-  } while ($i_LineEditor_point != $az_LineEditor_buffer->len &&
+  } while ($i_LineEditor_point != gb_len($p_LineEditor_buffer) &&
            !is_word_boundary(
-             $az_LineEditor_buffer->v[$i_LineEditor_point-1],
-             $az_LineEditor_buffer->v[$i_LineEditor_point  ]));
+             gb_at($p_LineEditor_buffer, $i_LineEditor_point-1),
+             gb_at($p_LineEditor_buffer, $i_LineEditor_point  )));
 
   $m_changed();
 }
@@ -348,8 +464,8 @@ defun($h_LineEditor_move_backward_word) {
     --$i_LineEditor_point;
   } while ($i_LineEditor_point &&
            !is_word_boundary(
-             $az_LineEditor_buffer->v[$i_LineEditor_point-1],
-             $az_LineEditor_buffer->v[$i_LineEditor_point  ]));
+             gb_at($p_LineEditor_buffer, $i_LineEditor_point-1),
+             gb_at($p_LineEditor_buffer, $i_LineEditor_point  )));
 
   $m_changed();
 }
@@ -377,12 +493,12 @@ defun($h_LineEditor_kill) {
   int begin = $i_LineEditor_point;
   int end = $i_LineEditor_kill;
   mwstring text = wcalloc(end-begin+1);
-  wmemcpy(text, $az_LineEditor_buffer->v + begin, (end-begin));
+  gb_copy(text, $p_LineEditor_buffer, begin, end-begin);
 
   $F_c_kill(0,0, $w_kill = text);
 
   $m_push_undo();
-  dynar_erase_z($az_LineEditor_buffer, begin, end-begin);
+  edit(begin, end-begin, NULL, 0);
   $m_changed();
 }
 
@@ -430,8 +546,8 @@ defun($h_LineEditor_kill_backward_word) {
  */
 defun($h_LineEditor_home) {
   unsigned firstNonWhitespace = 0;
-  while (firstNonWhitespace < $az_LineEditor_buffer->len &&
-         iswspace($az_LineEditor_buffer->v[firstNonWhitespace]))
+  while (firstNonWhitespace < gb_len($p_LineEditor_buffer) &&
+         iswspace(gb_at($p_LineEditor_buffer, firstNonWhitespace)))
     ++firstNonWhitespace;
 
   if ($i_LineEditor_point == firstNonWhitespace)
@@ -447,7 +563,7 @@ defun($h_LineEditor_home) {
     Moves point past the last character in the line.
  */
 defun($h_LineEditor_end) {
-  $i_LineEditor_point = $az_LineEditor_buffer->len;
+  $i_LineEditor_point = gb_len($p_LineEditor_buffer);
   $m_changed();
 }
 
@@ -480,14 +596,14 @@ defun($h_LineEditor_kill_to_eol) {
 interactive($h_LineEditor_seek_forward_to_char_i,
             $h_LineEditor_seek_forward_to_char,
             i_(z, $z_LineEditor_seek_dst, L"Seek")) {
-  if ($i_LineEditor_point >= $az_LineEditor_buffer->len)
+  if ($i_LineEditor_point >= gb_len($p_LineEditor_buffer))
     return; //already at end
 
   ++$i_LineEditor_point;
 
-  while ($i_LineEditor_point < $az_LineEditor_buffer->len &&
+  while ($i_LineEditor_point < gb_len($p_LineEditor_buffer) &&
          $z_LineEditor_seek_dst !=
-           $az_LineEditor_buffer->v[$i_LineEditor_point])
+           gb_at($p_LineEditor_buffer, $i_LineEditor_point))
     ++$i_LineEditor_point;
   $m_changed();
 }
@@ -519,7 +635,7 @@ interactive($h_LineEditor_seek_backward_to_char_i,
 
   while ($i_LineEditor_point > 0 &&
          $z_LineEditor_seek_dst !=
-           $az_LineEditor_buffer->v[$i_LineEditor_point])
+           gb_at($p_LineEditor_buffer, $i_LineEditor_point))
     --$i_LineEditor_point;
   $m_changed();
 }
@@ -547,9 +663,9 @@ interactive($h_LineEditor_seek_forward_to_word_i,
             i_(z, $z_LineEditor_seek_dst, L"Seek")) {
   do {
     $f_LineEditor_move_forward_word();
-  }  while ($i_LineEditor_point != $az_LineEditor_buffer->len &&
+  }  while ($i_LineEditor_point != gb_len($p_LineEditor_buffer) &&
             $z_LineEditor_seek_dst !=
-              $az_LineEditor_buffer->v[$i_LineEditor_point]);
+              gb_at($p_LineEditor_buffer, $i_LineEditor_point));
 }
 
 /*
@@ -577,7 +693,7 @@ interactive($h_LineEditor_seek_backward_to_word_i,
     $f_LineEditor_move_backward_word();
   } while ($i_LineEditor_point &&
            $z_LineEditor_seek_dst !=
-             $az_LineEditor_buffer->v[$i_LineEditor_point]);
+             gb_at($p_LineEditor_buffer, $i_LineEditor_point));
 }
 
 /*
@@ -618,40 +734,47 @@ defun($h_LineEditor_yank) {
 
   wstring to_insert = $aw_c_kill_ring->v[$I_c_kill_ring];
   $m_push_undo();
-  dynar_ins_z($az_LineEditor_buffer, $i_LineEditor_point,
-              to_insert, wcslen(to_insert));
+  edit($i_LineEditor_point, 0, to_insert, wcslen(to_insert));
 
   $m_changed();
 }
 
 /*
   SYMBOL: $f_LineEditor_undo
-    Undoes one undo step for this LineEditor, if there are any undo states.
+    Undoes one undo step for this LineEditor, if there are any undo states, by
+    reverting its deltas in reverse order. Point is moved to the end of the
+    restored text.
  */
 defun($h_LineEditor_undo) {
-  if ($laz_LineEditor_undo) {
-    lpush_az($laz_LineEditor_redo, $az_LineEditor_buffer);
-    $az_LineEditor_buffer = lpop_az($laz_LineEditor_undo);
-
-    if ($i_LineEditor_point > $az_LineEditor_buffer->len)
-      $i_LineEditor_point = $az_LineEditor_buffer->len;
+  if ($lp_LineEditor_undo) {
+    undo_step* step = lpop_p($lp_LineEditor_undo);
+    for (undo_delta* d = step->last; d; d = d->prev) {
+      apply_delta(d->off, d->ninserted, d->removed, d->nremoved);
+      $i_LineEditor_point = d->off + d->nremoved;
+    }
 
+    lpush_p($lp_LineEditor_redo, step);
+    $y_LineEditor_undo_boundary = true;
     $m_changed();
   }
 }
 
 /*
   SYMBOL: $f_LineEditor_redo
-    Redoes one redo step for this LineEditor, if there are any redo states.
+    Redoes one redo step for this LineEditor, if there are any redo states, by
+    reapplying its deltas in order. Point is moved to the end of the
+    reinserted text.
  */
 defun($h_LineEditor_redo) {
-  if ($laz_LineEditor_redo) {
-    lpush_az($laz_LineEditor_undo, $az_LineEditor_buffer);
-    $az_LineEditor_buffer = lpop_az($laz_LineEditor_redo);
-
-    if ($i_LineEditor_point > $az_LineEditor_buffer->len)
-      $i_LineEditor_point = $az_LineEditor_buffer->len;
+  if ($lp_LineEditor_redo) {
+    undo_step* step = lpop_p($lp_LineEditor_redo);
+    for (undo_delta* d = step->first; d; d = d->next) {
+      apply_delta(d->off, d->nremoved, d->inserted, d->ninserted);
+      $i_LineEditor_point = d->off + d->ninserted;
+    }
 
+    lpush_p($lp_LineEditor_undo, step);
+    $y_LineEditor_undo_boundary = true;
     $m_changed();
   }
 }
@@ -684,7 +807,8 @@ defun($h_LineEditor_redo) {
  */
 defun($h_LineEditor_traverse_sexpr) {
   signed delta = $y_LineEditor_sexpr_direction? +1 : -1;
-  signed bound = $y_LineEditor_sexpr_direction? $az_LineEditor_buffer->len : -1;
+  signed bound =
+    $y_LineEditor_sexpr_direction? gb_len($p_LineEditor_buffer) : -1;
   bool has_encountered_paren = !$y_LineEditor_sexpr_skip_init;
 
   // Moving backward really requires us to alter point *before* checking
@@ -698,7 +822,7 @@ defun($h_LineEditor_traverse_sexpr) {
   
   while ($i_LineEditor_point != bound &&
          (!has_encountered_paren || $i_LineEditor_sexpr_depth > 0)) {
-    switch ($az_LineEditor_buffer->v[$i_LineEditor_point]) {
+    switch (gb_at($p_LineEditor_buffer, $i_LineEditor_point)) {
     case L'(':
     case L'[':
     case L'{':
@@ -823,7 +947,7 @@ defun($h_LineEditor_kill_parent_sexpr) {
     $w_LineEditor_permute. If found, they will be re-ordered to equal
     $w_LineEditor_permute. Otherwise, an error is issued. Point is not moved.
  */
-static bool is_permutation_of(wstring candidate, wstring target);
+static bool is_permutation_of(unsigned candidate, wstring target);
 interactive($h_LineEditor_permute_i,
             $h_LineEditor_permute,
             i_(w, $w_LineEditor_permute, L"Permute")) {
@@ -831,11 +955,10 @@ interactive($h_LineEditor_permute_i,
 
   int start = $i_LineEditor_point - wcslen($w_LineEditor_permute);
   while (start >= 0) {
-    if (is_permutation_of($az_LineEditor_buffer->v + start,
-                          $w_LineEditor_permute)) {
+    if (is_permutation_of(start, $w_LineEditor_permute)) {
       $m_push_undo();
-      wmemcpy($az_LineEditor_buffer->v + start, $w_LineEditor_permute,
-              wcslen($w_LineEditor_permute));
+      edit(start, wcslen($w_LineEditor_permute),
+           $w_LineEditor_permute, wcslen($w_LineEditor_permute));
       $m_changed();
       return;
     } else {
@@ -848,10 +971,10 @@ interactive($h_LineEditor_permute_i,
                      L"Permutation not found: ", $w_LineEditor_permute));
 }
 
-static bool is_permutation_of(wstring candidate, wstring target) {
+static bool is_permutation_of(unsigned candidate, wstring target) {
   unsigned len = wcslen(target);
   wchar_t a[len];
-  wmemcpy(a, candidate, len);
+  gb_copy(a, $p_LineEditor_buffer, candidate, len);
 
   //This is O(n^2), but simpler and probably faster than sorting for typical
   //inputs (< 5 chars)
@@ -878,15 +1001,16 @@ static bool is_permutation_of(wstring candidate, wstring target) {
     advanced before the transpose as well.
  */
 defun($h_LineEditor_transpose_and_advance) {
-  if ($az_LineEditor_buffer->len < 2) return;
+  if (gb_len($p_LineEditor_buffer) < 2) return;
   if ($i_LineEditor_point == 0) ++$i_LineEditor_point;
-  if ($i_LineEditor_point == $az_LineEditor_buffer->len) return;
+  if ($i_LineEditor_point == gb_len($p_LineEditor_buffer)) return;
 
   $m_push_undo();
-  wchar_t tmp = $az_LineEditor_buffer->v[$i_LineEditor_point];
-  $az_LineEditor_buffer->v[$i_LineEditor_point] =
-    $az_LineEditor_buffer->v[$i_LineEditor_point - 1];
-  $az_LineEditor_buffer->v[$i_LineEditor_point - 1] = tmp;
+  wchar_t swapped[2] = {
+    gb_at($p_LineEditor_buffer, $i_LineEditor_point),
+    gb_at($p_LineEditor_buffer, $i_LineEditor_point - 1),
+  };
+  edit($i_LineEditor_point - 1, 2, swapped, 2);
 
   ++$i_LineEditor_point;
   $m_changed();
@@ -978,3 +1102,17 @@ ATSTART(setup_line_editor_keybindings, STATIC_INITIALISATION_PRIORITY) {
   bind_char($lp_LineEditor_keybindings, $u_ground, L'\r', NULL,
             $m_accept);
 }
+
+defbench(typing, "Type characters into a buffer, accepting every 64th") {
+  object buffer = $c_FileBuffer($w_FileBuffer_filename = L"*bench*",
+                                $y_FileBuffer_memory_backed = true);
+  bench_workspace();
+  bench_keys(L"i");
+
+  bench_start();
+  for (unsigned i = 0; i < iterations; ++i)
+    bench_keys(63 == i % 64? L"\ri" : L"x");
+  bench_stop();
+
+  $M_destroy(0, buffer);
+}
@@ -18,6 +18,7 @@
 */
 #include "linum.slc"
 #include "face.h"
+#include "streamed_lines.h"
 
 /*
   TITLE: Line-Number Mode
@@ -103,7 +104,8 @@ mode_adv_after($u_line_numbering, $h_RenderedLine_gen_meta) {
   // Do nothing if not in the right context
   if (!$o_BufferEditor_buffer) return;
   dynar_w contents = $($o_BufferEditor_buffer, $aw_FileBuffer_contents);
-  if (!contents) return;
+  streamed_lines* stream = $($o_BufferEditor_buffer, $p_FileBuffer_stream);
+  if (!contents && !stream) return;
 
   // Count how many characters are available
   unsigned avail = 0;
@@ -139,7 +141,8 @@ mode_adv_after($u_line_numbering, $h_RenderedLine_gen_meta) {
 
   if (avail > 0) {
     // See how many digits we need to display absolute line numbers
-    unsigned num_digits = 0, max = contents->len;
+    unsigned num_digits = 0, max =
+      stream? sl_len(stream) : contents->len;
     while (max)
       ++num_digits, max /= 10;
 
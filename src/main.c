@@ -50,6 +50,8 @@ int main(int argc, char** argv) {
 
   bind_char($$lp_main_keymap, $u_extended, CONTROL_C, NULL, $$f_quit);
   bind_char($$lp_main_keymap2, $u_extended, CONTROL_X, $u_ground, $$f_die);
+  bind_char($$lp_main_keymap2, $u_extended, CONTROL_G, $u_ground,
+            $$f_kernel_gc_report);
 
   process_cmdline_args(argv, argc);
 
@@ -99,3 +101,15 @@ defun($$h_die) {
   $s_rollback_reason = reason;
   tx_rollback();
 }
+
+// Displays a notice summarising the collector statistics kept by the kernel
+// ($I_gc_pause_count, $I_gc_pause_last_us, $I_gc_pause_max_us) and the
+// current heap size.
+defun($$h_kernel_gc_report) {
+  wchar_t text[256];
+  swprintf(text, lenof(text),
+           L"GC: %u idle slices, last %u us, max %u us; heap %lu KiB",
+           $I_gc_pause_count, $I_gc_pause_last_us, $I_gc_pause_max_us,
+           (unsigned long)(GC_get_heap_size() / 1024));
+  $F_message_notice(0,0, $w_message_text = wstrdup(text));
+}
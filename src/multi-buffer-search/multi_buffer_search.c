@@ -0,0 +1,465 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "multi_buffer_search.slc"
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "../face.h"
+#include "../interactive.h"
+#include "../key_dispatch.h"
+#include "../registry.h"
+
+/*
+  TITLE: Multi-Buffer Search
+  OVERVIEW: Searches every open FileBuffer at once, using a pool of worker
+    threads, and streams the matching lines into the Transcript.
+
+  NOTES: Threading
+    The object system is not thread-safe, and worker threads are not
+    registered with the garbage collector, so workers must never touch
+    objects, symbols, or allocate GC memory. Instead, the search snapshots the
+    line arrays of every buffer on the main thread, and the workers only read
+    those snapshots (which are immutable and kept alive by the search object)
+    and write malloc()ed result blocks.
+    Streamed FileBuffers (see $y_FileBuffer_streamed) cannot be snapshotted,
+    and are not searched.
+
+    Workers only rule lines out by looking for the Pattern's required literals
+    ($lw_Pattern_literals). Each result block is written as a pointer to a
+    pipe, which the search object consumes through the kernel loop; lines are
+    verified with the full Pattern there before being shown, one block per
+    kernel cycle so that the UI stays responsive. The last worker to exit
+    closes the write end of the pipe, so the search learns that it is complete
+    from end-of-file; nothing a worker could fail to write is needed for that.
+ */
+
+// Number of lines handed to a worker at a time
+#define CHUNK_LINES 4096
+
+struct mbs_job {
+  const wstring* lines;
+  unsigned nlines;
+};
+
+struct mbs_result {
+  unsigned job, count;
+  unsigned lines[];
+};
+
+struct mbs_shared {
+  pthread_mutex_t lock;
+  // Protected by lock
+  unsigned next_job, next_line;
+  bool cancelled, lost;
+  /* The number of holders of output: one per running worker, plus one for
+   * the constructor while it starts them. The last to let go closes it.
+   */
+  unsigned output_holders;
+
+  // Read-only once workers start
+  const struct mbs_job* jobs;
+  unsigned njobs;
+  const wstring* literals;
+  unsigned nliterals;
+  int output;
+};
+
+static bool claim_chunk(struct mbs_shared* shared,
+                        unsigned* job, unsigned* begin, unsigned* end) {
+  bool ret = false;
+  pthread_mutex_lock(&shared->lock);
+  while (!shared->cancelled && shared->next_job < shared->njobs) {
+    const struct mbs_job* curr = shared->jobs + shared->next_job;
+    if (shared->next_line >= curr->nlines) {
+      ++shared->next_job;
+      shared->next_line = 0;
+      continue;
+    }
+
+    *job = shared->next_job;
+    *begin = shared->next_line;
+    *end = *begin + CHUNK_LINES;
+    if (*end > curr->nlines)
+      *end = curr->nlines;
+    shared->next_line = *end;
+    ret = true;
+    break;
+  }
+  pthread_mutex_unlock(&shared->lock);
+  return ret;
+}
+
+static void release_output(struct mbs_shared* shared) {
+  pthread_mutex_lock(&shared->lock);
+  bool last = !--shared->output_holders;
+  pthread_mutex_unlock(&shared->lock);
+
+  if (last)
+    close(shared->output);
+}
+
+static void* search_worker(void* vshared) {
+  struct mbs_shared* shared = vshared;
+  unsigned job, begin, end;
+
+  while (claim_chunk(shared, &job, &begin, &end)) {
+    struct mbs_result* result =
+      malloc(sizeof(struct mbs_result) + sizeof(unsigned)*(end-begin));
+    if (!result) break;
+
+    result->job = job;
+    result->count = 0;
+    for (unsigned line = begin; line < end; ++line) {
+      wstring text = shared->jobs[job].lines[line];
+      unsigned i;
+      for (i = 0; i < shared->nliterals; ++i)
+        if (!wcsstr(text, shared->literals[i]))
+          break;
+
+      if (i == shared->nliterals)
+        result->lines[result->count++] = line;
+    }
+
+    if (!result->count) {
+      free(result);
+    } else if (!write_fully(shared->output, &result, sizeof(result))) {
+      free(result);
+      // Whatever was lost, the results are now incomplete
+      pthread_mutex_lock(&shared->lock);
+      shared->cancelled = shared->lost = true;
+      pthread_mutex_unlock(&shared->lock);
+      break;
+    }
+  }
+
+  release_output(shared);
+  return NULL;
+}
+
+/*
+  SYMBOL: $c_MultiBufferSearch
+    Consumer which searches every buffer in $p_buffers for
+    $w_MultiBufferSearch_query, appending matching lines to
+    $o_MultiBufferSearch_transcript as they are found. The search starts as
+    soon as the object is constructed; it destroys itself when complete.
+
+  SYMBOL: $w_MultiBufferSearch_query
+    The Pattern source to search for.
+
+  SYMBOL: $o_MultiBufferSearch_transcript
+    The Transcript to which results and messages are written. Defaults to
+    $o_Transcript. Messages must be shown within it explicitly, since the
+    kernel calls Consumers outside of any Workspace.
+
+  SYMBOL: $o_MultiBufferSearch_pattern
+    The Pattern compiled from $w_MultiBufferSearch_query.
+
+  SYMBOL: $ao_MultiBufferSearch_buffers $law_MultiBufferSearch_snapshots
+    The buffers being searched, and snapshots of their contents at the time the
+    search started. The snapshots are what the workers actually read.
+
+  SYMBOL: $p_MultiBufferSearch_shared
+    Pointer to the non-GC state shared with the worker threads.
+
+  SYMBOL: $I_MultiBufferSearch_nmatches
+    The number of matching lines reported so far.
+
+  SYMBOL: $I_multi_buffer_search_threads
+    The number of worker threads to use for multi-buffer searches. If zero,
+    one thread per online processor is used.
+
+  SYMBOL: $o_multi_buffer_search
+    The currently running MultiBufferSearch, if any. Starting a new search
+    cancels this one.
+ */
+subclass($c_Consumer, $c_MultiBufferSearch)
+STATIC_INIT_TO($I_multi_buffer_search_threads, 0)
+
+defun($h_MultiBufferSearch) {
+  $o_MultiBufferSearch_transcript = $o_Transcript;
+  $o_MultiBufferSearch_pattern =
+    $c_Pattern($w_Pattern_pattern = $w_MultiBufferSearch_query);
+
+  // Take snapshots of every buffer
+  $ao_MultiBufferSearch_buffers = dynar_new_o();
+  $law_MultiBufferSearch_snapshots = NULL;
+  REG_EACH(curr, $p_buffers) {
+    // Streamed buffers are too large to snapshot
+    if ($(curr->obj, $y_FileBuffer_streamed)) continue;
+
+    dynar_push_o($ao_MultiBufferSearch_buffers, curr->obj);
+    $$(curr->obj) {
+      $m_access();
+      lpush_aw($law_MultiBufferSearch_snapshots,
+               dynar_clone_w($aw_FileBuffer_contents));
+    }
+  }
+  $law_MultiBufferSearch_snapshots =
+    lrev_aw($law_MultiBufferSearch_snapshots);
+
+  unsigned njobs = $ao_MultiBufferSearch_buffers->len;
+  list_w literals = $($o_MultiBufferSearch_pattern, $lw_Pattern_literals);
+  unsigned nliterals = llen_w(literals);
+
+  struct mbs_shared* shared = malloc(sizeof(struct mbs_shared));
+  struct mbs_job* jobs = malloc(sizeof(struct mbs_job) * (njobs ?: 1));
+  wstring* lits = malloc(sizeof(wstring) * (nliterals ?: 1));
+  if (!shared || !jobs || !lits) {
+    free(shared);
+    free(jobs);
+    free(lits);
+    $v_rollback_type = $u_MultiBufferSearch;
+    $s_rollback_reason = "Out of memory";
+    tx_rollback();
+  }
+
+  unsigned ix = 0;
+  for (list_aw curr = $law_MultiBufferSearch_snapshots;
+       curr; curr = curr->cdr, ++ix) {
+    jobs[ix].lines = curr->car->v;
+    jobs[ix].nlines = curr->car->len;
+  }
+  ix = 0;
+  for (; literals; literals = literals->cdr)
+    lits[ix++] = literals->car;
+
+  int pipes[2];
+  if (-1 == pipe(pipes)) {
+    free(shared);
+    free(jobs);
+    free(lits);
+    tx_rollback_errno($u_MultiBufferSearch);
+  }
+  fcntl(pipes[0], F_SETFL, O_NONBLOCK);
+
+  memset(shared, 0, sizeof(struct mbs_shared));
+  pthread_mutex_init(&shared->lock, NULL);
+  shared->jobs = jobs;
+  shared->njobs = njobs;
+  shared->literals = lits;
+  shared->nliterals = nliterals;
+  shared->output = pipes[1];
+  shared->output_holders = 1;
+  $p_MultiBufferSearch_shared = shared;
+  $i_Consumer_fd = pipes[0];
+
+  unsigned nthreads = $I_multi_buffer_search_threads;
+  if (!nthreads) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = ncpus > 0? ncpus : 1;
+  }
+
+  $I_MultiBufferSearch_nmatches = 0;
+  unsigned nstarted = 0;
+  for (unsigned i = 0; i < nthreads; ++i) {
+    pthread_t thread;
+    pthread_mutex_lock(&shared->lock);
+    ++shared->output_holders;
+    pthread_mutex_unlock(&shared->lock);
+    if (pthread_create(&thread, NULL, search_worker, shared)) {
+      // Can't be the last holder; this constructor still is one
+      pthread_mutex_lock(&shared->lock);
+      --shared->output_holders;
+      pthread_mutex_unlock(&shared->lock);
+      break;
+    }
+    pthread_detach(thread);
+    ++nstarted;
+  }
+
+  if (!nstarted) {
+    // Not even one worker could be started. The search can't simply run on
+    // this thread, since nothing would drain the pipe while it did.
+    close(pipes[0]);
+    close(pipes[1]);
+    pthread_mutex_destroy(&shared->lock);
+    free(shared);
+    free(jobs);
+    free(lits);
+    tx_rollback_merrno($u_MultiBufferSearch, 0,
+                       "Could not start search threads");
+  }
+  release_output(shared);
+
+  if ($o_multi_buffer_search)
+    $M_cancel(0, $o_multi_buffer_search);
+  $o_multi_buffer_search = $o_MultiBufferSearch;
+}
+
+/*
+  SYMBOL: $f_MultiBufferSearch_cancel
+    Stops this search from producing further results. Workers stop at their
+    next chunk; the search destroys itself once they have all finished.
+ */
+defun($h_MultiBufferSearch_cancel) {
+  struct mbs_shared* shared = $p_MultiBufferSearch_shared;
+  pthread_mutex_lock(&shared->lock);
+  shared->cancelled = true;
+  pthread_mutex_unlock(&shared->lock);
+
+  if ($o_multi_buffer_search == $o_MultiBufferSearch)
+    $o_multi_buffer_search = NULL;
+}
+
+/*
+  SYMBOL: $I_MultiBufferSearch_meta_face
+    Face to apply to the meta (the buffer name) of result lines.
+ */
+STATIC_INIT_TO($I_MultiBufferSearch_meta_face, mkface("!fG"))
+
+/* Returns the line meta shared by every result from the given buffer. */
+static qstring format_meta(wstring filename) {
+  wchar_t meta[$i_line_meta_width+1];
+  wstrlcpy(meta, filename, $i_line_meta_width+1);
+  for (unsigned i = wcslen(meta); i < $i_line_meta_width; ++i)
+    meta[i] = L' ';
+  meta[$i_line_meta_width] = 0;
+
+  return apply_face_str($I_MultiBufferSearch_meta_face, wstrtoqstr(meta));
+}
+
+static qstring format_body(unsigned line, wstring text) {
+  wchar_t prefix[16];
+  swprintf(prefix, lenof(prefix), L"%u: ", line+1);
+  return wstrtoqstr(wstrap(prefix, text));
+}
+
+/*
+  SYMBOL: $f_MultiBufferSearch_read
+    Takes one result block from the workers, verifies its lines against the
+    full Pattern, and appends those that match to the Transcript. Once the
+    pipe reports end-of-file, every worker has finished, and the search is
+    finished with $f_MultiBufferSearch_finish.
+ */
+defun($h_MultiBufferSearch_read) {
+  struct mbs_shared* shared = $p_MultiBufferSearch_shared;
+  struct mbs_result* result;
+  ssize_t nread = read($i_Consumer_fd, &result, sizeof(result));
+  if (!nread) {
+    $m_finish();
+    return;
+  }
+
+  if (nread != sizeof(result)) {
+    if (nread == -1 && (errno == EAGAIN || errno == EINTR))
+      return;
+    // Shouldn't happen. Stop the workers, but the shared state can't be
+    // released until every one of them has exited.
+    pthread_mutex_lock(&shared->lock);
+    shared->cancelled = shared->lost = true;
+    pthread_mutex_unlock(&shared->lock);
+    return;
+  }
+
+  if (!shared->cancelled) {
+    object buffer = $ao_MultiBufferSearch_buffers->v[result->job];
+    const wstring* lines = shared->jobs[result->job].lines;
+    dynar_q bodies = dynar_new_q();
+    for (unsigned i = 0; i < result->count; ++i) {
+      unsigned line = result->lines[i];
+      if ($M_matches($y_Pattern_matches, $o_MultiBufferSearch_pattern,
+                     $w_Pattern_input = lines[line])) {
+        dynar_push_q(bodies, format_body(line, lines[line]));
+        ++$I_MultiBufferSearch_nmatches;
+      }
+    }
+
+    // Every line of a block comes from the same buffer, so they can all
+    // share one meta
+    if (bodies->len && $o_MultiBufferSearch_transcript)
+      $M_append_bodies(0, $o_MultiBufferSearch_transcript,
+                       $aq_Transcript_bodies = bodies,
+                       $q_Transcript_meta =
+                         format_meta($(buffer, $w_FileBuffer_filename)));
+  }
+
+  free(result);
+}
+
+/*
+  SYMBOL: $f_MultiBufferSearch_finish
+    Called once every worker has exited. Reports the result of the search (or
+    that some of it was lost) within $o_MultiBufferSearch_transcript, releases
+    the shared state, and destroys this search.
+ */
+defun($h_MultiBufferSearch_finish) {
+  struct mbs_shared* shared = $p_MultiBufferSearch_shared;
+
+  wchar_t summary[64];
+  swprintf(summary, lenof(summary), L"%u match%ls in %u buffer%ls",
+           $I_MultiBufferSearch_nmatches,
+           $I_MultiBufferSearch_nmatches == 1? L"" : L"es",
+           shared->njobs, shared->njobs == 1? L"" : L"s");
+  if ($o_MultiBufferSearch_transcript) {
+    $$($o_MultiBufferSearch_transcript) {
+      if (shared->lost)
+        $F_message_error(0,0, $w_message_text =
+                         L"Lost contact with the search threads");
+      else if (!shared->cancelled)
+        $F_message_notice(0,0, $w_message_text = wstrdup(summary));
+    }
+  }
+
+  // Every result block was read before the end of the pipe
+  close($i_Consumer_fd);
+  pthread_mutex_destroy(&shared->lock);
+  free((void*)shared->jobs);
+  free((void*)shared->literals);
+  free(shared);
+  $p_MultiBufferSearch_shared = NULL;
+  $law_MultiBufferSearch_snapshots = NULL;
+
+  if ($o_multi_buffer_search == $o_MultiBufferSearch)
+    $o_multi_buffer_search = NULL;
+
+  $m_destroy();
+}
+
+/*
+  SYMBOL: $f_multi_buffer_search $f_multi_buffer_search_i
+    Starts a MultiBufferSearch for $w_multi_buffer_search over every open
+    buffer, writing results to the current Transcript.
+
+  SYMBOL: $w_multi_buffer_search
+    The query for $f_multi_buffer_search. If empty,
+    $w_previous_search_query is used instead.
+ */
+interactive($h_multi_buffer_search_i,
+            $h_multi_buffer_search,
+            i_(w, $w_multi_buffer_search, L"grep all")) {
+  if (!*$w_multi_buffer_search && $w_previous_search_query)
+    $w_multi_buffer_search = $w_previous_search_query;
+  else
+    $w_previous_search_query = $w_multi_buffer_search;
+
+  $c_MultiBufferSearch($w_MultiBufferSearch_query = $w_multi_buffer_search);
+}
+
+/*
+  SYMBOL: $lp_multi_buffer_search_keymap
+    Binds C-x g in BufferEditors to $f_multi_buffer_search_i.
+ */
+class_keymap($c_BufferEditor, $lp_multi_buffer_search_keymap,
+             $llp_Activity_keymap)
+ATSINIT {
+  bind_char($lp_multi_buffer_search_keymap, $u_extended, L'g', $u_ground,
+            $f_multi_buffer_search_i);
+}
@@ -0,0 +1,302 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "packed_lines.slc"
+
+#include "packed_lines.h"
+
+/*
+  TITLE: Compressed Line Storage
+  OVERVIEW: Provides the packed_lines, a compact, read-only copy of the lines
+    of a FileBuffer which has gone cold. Lines are converted to UTF-8 with a
+    private encoder (so that packing does not depend on the locale, and any
+    wchar_t value survives the round trip), then compressed with a small LZ77
+    codec in the style of LZ4. Ordinary source text typically shrinks to a
+    fifth or less of its wide-character size, and unpacking costs little more
+    than allocating the strings.
+    --
+    The compressed stream is a sequence of sequences, each of which is a token
+    byte, whose high nibble is the number of literals and low nibble the match
+    length less PL_MIN_MATCH; any further literal length bytes; the literals;
+    a two-byte little-endian match offset; and any further match length bytes.
+    A nibble of 15 is followed by length bytes, each added to it, until one is
+    not 255. The final sequence has literals only, and ends the stream.
+*/
+
+#define PL_HASH_BITS 12
+#define PL_MIN_MATCH 4
+#define PL_MAX_OFFSET 65535
+
+/* Returns the number of bytes needed to encode c. Beyond the standard forms,
+ * 6 bytes hold 31 bits and 7 (with a lead byte of 0xFE) hold 36.
+ */
+static unsigned utf8_len(unsigned long long c) {
+  unsigned n;
+  if (c < 0x80) return 1;
+  for (n = 2; n < 7 && c >= 1ULL << (5*n + 1); ++n);
+  return n;
+}
+
+static unsigned char* utf8_put(unsigned char* dst, unsigned long long c) {
+  unsigned n = utf8_len(c);
+  if (1 == n) {
+    *dst = c;
+    return dst+1;
+  }
+
+  for (unsigned i = n-1; i > 0; --i) {
+    dst[i] = 0x80 | (c & 0x3F);
+    c >>= 6;
+  }
+  dst[0] = ((0xFF00 >> n) & 0xFF) | c;
+  return dst + n;
+}
+
+static const unsigned char* utf8_get(const unsigned char* src,
+                                     unsigned long long* c) {
+  unsigned char lead = *src++;
+  unsigned n = 0;
+  while (n < 7 && (lead & (0x80 >> n))) ++n;
+  if (!n) {
+    *c = lead;
+    return src;
+  }
+
+  unsigned long long v = lead & (0x7F >> n);
+  for (unsigned i = 1; i < n; ++i)
+    v = (v << 6) | (*src++ & 0x3F);
+  *c = v;
+  return src;
+}
+
+static unsigned pl_hash(const unsigned char* p) {
+  unsigned v;
+  memcpy(&v, p, 4);
+  return (v * 2654435761u) >> (32 - PL_HASH_BITS);
+}
+
+/* Writes the continuation of a length whose nibble was 15; len has already
+ * had 15 subtracted.
+ */
+static unsigned char* put_length(unsigned char* dst, size_t len) {
+  for (; len >= 255; len -= 255)
+    *dst++ = 255;
+  *dst++ = len;
+  return dst;
+}
+
+static const unsigned char* get_length(const unsigned char* src,
+                                       size_t* len) {
+  unsigned char b;
+  do {
+    b = *src++;
+    *len += b;
+  } while (255 == b);
+  return src;
+}
+
+/* Writes one sequence. A match length of zero writes the final,
+ * literal-only sequence.
+ */
+static unsigned char* put_sequence(unsigned char* dst,
+                                   const unsigned char* lit, size_t nlit,
+                                   size_t offset, size_t mlen) {
+  unsigned char* token = dst++;
+  *token = (nlit < 15? nlit : 15) << 4;
+  if (nlit >= 15)
+    dst = put_length(dst, nlit - 15);
+  memcpy(dst, lit, nlit);
+  dst += nlit;
+
+  if (!mlen) return dst;
+
+  *dst++ = offset & 0xFF;
+  *dst++ = offset >> 8;
+  mlen -= PL_MIN_MATCH;
+  *token |= mlen < 15? mlen : 15;
+  if (mlen >= 15)
+    dst = put_length(dst, mlen - 15);
+  return dst;
+}
+
+/* Compresses the n bytes at src into dst, which must have space for at least
+ * n + n/255 + 16 bytes. Returns the number of bytes written.
+ */
+static size_t lz_compress(const unsigned char* src, size_t n,
+                          unsigned char* dst) {
+  // Positions, plus one, of the most recent occurrence of each hashed 4-byte
+  // prefix; zero means none.
+  size_t table[1 << PL_HASH_BITS];
+  const unsigned char* ip = src, * anchor = src, * end = src + n;
+  unsigned char* op = dst;
+
+  memset(table, 0, sizeof(table));
+  while (ip + PL_MIN_MATCH <= end) {
+    unsigned h = pl_hash(ip);
+    size_t pos = ip - src, cand = table[h];
+    table[h] = pos + 1;
+
+    if (cand && pos + 1 - cand <= PL_MAX_OFFSET &&
+        !memcmp(src + cand - 1, ip, PL_MIN_MATCH)) {
+      const unsigned char* match = src + cand - 1;
+      size_t mlen = PL_MIN_MATCH;
+      while (ip + mlen < end && ip[mlen] == match[mlen])
+        ++mlen;
+
+      op = put_sequence(op, anchor, ip - anchor, ip - match, mlen);
+      ip += mlen;
+      anchor = ip;
+    } else {
+      ++ip;
+    }
+  }
+
+  op = put_sequence(op, anchor, end - anchor, 0, 0);
+  return op - dst;
+}
+
+/* Decompresses the n bytes at src into dst, which must be exactly large
+ * enough to hold the output.
+ */
+static void lz_decompress(const unsigned char* src, size_t n,
+                          unsigned char* dst) {
+  const unsigned char* end = src + n;
+  for (;;) {
+    unsigned token = *src++;
+    size_t len = token >> 4;
+    if (15 == len)
+      src = get_length(src, &len);
+    memcpy(dst, src, len);
+    dst += len;
+    src += len;
+
+    if (src == end) break;
+
+    size_t offset = src[0] | (src[1] << 8);
+    src += 2;
+    len = token & 15;
+    if (15 == len)
+      src = get_length(src, &len);
+    len += PL_MIN_MATCH;
+
+    const unsigned char* match = dst - offset;
+    if (offset >= len) {
+      memcpy(dst, match, len);
+      dst += len;
+    } else {
+      // Overlapping match; it repeats the most recent offset bytes, so must
+      // be copied forward one byte at a time.
+      while (len--)
+        *dst++ = *match++;
+    }
+  }
+}
+
+packed_lines* pl_pack(const wstring* lines, unsigned nlines) {
+  packed_lines* this = new(packed_lines);
+  this->nlines = nlines;
+
+  for (unsigned i = 0; i < nlines; ++i) {
+    for (wstring s = lines[i]; *s; ++s)
+      this->raw_size += utf8_len((unsigned)*s);
+    ++this->raw_size;
+  }
+
+  unsigned char* raw = xmalloc(this->raw_size), * dst = raw;
+  for (unsigned i = 0; i < nlines; ++i) {
+    for (wstring s = lines[i]; *s; ++s)
+      dst = utf8_put(dst, (unsigned)*s);
+    *dst++ = 0;
+  }
+
+  unsigned char* compressed =
+    xmalloc(this->raw_size + this->raw_size/255 + 16);
+  this->size = lz_compress(raw, this->raw_size, compressed);
+  this->data = gcalloc_atomic(this->size);
+  memcpy(this->data, compressed, this->size);
+
+  free(compressed);
+  free(raw);
+  return this;
+}
+
+void pl_unpack(const packed_lines* this, wstring* dst) {
+  unsigned char* raw = xmalloc(this->raw_size);
+  const unsigned char* src = raw;
+  lz_decompress(this->data, this->size, raw);
+
+  for (unsigned i = 0; i < this->nlines; ++i) {
+    // Every character begins with exactly one byte which is not a
+    // continuation byte.
+    size_t len = 0;
+    for (const unsigned char* s = src; *s; ++s)
+      len += (0x80 != (*s & 0xC0));
+
+    mwstring line = wcalloc(len+1);
+    for (size_t j = 0; j < len; ++j) {
+      unsigned long long c;
+      src = utf8_get(src, &c);
+      line[j] = (wchar_t)c;
+    }
+    ++src; // Skip the terminator
+
+    dst[i] = line;
+  }
+
+  free(raw);
+}
+
+deftest(packed_lines_round_trip) {
+  static const wchar_t odd[] = { L'ⓒ', 0x10FFFF, 0x7FFFFFFF, -1, L'x', 0 };
+  unsigned n = 3000;
+  wstring* lines = gcalloc(n * sizeof(wstring));
+  wstring* out = gcalloc(n * sizeof(wstring));
+
+  for (unsigned i = 0; i < n; ++i) {
+    switch (i % 4) {
+    case 0: lines[i] = L""; break;
+    case 1: lines[i] = odd; break;
+    case 2: {
+      wchar_t text[64];
+      swprintf(text, lenof(text), L"Line %u of the packed_lines test", i);
+      lines[i] = wstrdup(text);
+    } break;
+    case 3: {
+      // Long runs exercise overlapping matches and extended lengths
+      mwstring run = wcalloc(601);
+      wmemset(run, L'a' + i % 26, 600);
+      lines[i] = run;
+    } break;
+    }
+  }
+
+  packed_lines* packed = pl_pack(lines, n);
+  assert(n == packed->nlines);
+  assert(packed->size < packed->raw_size / 4);
+
+  pl_unpack(packed, out);
+  for (unsigned i = 0; i < n; ++i)
+    assert(!wcscmp(lines[i], out[i]));
+
+  // Degenerate cases
+  packed = pl_pack(NULL, 0);
+  pl_unpack(packed, NULL);
+  packed = pl_pack(lines, 1);
+  pl_unpack(packed, out);
+  assert(!*out[0]);
+}
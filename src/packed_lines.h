@@ -0,0 +1,66 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef PACKED_LINES_H_
+#define PACKED_LINES_H_
+
+/**
+ * A compressed, immutable copy of an array of wstrings, as kept by a cold
+ * FileBuffer. The lines are encoded as UTF-8, each terminated by a NUL byte,
+ * and that stream is then compressed with a byte-oriented LZ77 scheme in the
+ * style of LZ4, which favours fast decompression over ratio.
+ *
+ * Instances are allocated on the heap with the GC; data is allocated with
+ * gcalloc_atomic(), so that the collector never scans it for pointers.
+ */
+typedef struct packed_lines {
+  /**
+   * The number of lines packed.
+   */
+  unsigned nlines;
+  /**
+   * The length of the uncompressed UTF-8 stream, in bytes.
+   */
+  size_t raw_size;
+  /**
+   * The length of data, in bytes.
+   */
+  size_t size;
+  unsigned char* data;
+} packed_lines;
+
+/**
+ * Packs the given array of nlines wstrings. Any wchar_t value is preserved.
+ */
+packed_lines* pl_pack(const wstring* lines, unsigned nlines);
+
+/**
+ * Unpacks the lines into dst, which must have space for this->nlines
+ * wstrings. Each line is a new, separately-allocated mwstring.
+ */
+void pl_unpack(const packed_lines* this, wstring* dst);
+
+/**
+ * Returns the approximate number of bytes of memory held by the
+ * packed_lines.
+ */
+static inline size_t pl_footprint(const packed_lines* this) {
+  return sizeof(packed_lines) + this->size;
+}
+
+#endif /* PACKED_LINES_H_ */
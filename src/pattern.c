@@ -20,6 +20,7 @@
 #include <wctype.h>
 
 #include "regex_support.h"
+#include "steno_index.h"
 
 /*
   TITLE: Pattern Matching Utilities
@@ -100,6 +101,14 @@
     called.
     --
     $w_pseudo_steno_expand MUST NOT be altered by this function.
+
+  SYMBOL: $p_pseudo_steno_expand_index
+    If non-NULL, a steno_index* whose vocabulary $f_pseudo_steno_expand
+    searches before polling $p_pseudo_steno_expand_enumerator, as if it were
+    the first subsequence of the enumeration. Large vocabularies should be
+    provided this way, since the index can rule out most words without
+    examining them. If NULL, or if no expansion is found within the index,
+    the enumerator is used as usual (if it is non-NULL).
  */
 static bool is_alternate_word_boundary(wchar_t, wchar_t);
 static bool starts_with_same_char(wstring, wstring);
@@ -117,26 +126,32 @@ defun($h_pseudo_steno_expand) {
     return;
   }
 
+  wstring input = $w_pseudo_steno_expand;
   wstring best = NULL;
-  $y_pseudo_steno_expand_enumerator = true;
+  void consider(wstring candidate) {
+    if (starts_with_same_char(candidate, input) &&
+        is_supersequence_of_input(candidate, input) &&
+        can_fit_word_boundary_rule(candidate, input)) {
+      if (!best)
+        best = candidate;
+      else
+        best =
+          select_shorter(best, candidate) ?:
+          select_with_fewer_word_boundaries(best, candidate) ?:
+          select_with_latest_insertions(best, candidate, input) ?:
+          select_with_most_common_insertion(best, candidate, input) ?:
+          select_asciibetically_first(best, candidate);
+    }
+  }
+
+  if ($p_pseudo_steno_expand_index)
+    sti_each_candidate($p_pseudo_steno_expand_index, input, consider);
+
+  $y_pseudo_steno_expand_enumerator = !!$p_pseudo_steno_expand_enumerator;
   while ($y_pseudo_steno_expand_enumerator && !best) {
     wstring candidate;
-    while ((candidate = enumerate_next_expansion())) {
-      wstring input = $w_pseudo_steno_expand;
-      if (starts_with_same_char(candidate, input) &&
-          is_supersequence_of_input(candidate, input) &&
-          can_fit_word_boundary_rule(candidate, input)) {
-        if (!best)
-          best = candidate;
-        else
-          best =
-            select_shorter(best, candidate) ?:
-            select_with_fewer_word_boundaries(best, candidate) ?:
-            select_with_latest_insertions(best, candidate, input) ?:
-            select_with_most_common_insertion(best, candidate, input) ?:
-            select_asciibetically_first(best, candidate);
-      }
-    }
+    while ((candidate = enumerate_next_expansion()))
+      consider(candidate);
   }
 
   $w_pseudo_steno_expand = best;
@@ -193,50 +208,54 @@ deftest(is_supersequence_of_input) {
 }
 
 static bool can_fit_word_boundary_rule(wstring candidate, wstring input) {
-  // Base case: strings exhausted
-  if (!*input || !*candidate)
-    return *input == *candidate;
-
   /*
-    Invariant: input[1] and candidate[1] have defined values.
-
-    Invariant: We have already matched input[0]; candidate[0] is either
-    matched or already rejected.
-      Thus, input is moved forward whenever a potential match is found between
-      input[1] and candidate[1].
-
-    There may be multiple possible ways to distribute the matches, so use
-    recursion to "fork" the check in case we need to backtrack.
-
-    If the input pair is not a word boundary, the candidate pair must not be a
-    word boundary. If the input pair is a word boundary (using the alternate
-    rule), we don't care about the candidate pair.
-
-    If there is a candidate-input match, we don't need to worry about word
-    boundaries, because any boundary indicated by candidate[1] and which also
-    matches input[1] would cause the input pair to be a word boundary.
+    Both strings are considered to include their terminating NUL, which must
+    be matched to each other. Matching input[0] to candidate[0] is a given.
+
+    Rather than trying each way of distributing the input characters over the
+    candidate and backtracking when one fails, walk the candidate once,
+    tracking the set of input prefixes which could have been matched so far
+    by some valid distribution. reachable[j] indicates that input[j] has been
+    matched at or before the current candidate position, and that every
+    character skipped since then could be inserted without violating the
+    rule.
+
+    Moving from candidate[k] to candidate[k+1], an input prefix j can
+    - advance to j+1 if candidate[k+1] == input[j+1];
+    - stay at j (ie, candidate[k+1] is inserted) if the input pair
+      input[j],input[j+1] is a word boundary (using the alternate rule), or
+      the candidate pair candidate[k],candidate[k+1] is not.
    */
-  bool input_pair_is_word_boundary =
-    is_alternate_word_boundary(input[0], input[1]);
-  while (*candidate) {
-    if (candidate[1] == input[1] &&
-        can_fit_word_boundary_rule(candidate+1, input+1))
-      return true;
-
-    // No match or backtracking
+  unsigned ilen = wcslen(input);
+  if (!ilen || !*candidate)
+    return *input == *candidate;
 
-    if (!input_pair_is_word_boundary &&
-        is_word_boundary(candidate[0], candidate[1]))
-      // This possibility fails the rule
-      return false;
+  bool reachable[ilen+1], next[ilen+1];
+  bool input_boundary[ilen];
+  memset(reachable, 0, sizeof(reachable));
+  reachable[0] = true;
+  for (unsigned j = 0; j < ilen; ++j)
+    input_boundary[j] = is_alternate_word_boundary(input[j], input[j+1]);
+
+  for (; *candidate; ++candidate) {
+    bool any = false;
+    bool candidate_boundary = is_word_boundary(candidate[0], candidate[1]);
+    memset(next, 0, sizeof(next));
+    for (unsigned j = 0; j < ilen; ++j) {
+      if (!reachable[j]) continue;
+
+      if (candidate[1] == input[j+1])
+        any = next[j+1] = true;
+      if (input_boundary[j] || !candidate_boundary)
+        any = next[j] = true;
+    }
 
-    // No match, but the insertion here is OK
-    ++candidate;
+    if (!any) return false;
+    memcpy(reachable, next, sizeof(reachable));
   }
 
-  // Reached end of candidate before end of input; the candidate does not
-  // match, at least with the choices made so far
-  return false;
+  // The candidate's NUL can only have been matched by the input's
+  return reachable[ilen];
 }
 
 deftest(can_fit_word_boundary_rule) {
@@ -393,6 +412,330 @@ deftest(select_asciibetically_first) {
   assert(!wcscmp(L"bar", select_asciibetically_first(L"bar", L"foo")));
 }
 
+/*
+  Extracts runs of literal characters which any string matched by the given
+  regular expression must contain. This is deliberately conservative: only
+  characters outside of any group are considered, anything preceding an
+  optional quantifier is dropped, and patterns using top-level alternation or
+  option settings yield nothing at all.
+ */
+static list_w regex_required_literals(wstring rx) {
+  list_w literals = NULL;
+  wchar_t run[wcslen(rx)+1];
+  unsigned run_len = 0;
+  signed depth = 0;
+  bool skip_alnum = false;
+
+#define END_RUN()                                               \
+  do {                                                          \
+    if (run_len) {                                              \
+      run[run_len] = 0;                                         \
+      lpush_w(literals, wstrdup(run));                          \
+      run_len = 0;                                              \
+    }                                                           \
+  } while (0)
+
+  while (*rx) {
+    wchar_t ch = *rx++;
+
+    // Trailing operands of an escape like \x41 or \p{L} are not literal
+    if (skip_alnum) {
+      if (iswalnum(ch) || ch == L'{' || ch == L'}' ||
+          ch == L'<' || ch == L'>' || ch == L'\'')
+        continue;
+      skip_alnum = false;
+    }
+
+    switch (ch) {
+    case L'|':
+      if (!depth) return NULL;
+      break;
+
+    case L'(':
+      if (*rx == L'?') return NULL;
+      END_RUN();
+      ++depth;
+      break;
+
+    case L')':
+      END_RUN();
+      if (--depth < 0) return NULL;
+      break;
+
+    case L'?':
+    case L'*':
+      // The preceding character is optional
+      if (run_len) --run_len;
+      END_RUN();
+      break;
+
+    case L'{':
+      if (run_len) --run_len;
+      END_RUN();
+      while (*rx && *rx++ != L'}');
+      break;
+
+    case L'+':
+    case L'.':
+    case L'^':
+    case L'$':
+      END_RUN();
+      break;
+
+    case L'[':
+      END_RUN();
+      if (*rx == L'^') ++rx;
+      if (*rx == L']') ++rx;
+      while (*rx && *rx != L']') {
+        if (*rx == L'\\' && rx[1]) ++rx;
+        else if (*rx == L'[' && rx[1] == L':' && wcsstr(rx, L":]"))
+          rx = wcsstr(rx, L":]") + 1;
+        ++rx;
+      }
+      if (*rx) ++rx;
+      break;
+
+    case L'\\':
+      ch = *rx++;
+      if (ch == L'Q') return NULL;
+      if (iswalnum(ch)) {
+        END_RUN();
+        skip_alnum = true;
+        break;
+      }
+      /* fall through */
+
+    default:
+      if (!depth)
+        run[run_len++] = ch;
+      break;
+    }
+  }
+
+  END_RUN();
+#undef END_RUN
+  return literals;
+}
+
+deftest(regex_required_literals) {
+  // Whether the regex yields exactly the two given literals, last first
+  #define REQUIRES(regex, last, first) ({                           \
+        list_w l = regex_required_literals(regex);                  \
+        2 == llen_w(l) && !wcscmp(last, l->car) &&                  \
+          !wcscmp(first, l->cdr->car); })
+
+  assert(REQUIRES(L"foo.*bar", L"bar", L"foo"));
+  assert(REQUIRES(L"colou?r", L"r", L"colo"));
+  assert(REQUIRES(L"\\x41bc\\.d(ef|gh)ij[k]+", L"ij", L".d"));
+  #undef REQUIRES
+
+  assert(!regex_required_literals(L"foo|bar"));
+  assert(!regex_required_literals(L"(?i)foo"));
+}
+
+/*
+  Non-regex Patterns are compiled into an Aho-Corasick automaton over all of
+  their terms and anchors, so that a single pass over the input finds every
+  occurrence of every literal. Anchors are then just checks on where their
+  occurrences begin or end.
+
+  States are numbered, with state 0 being the root. Edges out of each state
+  are kept sorted by character so they can be binary-searched.
+ */
+struct ac_state {
+  wchar_t* keys;
+  unsigned* next;
+  unsigned nedges;
+  // State to fall back to when no edge matches
+  unsigned fail;
+  // Nearest state reachable by failure links which ends a literal, or 0
+  unsigned dict;
+  // Index of the distinct unanchored term which ends here, or -1
+  signed term;
+  // Whether this state ends the begin or end anchor
+  bool begin, end;
+  // Length of the string spelled by the path to this state
+  unsigned depth;
+};
+
+typedef struct {
+  struct ac_state* states;
+  unsigned nstates;
+  // Number of distinct unanchored terms
+  unsigned nterms;
+  bool has_begin, has_end;
+  unsigned begin_len;
+} ac_automaton;
+
+static signed ac_find_edge(const struct ac_state* state, wchar_t ch) {
+  unsigned lo = 0, hi = state->nedges;
+  while (lo < hi) {
+    unsigned mid = (lo+hi)/2;
+    if (state->keys[mid] == ch)
+      return mid;
+    else if (state->keys[mid] < ch)
+      lo = mid+1;
+    else
+      hi = mid;
+  }
+
+  return -1;
+}
+
+static unsigned ac_add_state(ac_automaton* ac, unsigned depth) {
+  ac->states = gcrealloc(ac->states, (ac->nstates+1)*sizeof(struct ac_state));
+  struct ac_state* state = ac->states + ac->nstates;
+  memset(state, 0, sizeof(struct ac_state));
+  state->term = -1;
+  state->depth = depth;
+  return ac->nstates++;
+}
+
+static unsigned ac_insert(ac_automaton* ac, wstring str) {
+  unsigned curr = 0;
+  for (; *str; ++str) {
+    signed edge = ac_find_edge(ac->states + curr, *str);
+    if (edge >= 0) {
+      curr = ac->states[curr].next[edge];
+      continue;
+    }
+
+    unsigned child = ac_add_state(ac, ac->states[curr].depth+1);
+    struct ac_state* state = ac->states + curr;
+    unsigned ix = 0;
+    while (ix < state->nedges && state->keys[ix] < *str) ++ix;
+    state->keys = gcrealloc(state->keys, (state->nedges+1)*sizeof(wchar_t));
+    state->next = gcrealloc(state->next, (state->nedges+1)*sizeof(unsigned));
+    memmove(state->keys+ix+1, state->keys+ix,
+            (state->nedges-ix)*sizeof(wchar_t));
+    memmove(state->next+ix+1, state->next+ix,
+            (state->nedges-ix)*sizeof(unsigned));
+    state->keys[ix] = *str;
+    state->next[ix] = child;
+    ++state->nedges;
+    curr = child;
+  }
+
+  return curr;
+}
+
+static unsigned ac_step(const ac_automaton* ac, unsigned curr, wchar_t ch) {
+  while (true) {
+    signed edge = ac_find_edge(ac->states + curr, ch);
+    if (edge >= 0)
+      return ac->states[curr].next[edge];
+    if (!curr)
+      return 0;
+    curr = ac->states[curr].fail;
+  }
+}
+
+static ac_automaton* ac_compile(list_w terms, wstring begin, wstring end) {
+  ac_automaton* ac = new(ac_automaton);
+  ac_add_state(ac, 0);
+
+  for (; terms; terms = terms->cdr) {
+    unsigned state = ac_insert(ac, terms->car);
+    if (-1 == ac->states[state].term)
+      ac->states[state].term = ac->nterms++;
+  }
+
+  // (Note that ac_insert() may move ac->states.)
+  if (begin) {
+    unsigned state = ac_insert(ac, begin);
+    ac->states[state].begin = true;
+    ac->has_begin = true;
+    ac->begin_len = wcslen(begin);
+  }
+  if (end) {
+    unsigned state = ac_insert(ac, end);
+    ac->states[state].end = true;
+    ac->has_end = true;
+  }
+
+  // Breadth-first traversal to set failure and dictionary links; since
+  // children always have larger depth, visiting states in order of depth
+  // guarantees each parent's links are known before its children's.
+  unsigned queue[ac->nstates];
+  unsigned head = 0, tail = 0;
+  queue[tail++] = 0;
+  while (head < tail) {
+    unsigned parent = queue[head++];
+    for (unsigned i = 0; i < ac->states[parent].nedges; ++i) {
+      wchar_t ch = ac->states[parent].keys[i];
+      unsigned child = ac->states[parent].next[i];
+      unsigned fail =
+        parent? ac_step(ac, ac->states[parent].fail, ch) : 0;
+      struct ac_state* fs = ac->states + fail;
+      ac->states[child].fail = fail;
+      ac->states[child].dict =
+        (-1 != fs->term || fs->begin || fs->end)? fail : fs->dict;
+      queue[tail++] = child;
+    }
+  }
+
+  return ac;
+}
+
+static bool ac_matches(const ac_automaton* ac, wstring input) {
+  bool found[ac->nterms+1];
+  unsigned nfound = 0;
+  bool begin_ok = !ac->has_begin;
+  signed end_at = -1, last_nonws = -1;
+  memset(found, 0, sizeof(found));
+
+  unsigned curr = 0;
+  for (signed i = 0; input[i]; ++i) {
+    if (!iswspace(input[i]))
+      last_nonws = i;
+
+    curr = ac_step(ac, curr, input[i]);
+    for (unsigned s = curr; s; s = ac->states[s].dict) {
+      const struct ac_state* state = ac->states + s;
+      if (-1 != state->term && !found[state->term]) {
+        found[state->term] = true;
+        ++nfound;
+      }
+      if (state->begin && i+1 == (signed)state->depth)
+        begin_ok = true;
+      if (state->end)
+        end_at = i;
+    }
+
+    // The begin anchor can't match anywhere past its own length
+    if (!begin_ok && i+1 >= (signed)ac->begin_len)
+      return false;
+    // Nothing else can change the outcome if there is no end anchor
+    if (!ac->has_end && begin_ok && nfound == ac->nterms)
+      return true;
+  }
+
+  return begin_ok && nfound == ac->nterms &&
+    (!ac->has_end || (end_at >= 0 && end_at == last_nonws));
+}
+
+deftest(aho_corasick_matching) {
+  #define MATCHES(terms, begin, end, input)             \
+    ac_matches(ac_compile(terms, begin, end), input)
+
+  list_w terms = NULL;
+  lpush_w(terms, L"he");
+  lpush_w(terms, L"she");
+  lpush_w(terms, L"hers");
+  assert(MATCHES(terms, NULL, NULL, L"ushers"));
+  assert(MATCHES(terms, NULL, NULL, L"hers she"));
+  assert(!MATCHES(terms, NULL, NULL, L"she he"));
+
+  assert(MATCHES(NULL, L"foo", L"bar", L"foo bar"));
+  assert(MATCHES(NULL, L"foo", L"bar", L"foobar  "));
+  assert(!MATCHES(NULL, L"foo", L"bar", L"fo bar"));
+  assert(!MATCHES(NULL, L"foo", L"bar", L"foo barx"));
+  assert(!MATCHES(NULL, L"foo", L"bar", L"xfoo bar"));
+
+  assert(!MATCHES(NULL, L"abcd", NULL, L"abc"));
+  #undef MATCHES
+}
+
 /*
   SYMBOL: $c_Pattern
     Encapsulates data used for Soliloquy's pattern matching. Unlike some other
@@ -428,6 +771,17 @@ deftest(select_asciibetically_first) {
   SYMBOL: $p_Pattern_regex
     A regular_expression* which this pattern uses for matching. If non-NULL,
     all other Pattern fields are irrelevant.
+
+  SYMBOL: $p_Pattern_automaton
+    An automaton compiled from the terms and anchors of a non-regex pattern,
+    which finds all of them in a single pass over the input. NULL for regex
+    patterns and patterns with exactly one unanchored term.
+
+  SYMBOL: $lw_Pattern_literals
+    Literal strings which every input matched by this pattern must contain
+    somewhere. This is used to cheaply rule out inputs before actually
+    matching them; it need not be complete, and may be NULL even for patterns
+    that have requirements.
  */
 defun($h_Pattern) {
   wstring control_r = wcschr($w_Pattern_pattern, L'R' - L'@');
@@ -440,6 +794,7 @@ defun($h_Pattern) {
     $w_Pattern_pattern = copy;
 
     $p_Pattern_regex = rx_compile($w_Pattern_pattern, NULL);
+    $lw_Pattern_literals = regex_required_literals($w_Pattern_pattern);
     return;
   }
 
@@ -479,6 +834,19 @@ defun($h_Pattern) {
       lpush_w($lw_Pattern_terms, wstrdup(token));
     }
   }
+
+  $lw_Pattern_literals = $lw_Pattern_terms;
+  if ($w_Pattern_begin_anchor)
+    lpush_w($lw_Pattern_literals, $w_Pattern_begin_anchor);
+  if ($w_Pattern_end_anchor)
+    lpush_w($lw_Pattern_literals, $w_Pattern_end_anchor);
+
+  // A lone term is better served by a simple scan for its first character
+  if ($w_Pattern_begin_anchor || $w_Pattern_end_anchor ||
+      ($lw_Pattern_terms && $lw_Pattern_terms->cdr))
+    $p_Pattern_automaton = ac_compile($lw_Pattern_terms,
+                                      $w_Pattern_begin_anchor,
+                                      $w_Pattern_end_anchor);
 }
 
 /*
@@ -510,48 +878,20 @@ defun($h_Pattern_matches) {
       return;
     }
 
-    // Check beginning anchor if required
-    if ($w_Pattern_begin_anchor) {
-      if (wcsncmp($w_Pattern_input, $w_Pattern_begin_anchor,
-                  wcslen($w_Pattern_input))) {
-        $y_Pattern_matches = false;
-        return;
-      }
-    }
-
-    // Check end anchor if required
-    if ($w_Pattern_end_anchor) {
-      if (wcslen($w_Pattern_end_anchor) > wcslen($w_Pattern_input)) {
-        // Anchor is longer than string, so it can't match
-        $y_Pattern_matches = false;
-        return;
-      }
-
-      // Starting from the end, locate the first non-whitespace character, then
-      // move back by the number of characters in the anchor
-      wstring input = $w_Pattern_input + wcslen($w_Pattern_input);
-      while (iswspace(*input) && input != $w_Pattern_input) {
-        --input;
-      } 
-
-      // Ensure there is enough space for the anchor to possibly match
-      if (((unsigned)(input - $w_Pattern_input)) <
-          wcslen($w_Pattern_end_anchor)) {
-        $y_Pattern_matches = false;
-        return;
-      }
-
-      input -= wcslen($w_Pattern_end_anchor);
-      // See whether the anchor actually matches
-      if (wcsncmp(input,$w_Pattern_end_anchor,wcslen($w_Pattern_end_anchor))) {
-        $y_Pattern_matches = false;
-        return;
-      }
+    if ($p_Pattern_automaton) {
+      $y_Pattern_matches = ac_matches($p_Pattern_automaton, $w_Pattern_input);
+    } else if ($lw_Pattern_terms) {
+      // Single term; only try to match where its first character occurs
+      wstring term = $lw_Pattern_terms->car;
+      size_t len = wcslen(term);
+      wstring candidate = $w_Pattern_input;
+      while ((candidate = wcschr(candidate, term[0])) &&
+             wcsncmp(candidate, term, len))
+        ++candidate;
+
+      $y_Pattern_matches = !!candidate;
+    } else {
+      $y_Pattern_matches = true;
     }
-
-    // Check for other terms
-    $y_Pattern_matches =
-      every_w($lw_Pattern_terms,
-              lambdab((wstring term), wcsstr($w_Pattern_input, term)));
   }
 }
@@ -21,27 +21,57 @@
 #include "regex_support.h"
 
 #include <assert.h>
+#include <wchar.h>
+
+/*
+  When the 32-bit code unit PCRE2 library is available (and wchar_t is wide
+  enough to hold a full code point, which is always the case on systems we
+  care about), wstrings are handed to PCRE2 as-is, so no conversion to or from
+  UTF-8 is needed on any match. Otherwise, fall back to the original PCRE
+  library operating on UTF-8.
+*/
+#if defined(HAVE_PCRE2_32) && WCHAR_MAX >= 0x10FFFF
+#define USE_PCRE2 1
+#define PCRE2_CODE_UNIT_WIDTH 32
+#include <pcre2.h>
+#else
 #include <pcre.h>
+#endif
 
 /*
   Our regular expression data consists primarily of the PCRE structure. We
   also keep track of how many times rx_match() has been called on the
   expression. When it reaches STUDY_THRESH, try to study it to improve
   performance. When it reaches JIT_THRESH, try to compile it to native code.
+
+  PCRE2 always performs the analysis done by studying at compile time, so
+  STUDY_THRESH only has an effect with the PCRE backend; with PCRE2,
+  JIT_THRESH triggers JIT compilation as before.
 */
 #define STUDY_THRESH 32
 #define JIT_THRESH 256
 struct regular_expression {
+#ifdef USE_PCRE2
+  pcre2_code* native;
+  pcre2_match_data* match_data;
+#else
   pcre* native;
   pcre_extra* aux;
+#endif
   unsigned use_count;
 };
 
 static void finalise_regular_expression(void* rev, void* ignore) {
   regular_expression* re = rev;
+#ifdef USE_PCRE2
+  if (re->match_data)
+    pcre2_match_data_free(re->match_data);
+  pcre2_code_free(re->native);
+#else
   if (re->aux)
     pcre_free_study(re->aux);
   pcre_free(re->native);
+#endif
 }
 
 static regular_expression* alloc_re(void) {
@@ -59,6 +89,88 @@ static regular_expression* alloc_re(void) {
     Rollback type if regular expression compilation fails and the error parm to
     rx_comple() was NULL.
  */
+static regular_expression* compile_failed(string* error_out) {
+  if (error_out) {
+    return NULL;
+  } else {
+    $v_rollback_type = $u_invalid_regular_expression;
+    tx_rollback();
+  }
+}
+
+#ifdef USE_PCRE2
+
+// Match context carrying the JIT stack, created the first time any expression
+// is JIT-compiled.
+static pcre2_match_context* jit_match_context;
+
+regular_expression* rx_compile(wstring pattern, string* error_out) {
+  static const unsigned char* unicode_table;
+  if (!unicode_table)
+    unicode_table = pcre2_maketables(NULL);
+
+  static pcre2_compile_context* context;
+  if (!context) {
+    context = pcre2_compile_context_create(NULL);
+    pcre2_set_character_tables(context, unicode_table);
+  }
+
+  int errcode;
+  PCRE2_SIZE dont_care;
+  pcre2_code* re = pcre2_compile((PCRE2_SPTR)pattern, PCRE2_ZERO_TERMINATED,
+                                 PCRE2_UTF, &errcode, &dont_care, context);
+  if (!re) {
+    PCRE2_UCHAR message[256];
+    pcre2_get_error_message(errcode, message, lenof(message));
+    *(error_out ?: &$s_rollback_reason) = wstrtocstr((wstring)message);
+    return compile_failed(error_out);
+  }
+
+  regular_expression* ret = alloc_re();
+  ret->native = re;
+  ret->match_data = pcre2_match_data_create_from_pattern(re, NULL);
+  return ret;
+}
+
+unsigned rx_match(regular_expression* this, wstring str,
+                  rx_group* groups, unsigned max_groups) {
+  // Increment use count, and perform compiling if it hits that threshhold
+  ++this->use_count;
+  if (this->use_count == JIT_THRESH &&
+      !pcre2_jit_compile(this->native, PCRE2_JIT_COMPLETE)) {
+    // Set up a 1MB stack for the JIT code
+    if (!jit_match_context) {
+      pcre2_jit_stack* jitstack =
+        pcre2_jit_stack_create(32*1024, 1024*1024, NULL);
+      if (jitstack) {
+        jit_match_context = pcre2_match_context_create(NULL);
+        pcre2_jit_stack_assign(jit_match_context, NULL, jitstack);
+      }
+    }
+  }
+
+  int result = pcre2_match(this->native, (PCRE2_SPTR)str, wcslen(str), 0,
+                           0, this->match_data, jit_match_context);
+  if (result < 0) return 0; // No match
+
+  // Match, extract groups. A result of zero means the ovector was too small,
+  // which can't happen since it was sized from the pattern.
+  assert(result > 0);
+  PCRE2_SIZE* ovector = pcre2_get_ovector_pointer(this->match_data);
+  for (unsigned i = 0; i < (unsigned)result && i < max_groups; ++i) {
+    if (PCRE2_UNSET == ovector[i*2]) {
+      groups[i].begin = groups[i].end = -1;
+    } else {
+      groups[i].begin = ovector[i*2+0];
+      groups[i].end = ovector[i*2+1];
+    }
+  }
+
+  return result;
+}
+
+#else /* !USE_PCRE2 */
+
 regular_expression* rx_compile(wstring pattern, string* error_out) {
   static const unsigned char* unicode_table;
   if (!unicode_table)
@@ -69,22 +181,26 @@ regular_expression* rx_compile(wstring pattern, string* error_out) {
   int dont_care;
   pcre* re = pcre_compile(pattern8, PCRE_UTF8, error, &dont_care,
                           unicode_table);
-  if (!re) {
-    if (error_out) {
-      return NULL;
-    } else {
-      $v_rollback_type = $u_invalid_regular_expression;
-      tx_rollback();
-    }
-  }
+  if (!re)
+    return compile_failed(error_out);
 
   regular_expression* ret = alloc_re();
   ret->native = re;
   return ret;
 }
 
+/* Converts a byte offset into the UTF-8 string str into a character offset. */
+static signed utf8_char_offset(string str, signed off) {
+  signed ret = 0;
+  for (signed i = 0; i < off; ++i)
+    if (0x80 != (str[i] & 0xC0))
+      ++ret;
+
+  return ret;
+}
+
 unsigned rx_match(regular_expression* this, wstring str,
-                  wstring* groups, unsigned max_groups) {
+                  rx_group* groups, unsigned max_groups) {
   string str8 = wstrtocstr(str);
 
   // Increment use count, and perform studying/compiling if it hits those
@@ -130,12 +246,8 @@ unsigned rx_match(regular_expression* this, wstring str,
   unsigned cnt = 0;
   while (cnt < lenof(group_pairs)/3 && group_pairs[cnt*3] != -1) {
     if (cnt < max_groups) {
-      unsigned sz = group_pairs[cnt*3+1] - group_pairs[cnt*3+0];
-      char buff[sz+1];
-      buff[sz] = 0;
-      memcpy(buff, str8 + group_pairs[cnt*3+0], sz);
-
-      groups[cnt] = cstrtowstr(buff);
+      groups[cnt].begin = utf8_char_offset(str8, group_pairs[cnt*3+0]);
+      groups[cnt].end = utf8_char_offset(str8, group_pairs[cnt*3+1]);
     }
 
     ++cnt;
@@ -146,3 +258,15 @@ unsigned rx_match(regular_expression* this, wstring str,
   assert(cnt);
   return cnt;
 }
+
+#endif /* USE_PCRE2 */
+
+mwstring rx_group_str(wstring str, rx_group group) {
+  if (group.begin < 0) return NULL;
+
+  unsigned sz = group.end - group.begin;
+  mwstring ret = wcalloc(sz+1);
+  wmemcpy(ret, str + group.begin, sz);
+  ret[sz] = 0;
+  return ret;
+}
@@ -35,17 +35,37 @@ typedef struct regular_expression regular_expression;
  */
 regular_expression* rx_compile(wstring, string* error);
 
+/**
+ * Describes a single captured group from rx_match(), as a half-open range of
+ * character offsets into the subject string. Groups which did not participate
+ * in the match have both offsets set to -1.
+ */
+typedef struct rx_group {
+  signed begin, end;
+} rx_group;
+
 /**
  * Matches the given regular expression to the given string. Returns the number
  * of groups which matched (0 means no match; >=1 is match). Up to max_groups
- * integers will be written to *groups, indicating strings captured by the
- * pattern (where group 0 is the whole string which matched the pattern).
+ * entries will be written to *groups, indicating the ranges of the subject
+ * captured by the pattern (where group 0 is the whole range which matched the
+ * pattern). No strings are allocated; use rx_group_str() if a copy of a
+ * captured group is needed.
  *
  * Be aware that groups MUST be a valid pointer unless max_groups is zero,
  * and that the return value may be greater than max_groups. Values within
  * groups beyond min(max_pairs, return_value) will not be altered.
+ *
+ * A regular_expression carries scratch space for matching, so it must not be
+ * matched from more than one thread at a time.
  */
 unsigned rx_match(regular_expression*, wstring,
-                  wstring* groups, unsigned max_groups);
+                  rx_group* groups, unsigned max_groups);
+
+/**
+ * Returns a freshly-allocated copy of the portion of str described by the
+ * given group, or NULL if the group did not participate in the match.
+ */
+mwstring rx_group_str(wstring str, rx_group group);
 
 #endif /* REGEX_SUPPORT_H_ */
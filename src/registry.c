@@ -0,0 +1,114 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "registry.slc"
+
+#include "registry.h"
+
+/*
+  TITLE: Object Registries
+  OVERVIEW: Provides the registry, a set of objects with constant-time addition
+    and removal, used for the global lists of live objects (such as
+    $p_buffers) which objects join on construction and leave on destruction.
+*/
+
+registry* reg_new(void) {
+  registry* this = new(registry);
+  this->head.prev = this->head.next = &this->head;
+  this->head.linked = true;
+  return this;
+}
+
+static void reg_link(registry_node* node) {
+  node->prev->next = node;
+  node->next->prev = node;
+  node->linked = true;
+}
+
+static void reg_unlink(registry_node* node) {
+  // node->next is left alone, so that iteration positioned on this node can
+  // continue past it.
+  node->prev->next = node->next;
+  node->next->prev = node->prev;
+  node->linked = false;
+}
+
+/* Transactions undo changes in the reverse order they were made, so the
+ * neighbours a node had when it was unlinked are its neighbours again by the
+ * time it is relinked.
+ */
+static void undo_add(void* vnode) {
+  registry_node* node = vnode;
+  reg_unlink(node);
+  --node->owner->len;
+}
+
+static void undo_remove(void* vnode) {
+  registry_node* node = vnode;
+  reg_link(node);
+  ++node->owner->len;
+}
+
+registry_node* reg_add(registry* this, object obj) {
+  registry_node* node = new(registry_node);
+  node->obj = obj;
+  node->owner = this;
+  node->prev = &this->head;
+  node->next = this->head.next;
+  reg_link(node);
+  ++this->len;
+
+  tx_push_undo(undo_add, node);
+  return node;
+}
+
+void reg_remove(registry_node* node) {
+  if (!node->linked) return;
+
+  reg_unlink(node);
+  --node->owner->len;
+
+  tx_push_undo(undo_remove, node);
+}
+
+deftest(registry_iteration_is_stable) {
+  registry* reg = reg_new();
+  object objs[5];
+  registry_node* nodes[5];
+  for (unsigned i = 0; i < lenof(objs); ++i)
+    nodes[i] = reg_add(reg, objs[i] = object_new(NULL));
+  assert(objs[4] == reg_first(reg));
+
+  // Remove the current and the following object while iterating over them,
+  // and add one which must not be visited.
+  unsigned visited = 0;
+  REG_EACH(curr, reg) {
+    assert(curr->obj != objs[2]);
+    if (curr->obj == objs[3]) {
+      reg_remove(nodes[3]);
+      reg_remove(nodes[2]);
+      reg_add(reg, object_new(NULL));
+    }
+    ++visited;
+  }
+  assert(4 == visited);
+  assert(4 == reg->len);
+
+  reg_remove(nodes[2]);
+  assert(4 == reg->len);
+}
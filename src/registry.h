@@ -0,0 +1,101 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef REGISTRY_H_
+#define REGISTRY_H_
+
+/**
+ * A node of a registry. obj is the registered object, and owner the registry
+ * the node belongs to. Nodes are allocated by reg_add().
+ */
+typedef struct registry_node {
+  object obj;
+  struct registry* owner;
+  struct registry_node* prev, * next;
+  bool linked;
+} registry_node;
+
+/**
+ * A set of objects, such as all FileBuffers in existence, supporting
+ * constant-time addition and removal. The registry is a circular doubly-linked
+ * list through a sentinel node; callers keep the node returned by reg_add() so
+ * that they can later remove the object without searching for it. Objects are
+ * kept in reverse order of addition, so reg_first() is the most recently added
+ * object, just like the head of the list built by cons_o().
+ *
+ * Iteration is stable: objects may be added or removed (including the one at
+ * the current position) while iterating. Objects added during iteration are not
+ * visited, and objects removed before being reached are skipped.
+ *
+ * Registries are ephemeral, but changes made within a transaction are undone
+ * if it is rolled back.
+ *
+ * Instances are allocated on the heap with the GC.
+ */
+typedef struct registry {
+  registry_node head;
+  unsigned len;
+} registry;
+
+/**
+ * Creates a new, empty registry.
+ */
+registry* reg_new(void);
+
+/**
+ * Adds the given object to the front of the registry, returning the node to
+ * pass to reg_remove().
+ */
+registry_node* reg_add(registry*, object);
+
+/**
+ * Removes the object held by the given node from its registry. Does nothing if
+ * it has already been removed.
+ */
+void reg_remove(registry_node*);
+
+/**
+ * Returns the node after the given node in iteration order, or NULL if there
+ * is none. Passing the registry's head returns the first node.
+ */
+static inline registry_node* reg_next(registry* this, registry_node* node) {
+  do {
+    node = node->next;
+  } while (node != &this->head && !node->linked);
+
+  return node == &this->head? NULL : node;
+}
+
+/**
+ * Returns the most recently added object in the registry, or NULL if it is
+ * empty.
+ */
+static inline object reg_first(registry* this) {
+  registry_node* node = reg_next(this, &this->head);
+  return node? node->obj : NULL;
+}
+
+/**
+ * Iterates over the objects in the given registry; for example,
+ *   REG_EACH(curr, $p_buffers) { ... curr->obj ... }
+ */
+#define REG_EACH(node, reg)                                     \
+  for (registry_node* node = reg_next((reg), &((registry*)(reg))->head); \
+       node; node = reg_next((reg), node))
+
+#endif /* REGISTRY_H_ */
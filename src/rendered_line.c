@@ -61,7 +61,7 @@ defun($h_RenderedLine) {
     $q_RenderedLine_cvt.
  */
 defun($h_RenderedLine_cvt) {
-  mqstring meta = qcalloc(1 + $i_line_meta_width);
+  mqstring meta = arena_qcalloc(1 + $i_line_meta_width);
   size_t max = $i_line_meta_width;
 
   for (unsigned i = 0; i < $i_line_meta_width; ++i)
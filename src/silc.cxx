@@ -28,6 +28,18 @@
   reading from FILE.c and writing to FILE.slc. If given more than one, it
   operates in global mode, reading all listed files (*with* their extensions)
   and writing to symbols.def.
+
+  Global symbols are only *declared* in local mode; their definitions, along
+  with everything that must run exactly once for them (initialisers, class
+  constructors, domain and method membership), are written to symbols.def,
+  which is compiled exactly once, via silc_registry.c. File-private ($$)
+  symbols are defined in full in local mode and ignored in global mode. This
+  keeps the per-file output small, and independent of what other files do,
+  so that the local runs can proceed in parallel.
+
+  Output files are only rewritten if their content actually changed (as
+  determined by a hash recorded in the header), so that regenerating the
+  output for an unchanged file does not cause make to recompile it.
 */
 
 #include <string>
@@ -42,10 +54,18 @@
 #include <cctype>
 #include <list>
 #include <map>
+#include <sstream>
+#include <cstdio>
 using namespace std;
 
 static set<string> symbols_processed, symbols_known, templates_instantiated;
-static ofstream out;
+static ostringstream out;
+static bool global_mode;
+// Initialisers for the tables of symbols to implant into the root object,
+// symbol domain memberships, and advice to install, respectively. These are
+// emitted as static data at the end of the output, so that each output file
+// needs only one constructor per table instead of one per entry.
+static vector<string> root_implants, domain_members, hook_registrations;
 
 static string current_file;
 static unsigned line_number;
@@ -57,23 +77,36 @@ static void process_symbol(const string&);
 static void read_external_classes(void);
 static void domain_membership(void);
 static void method_membership(void);
+static void emit_tables(void);
+static bool write_if_changed(const string&, const string&);
 int main(int argc, const char*const* argv) {
-  string basename = argv[1];
-  out.open((basename + ".slc").c_str());
-  if (!out) {
-    perror("ofstream");
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0] << " basename" << endl
+         << "       " << argv[0] << " file.c file.c..." << endl;
     return 1;
   }
 
-  out << "/**\n * Autogenerated by silc.\n * Do not edit.\n"
-      << " * Not intended for human consumption.\n */\n"
-      << "#include <common.h>\n";
-  // Quick-and-dirty test-for-existence in C++03
-  if (ifstream((basename + ".h").c_str()))
-    out << "#include \"" << basename << ".h\"\n";
+  global_mode = argc > 2;
+  string outfile;
+  if (global_mode)
+    outfile = "symbols.def";
+  else
+    outfile = string(argv[1]) + ".slc";
+
+  out << "#include <common.h>\n";
+  if (!global_mode) {
+    // Quick-and-dirty test-for-existence in C++03
+    if (ifstream((string(argv[1]) + ".h").c_str()))
+      out << "#include \"" << argv[1] << ".h\"\n";
+  }
 
   process_symbol("$u_fundamental_construction");
-  process_file(basename + ".c");
+  if (global_mode) {
+    for (int i = 1; i < argc; ++i)
+      process_file(argv[i]);
+  } else {
+    process_file(string(argv[1]) + ".c");
+  }
 
   // Some implicit symbols
   current_file="<<IMPLICIT>>";
@@ -86,13 +119,68 @@ int main(int argc, const char*const* argv) {
   read_external_classes();
   method_membership();
   domain_membership();
+  emit_tables();
 
   out << "#undef ANONYMOUS" << endl
       << "#define ANONYMOUS _GLUE(_anon2_,__LINE__)" << endl;
 
+  if (!exit_status && !write_if_changed(outfile, out.str()))
+    return 1;
+
   return exit_status;
 }
 
+/* 64-bit FNV-1a. This only needs to detect changes to our own output, so
+ * there is no need for anything stronger.
+ */
+static unsigned long long content_hash(const string& str) {
+  unsigned long long hash = 0xCBF29CE484222325ULL;
+  for (unsigned i = 0; i < str.size(); ++i) {
+    hash ^= (unsigned char)str[i];
+    hash *= 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+/* Writes the given body, prefixed with a header identifying its hash, to the
+ * given file, unless the file already has a header with the same hash, in
+ * which case the file is left alone (including its mtime).
+ *
+ * Returns whether successful.
+ */
+static bool write_if_changed(const string& filename, const string& body) {
+  char hash[32];
+  sprintf(hash, "%016llx", content_hash(body));
+  string header(string("/**\n * Autogenerated by silc.\n * Do not edit.\n"
+                       " * Not intended for human consumption.\n"
+                       " * Content hash: ") + hash + "\n */\n");
+
+  {
+    ifstream in(filename.c_str());
+    if (in) {
+      string existing(header.size(), 0);
+      in.read(&existing[0], existing.size());
+      if (in && existing == header)
+        return true;
+    }
+  }
+
+  ofstream dst(filename.c_str());
+  if (!dst) {
+    perror(filename.c_str());
+    return false;
+  }
+
+  dst << header << body;
+  dst.close();
+  if (!dst) {
+    perror(filename.c_str());
+    return false;
+  }
+
+  return true;
+}
+
 static void process_line(const string&);
 static void process_file(const string& infile) {
   ifstream in(infile.c_str());
@@ -182,12 +270,25 @@ static string symbol_base_name(const string& sym) {
 // Extern since there's no way to predeclare a static variable
 extern const map<char, void (*)(const string&)> symbol_processors;
 
+/* Returns whether this run is responsible for defining the given symbol, as
+ * opposed to merely declaring it. Global symbols are defined only in global
+ * mode; file-private symbols only in local mode.
+ */
+static bool defines(const string& sym) {
+  return global_mode == symbol_is_global(sym);
+}
+
 static void process_symbol(const string& sym) {
   // Do nothing if we already handled this symbol
   if (symbols_processed.count(sym))
     return;
   symbols_processed.insert(sym);
-  
+
+  // File-private symbols are of no concern to the registry, and may collide
+  // between files anyway.
+  if (global_mode && !symbol_is_global(sym))
+    return;
+
   string type(symbol_get_type(sym));
   map<char, void (*)(const string&)>::const_iterator it =
     symbol_processors.find(type[0]);
@@ -208,6 +309,7 @@ static void process_function_macro(const string&);
 static void process_class(const string&);
 static void process_symbol_domain(const string&);
 static void process_function(const string&);
+static void process_method_or_hashmap(const string&);
 static void process_unique_identity(const string&);
 
 #define p(x,y) pair<char, void (*)(const string&)>(x,y)
@@ -226,7 +328,7 @@ static const pair<char, void (*)(const string&)> symbol_processors_[] = {
   p('h', process_first_class),
   p('i', process_first_class),
   p('l', process_first_class),
-  p('m', process_function),
+  p('m', process_method_or_hashmap),
   p('o', process_first_class),
   p('p', process_first_class),
   p('q', process_first_class),
@@ -247,10 +349,10 @@ static bool get_ctype_of_type(string&,
                               const string& symbol, const string& type);
 static bool instantiate_templates(const string& symbol, const string& type);
 static string change_symbol_type_char(const string& symbol, char newtype);
-static void linkage_of(const char*& extern_, const char*& attr,
-                       const string& symbol);
+static const char* linkage_of(const string& symbol);
 
 static void format(const string& templait, ...);
+static void tabulate(vector<string>&, const string& templait, ...);
 
 static void process_first_class(const string& symbol) {
   string type(symbol_get_type(symbol));
@@ -258,23 +360,34 @@ static void process_first_class(const string& symbol) {
   if (!get_ctype_of_type(ctype, symbol, type)) return;
   if (!instantiate_templates(symbol, type)) return;
 
-  const char* ext, * attr;
-  linkage_of(ext, attr, symbol);
-
-  format("`EXTERN struct symbol_header `ATTR _`SYM$base;                \n"
-         "`EXTERN typeof(`CTYPE) `ATTR _`SYM;                           \n"
-         "ATSTARTA(_init_`SYM, SYMBOL_CONSTRUCTION_PRIORITY,`EXTERN,`ATTR) {\n"
-         "  _`SYM$base.size = sizeof(`CTYPE);                           \n"
-         "  _`SYM$base.payload = &_`SYM;                                \n"
-         "}                                                             \n"
-         "ATSTARTA(_ri_`SYM, SYMBOL_ROOT_IMPLANTATION_PRIORITY,`EXTERN,`ATTR){\n"
-         "  object_implant(&_`SYM$base, ImplantSingle);                 \n"
-         "}                                                             \n"
+  if (!defines(symbol)) {
+    format("extern struct symbol_header _`SYM$base;                     \n"
+           "extern typeof(`CTYPE) _`SYM;                                \n"
+           "static const enum implantation_type                         \n"
+           "    _`SYM$implantation_type = ImplantSingle;                \n"
+           "#define `SYM _`SYM                                          \n",
+           "`SYM", symbol.c_str(), "`CTYPE", ctype.c_str(), NULL);
+    return;
+  }
+
+  // Hook points carry their own name, so that they can be identified by the
+  // hook profiler.
+  const char* init = (type == "h"? " = { .name = \"`SYM\" }" : "");
+
+  // Both the header and the payload are initialised statically, so no code
+  // needs to run to construct the symbol.
+  format("`EXTERN typeof(`CTYPE) _`SYM`INIT;                            \n"
+         "`EXTERN struct symbol_header _`SYM$base = {                   \n"
+         "  .size = sizeof(`CTYPE),                                     \n"
+         "  .payload = &_`SYM,                                          \n"
+         "};                                                            \n"
          "static const enum implantation_type                           \n"
          "    _`SYM$implantation_type = ImplantSingle;                  \n"
          "#define `SYM _`SYM                                            \n",
-         "`EXTERN", ext, "`ATTR", attr, "`SYM", symbol.c_str(),
+         "`INIT", init,
+         "`EXTERN", linkage_of(symbol), "`SYM", symbol.c_str(),
          "`CTYPE", ctype.c_str(), NULL);
+  tabulate(root_implants, "&_`SYM$base", "`SYM", symbol.c_str(), NULL);
 }
 
 static void process_function_macro(const string& symF) {
@@ -317,6 +430,7 @@ static void process_class(const string& csym) {
   process_symbol(misym);
   format("#define `CSYM(...) ({                                          \\\n"
          "  object _`CSYM$local_this = object_new(NULL);                 \\\n"
+         "  object_set_class_name(_`CSYM$local_this, \"`CSYM\");       \\\n"
          "  $$(_`CSYM$local_this) {                                      \\\n"
          //This is redundant with the fundamental constructor, but is necessary
          //to get the expected results when calling via the $c frontend.
@@ -330,8 +444,14 @@ static void process_class(const string& csym) {
          "#define `CSYM$function `FSYM                                     \n"
          "#define `CSYM$identity `USYM                                     \n"
          "#define `CSYM$hook `HSYM                                         \n"
-         "#define `CSYM$this `OSYM                                         \n"
-         "static void _`CSYM$fun_ctor(void) {                              \n"
+         "#define `CSYM$this `OSYM                                         \n",
+         "`CSYM", csym.c_str(), "`OSYM", osym.c_str(),
+         "`USYM", usym.c_str(), "`DSYM", dsym.c_str(),
+         "`HSYM", hsym.c_str(), "`FSYM", fsym.c_str(), NULL);
+
+  if (!defines(csym)) return;
+
+  format("static void _`CSYM$fun_ctor(void) {                              \n"
          "  implant(`OSYM); implant(`DSYM); implant(`HSYM);                \n"
          "  `OSYM = object_current();                                      \n"
          // If the MISYM is already equal to OSYM, this class's constructor
@@ -339,16 +459,18 @@ static void process_class(const string& csym) {
          "  if (`MISYM == `OSYM) hook_abort();                             \n"
          "  implant(`MISYM);                                               \n"
          "  `MISYM = `OSYM;                                                \n"
-         "}                                                                \n"
-         "ATSTART(ANONYMOUS, ADVICE_INSTALLATION_PRIORITY) {               \n"
-         "  add_hook(&`HSYM, HOOK_BEFORE_EVERYTHING,                       \n"
-         "           $u_fundamental_construction, `USYM,                   \n"
-         "           _`CSYM$fun_ctor,constraint_before_superconstructor);  \n"
          "}                                                                \n",
          "`CSYM", csym.c_str(), "`OSYM", osym.c_str(),
-         "`USYM", usym.c_str(), "`DSYM", dsym.c_str(),
-         "`HSYM", hsym.c_str(), "`FSYM", fsym.c_str(),
+         "`DSYM", dsym.c_str(), "`HSYM", hsym.c_str(),
          "`MISYM", misym.c_str(), NULL);
+  // Identities are spelt as their own address, which is their value, since
+  // the variables themselves are not constant expressions.
+  tabulate(hook_registrations,
+           "{ &`HSYM, HOOK_BEFORE_EVERYTHING,\n"
+           "    (identity)&$u_fundamental_construction, (identity)&`USYM,\n"
+           "    _`CSYM$fun_ctor, constraint_before_superconstructor }",
+           "`CSYM", csym.c_str(), "`USYM", usym.c_str(),
+           "`HSYM", hsym.c_str(), NULL);
 }
 
 static void process_function(const string& sym) {
@@ -356,42 +478,65 @@ static void process_function(const string& sym) {
                                       symbol_get_type(sym) == "f"?
                                       'h' : 'H'));
   process_symbol(hsym);
-  const char* ext, * attr;
-  linkage_of(ext, attr, sym);
-  format("`EXTERN void _`SYM(void) `ATTR;            \n"
-         "`EXTERN void _`SYM(void) {                 \n"
+  if (!defines(sym)) {
+    format("void _`SYM(void);\n"
+           "#define `SYM _`SYM\n",
+           "`SYM", sym.c_str(), NULL);
+    return;
+  }
+
+  format("`EXTERN void _`SYM(void) {                 \n"
          "  invoke_hook(`REF`HOOK);                  \n"
          "}                                          \n"
          "#define `SYM _`SYM                         \n",
-         "`EXTERN", ext, "`ATTR", attr, "`SYM", sym.c_str(),
+         "`EXTERN", linkage_of(sym), "`SYM", sym.c_str(),
          "`REF", (symbol_get_type(sym) == "f"? "&" : ""),
          "`HOOK", hsym.c_str(),
          NULL);
 }
 
+// A bare $m_ is an abstract method; $m followed by a type (eg, $mo_) is a hash
+// map of that type.
+static void process_method_or_hashmap(const string& sym) {
+  if (symbol_get_type(sym) == "m")
+    process_function(sym);
+  else
+    process_first_class(sym);
+}
+
 static void process_unique_identity(const string& sym) {
-  const char* ext, * attr;
-  linkage_of(ext, attr, sym);
-  format("`EXTERN const identity `ATTR _`SYM = (identity)&_`SYM;\n",
-         "`EXTERN", ext, "`ATTR", attr, "`SYM", sym.c_str(), NULL);
+  if (defines(sym)) {
+    format("`EXTERN const identity _`SYM = (identity)&_`SYM;\n",
+           "`EXTERN", linkage_of(sym), "`SYM", sym.c_str(), NULL);
+  } else {
+    format("extern const identity _`SYM;\n",
+           "`SYM", sym.c_str(), NULL);
+  }
 
   format("#define `SYM _`SYM\n",
          "`SYM", sym.c_str(), NULL);
 }
 
 static void process_symbol_domain(const string& sym) {
-  const char* ext, * attr;
-  linkage_of(ext, attr, sym);
-  format("`EXTERN struct symbol_header `ATTR _`SYM$base;                \n"
-         "`EXTERN struct symbol_domain* `ATTR _`SYM = NULL;             \n"
-         "ATSTARTA(_init_`SYM, SYMBOL_CONSTRUCTION_PRIORITY,`EXTERN,`ATTR) {    \n"
-         "  _`SYM$base.size = sizeof(struct symbol_domain*);            \n"
-         "  _`SYM$base.payload = &_`SYM;                                \n"
-         "}                                                             \n"
+  if (!defines(sym)) {
+    format("extern struct symbol_header _`SYM$base;                     \n"
+           "extern struct symbol_domain* _`SYM;                         \n"
+           "static const enum implantation_type _`SYM$implantation_type = \n"
+           "    ImplantDomain;                                          \n"
+           "#define `SYM _`SYM                                          \n",
+           "`SYM", sym.c_str(), NULL);
+    return;
+  }
+
+  format("`EXTERN struct symbol_domain* _`SYM = NULL;                 \n"
+         "`EXTERN struct symbol_header _`SYM$base = {                   \n"
+         "  .size = sizeof(struct symbol_domain*),                      \n"
+         "  .payload = &_`SYM,                                          \n"
+         "};                                                            \n"
          "static const enum implantation_type _`SYM$implantation_type = \n"
          "    ImplantDomain;                                            \n"
          "#define `SYM _`SYM                                            \n",
-         "`EXTERN", ext, "`ATTR", attr, "`SYM", sym.c_str(), NULL);
+         "`EXTERN", linkage_of(sym), "`SYM", sym.c_str(), NULL);
 }
 
 static bool get_ctype_of_type(string& ctype,
@@ -445,6 +590,10 @@ static bool get_ctype_of_type(string& ctype,
     ctype = string("list_") + type.substr(1);
     break;
 
+  case 'm':
+    ctype = string("hashmap_") + type.substr(1);
+    break;
+
   case 'o':
     ctype = "object";
     break;
@@ -498,7 +647,7 @@ static bool instantiate_templates(const string& symbol, const string& type) {
   templates_instantiated.insert(type);
 
   static bool has_loaded = false;
-  static string list_template, dynar_template;
+  static string list_template, dynar_template, hashmap_template;
   if (!has_loaded) {
     has_loaded = true;
     {
@@ -520,16 +669,27 @@ static bool instantiate_templates(const string& symbol, const string& type) {
 
       getline(in, dynar_template, '\0');
     }
+
+    {
+      ifstream in("hashmap.plt");
+      if (!in) {
+        perror("ifstream(hashmap.plt)");
+        exit(255);
+      }
+
+      getline(in, hashmap_template, '\0');
+    }
   }
 
   string sub = type.substr(1);
 
-  if (type[0] == 'l' || type[0] == 'a') {
+  if (type[0] == 'l' || type[0] == 'a' || type[0] == 'm') {
     string ctype;
     if (!get_ctype_of_type(ctype, symbol, sub)) return false;
     if (!instantiate_templates(symbol, sub)) return false;
 
-    format(type[0] == 'l'? list_template : dynar_template,
+    format(type[0] == 'l'? list_template :
+           type[0] == 'a'? dynar_template : hashmap_template,
            "CTYPE", ctype.c_str(), "HUNG", sub.c_str(), NULL);
   }
 
@@ -542,22 +702,13 @@ static string change_symbol_type_char(const string& symbol, char type) {
   return ret;
 }
 
-static void linkage_of(const char*& ext, const char*& attr,
-                       const string& symbol) {
-  if (symbol_is_global(symbol)) {
-    ext = "";
-    attr = "__attribute__((weak))";
-  } else {
-    ext = "static";
-    attr = "";
-  }
+static const char* linkage_of(const string& symbol) {
+  // Global symbols are only ever defined once, in symbols.def
+  return symbol_is_global(symbol)? "" : "static";
 }
 
-static void format(const string& templait, ...) {
+static string vformat(const string& templait, va_list args) {
   string output(templait);
-  
-  va_list args;
-  va_start(args, templait);
 
   const char* from, * to;
   while ((from = va_arg(args, const char*))) {
@@ -567,10 +718,25 @@ static void format(const string& templait, ...) {
     while (string::npos != (where = output.find(from)))
       output.replace(where, strlen(from), to);
   }
-  
+
+  return output;
+}
+
+static void format(const string& templait, ...) {
+  va_list args;
+  va_start(args, templait);
+  out << vformat(templait, args);
   va_end(args);
+}
 
-  out << output;
+/* Like format(), but appends the result to the given table instead of writing
+ * it to the output.
+ */
+static void tabulate(vector<string>& table, const string& templait, ...) {
+  va_list args;
+  va_start(args, templait);
+  table.push_back(vformat(templait, args));
+  va_end(args);
 }
 
 static void domain_membership(void) {
@@ -591,9 +757,13 @@ static void domain_membership(void) {
             symbol_is_global(*it) == symbol_is_global(*sit) &&
             is_first_class(*sit)) {
           process_symbol(*it);
-          format("member_of_domain(`SYM, `DOM);\n",
-                 "`SYM", sit->c_str(), "`DOM", it->c_str(), NULL);
           to_erase.push_back(*sit);
+          if (!defines(*sit)) continue;
+
+          // is_first_class() excludes domains, so the member is always
+          // implanted singly.
+          tabulate(domain_members, "{ &_`SYM$base, &`DOM, ImplantSingle }",
+                   "`SYM", sit->c_str(), "`DOM", it->c_str(), NULL);
         }
       }
 
@@ -618,7 +788,7 @@ static void method_membership(void) {
       list<string> to_erase;
       for (set<string>::const_iterator sit = orphans.begin();
            sit != orphans.end(); ++sit) {
-        if (0 == sit->find(prefix)) {
+        if (0 == sit->find(prefix) && defines(*sit)) {
           string method(sit->substr(prefix.size()));
           string hook(string("$H_") + method);
           string identity(change_symbol_type_char(*sit, 'u'));
@@ -626,20 +796,17 @@ static void method_membership(void) {
           process_symbol(hook);
           process_symbol(identity);
           process_symbol(constr);
-          const char* ext, * attr;
-          linkage_of(ext, attr, *sit);
           format("static void _setup_`SYM(void) {                           \n"
                  "  implant(`HOOK);                                         \n"
                  "  `HOOK = &`SYM;                                          \n"
-                 "}                                                         \n"
-                 "ATSTARTA(_ia_`SYM,ADVICE_INSTALLATION_PRIORITY,`EXTERN,`ATTR) {\n"
-                 "  add_hook(&`CONSTR, HOOK_BEFORE, `ID, $u_method_setup,   \n"
-                 "           _setup_`SYM,                                   \n"
-                 "           constraint_after_superconstructor);            \n"
-                 "} \n",
-                 "`HOOK", hook.c_str(), "`ID", identity.c_str(),
-                 "`SYM", (*sit).c_str(), "`CONSTR", constr.c_str(),
-                 "`EXTERN", ext, "`ATTR", attr, NULL);
+                 "}                                                         \n",
+                 "`HOOK", hook.c_str(), "`SYM", (*sit).c_str(), NULL);
+          tabulate(hook_registrations,
+                   "{ &`CONSTR, HOOK_BEFORE,\n"
+                   "    (identity)&`ID, (identity)&$u_method_setup,\n"
+                   "    _setup_`SYM, constraint_after_superconstructor }",
+                   "`ID", identity.c_str(), "`SYM", (*sit).c_str(),
+                   "`CONSTR", constr.c_str(), NULL);
         }
       }
 
@@ -650,6 +817,39 @@ static void method_membership(void) {
   }
 }
 
+/* Writes the given table as a static array of the given element type, along
+ * with a constructor of the given priority which passes it to the given
+ * installation function. Nothing is written for an empty table.
+ */
+static void emit_table(const char* name, const char* type,
+                       const vector<string>& table,
+                       const char* priority, const char* installer) {
+  if (table.empty()) return;
+
+  out << "static " << type << " " << name << "[] = {\n";
+  for (vector<string>::const_iterator it = table.begin();
+       it != table.end(); ++it)
+    out << "  " << *it << ",\n";
+  out << "};\n";
+
+  format("ATSTART(`NAME$install, `PRIORITY) {\n"
+         "  `INSTALLER(`NAME, lenof(`NAME));\n"
+         "}\n",
+         "`NAME", name, "`PRIORITY", priority, "`INSTALLER", installer, NULL);
+}
+
+static void emit_tables(void) {
+  emit_table("_silc_root_implants", "struct symbol_header*const",
+             root_implants, "SYMBOL_ROOT_IMPLANTATION_PRIORITY",
+             "implant_symbols");
+  emit_table("_silc_domain_members", "const struct domain_registration",
+             domain_members, "DOMAIN_CONSTRUCTION_PRIORITY",
+             "add_symbols_to_domains");
+  emit_table("_silc_hook_registrations", "const struct hook_registration",
+             hook_registrations, "ADVICE_INSTALLATION_PRIORITY",
+             "add_hooks");
+}
+
 void read_external_classes(void) {
   symbols_known = symbols_processed;
   /* Read all classes from the "classes" file, and add them to processesd
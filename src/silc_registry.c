@@ -0,0 +1,29 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  TITLE: Shared Symbol Registry
+  OVERVIEW: Holds the one and only definition of every global symbol, as well
+    as the initialisers, class constructors, and domain and method membership
+    that go with them. The content itself is generated by running silc in
+    global mode over every source file, which writes symbols.def; each other
+    file's .slc only declares the global symbols it uses.
+*/
+
+#include "symbols.def"
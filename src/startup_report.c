@@ -0,0 +1,102 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  TITLE: Startup Timing Report
+  OVERVIEW: Records when each phase of program startup (as delimited by the
+    static constructor priorities in common.h) completed, and prints the
+    result when run with `sol --startup-report`, so that cold-start time can
+    be tracked.
+*/
+
+#include "startup_report.slc"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cmdline.h"
+
+enum startup_phase {
+  PhaseRuntime = 0, PhaseSymbols, PhaseDomains, PhaseRootObject, PhaseAdvice,
+  PhaseHookSorting, PhaseStaticInit, PhaseTests, PhaseMain, PhaseCount
+};
+
+static const char*const phase_names[PhaseCount] = {
+  "runtime initialisation",
+  "symbol construction",
+  "domain construction",
+  "root object construction",
+  "advice installation",
+  "hook sorting",
+  "static initialisation",
+  "tests",
+  "main() to argument processing",
+};
+
+static struct timespec startup_begin, phase_end[PhaseCount];
+
+static void mark(enum startup_phase phase) {
+  clock_gettime(CLOCK_MONOTONIC, &phase_end[phase]);
+}
+
+static double ms_between(const struct timespec* from,
+                         const struct timespec* to) {
+  return (to->tv_sec - from->tv_sec) * 1.0e3 +
+         (to->tv_nsec - from->tv_nsec) / 1.0e6;
+}
+
+/* Each phase is considered to end once everything of the priority which
+ * defines it has run, ie, with a constructor one priority later.
+ * (The "tests" phase is only non-empty in DEBUG builds.)
+ */
+ATSTART(mark_startup_begin, 101) {
+  clock_gettime(CLOCK_MONOTONIC, &startup_begin);
+}
+ATSTART(mark_runtime, 103) { mark(PhaseRuntime); }
+ATSTART(mark_symbols, SYMBOL_CONSTRUCTION_PRIORITY+1) { mark(PhaseSymbols); }
+ATSTART(mark_domains, DOMAIN_CONSTRUCTION_PRIORITY+1) { mark(PhaseDomains); }
+ATSTART(mark_root_object, SYMBOL_ROOT_IMPLANTATION_PRIORITY+1) {
+  mark(PhaseRootObject);
+}
+ATSTART(mark_advice, ADVICE_INSTALLATION_PRIORITY+1) { mark(PhaseAdvice); }
+ATSTART(mark_hook_sorting, HOOK_SORTING_PRIORITY+1) {
+  mark(PhaseHookSorting);
+}
+ATSTART(mark_static_init, STATIC_INITIALISATION_PRIORITY+1) {
+  mark(PhaseStaticInit);
+}
+ATSTART(mark_tests, TEST_EXECUTION_PRIORITY+1) { mark(PhaseTests); }
+
+def_cmdline_arg(-, startup_report, none,
+                "Print how long each phase of startup took, and exit.") {
+  mark(PhaseMain);
+
+  printf("%-32s %10s %10s\n", "Phase", "ms", "total ms");
+  const struct timespec* prev = &startup_begin;
+  for (unsigned i = 0; i < PhaseCount; ++i) {
+    printf("%-32s %10.3f %10.3f\n", phase_names[i],
+           ms_between(prev, &phase_end[i]),
+           ms_between(&startup_begin, &phase_end[i]));
+    prev = &phase_end[i];
+  }
+  printf("\n%u hooks added before main(), into %u chains\n",
+         startup_hooks_added, startup_chains_sorted);
+  exit(0);
+}
@@ -0,0 +1,220 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "steno_index.slc"
+
+#include "steno_index.h"
+
+/*
+  TITLE: Pseudo-Stenographic Expansion Index
+  OVERVIEW: Maintains a vocabulary of words for pseudo-stenographic expansion
+    so that expansion does not need to consider every word in the vocabulary.
+
+    Words are bucketed by their first character, since an expansion must
+    always begin with the same character as its input. Each word also carries
+    a 64-bit signature of the characters it contains and its length, so that
+    words which are too short or lack some character of the input can be
+    skipped without examining their text.
+
+    A separate hash table from word to entry allows words to be added and
+    removed in constant time.
+*/
+
+#define NBUCKETS 256
+
+typedef struct sti_entry {
+  wstring word;
+  unsigned long long chars;
+  unsigned len;
+  unsigned refs;
+  // Index of this entry within its bucket
+  unsigned ix;
+} sti_entry;
+
+typedef struct {
+  sti_entry** v;
+  unsigned len, size;
+} sti_bucket;
+
+struct steno_index {
+  sti_bucket buckets[NBUCKETS];
+  // Open-addressed hash table of all entries; removed entries are replaced
+  // by the tombstone so that probe chains stay intact.
+  sti_entry** table;
+  unsigned table_size, table_used, nwords;
+};
+
+static sti_entry tombstone;
+
+static unsigned long long char_signature(wstring str) {
+  unsigned long long sig = 0;
+  for (; *str; ++str)
+    sig |= 1ULL << (((unsigned)*str * 0x9E3779B1u) >> 26);
+
+  return sig;
+}
+
+static unsigned word_hash(wstring str) {
+  unsigned hash = 2166136261u;
+  for (; *str; ++str)
+    hash = (hash ^ (unsigned)*str) * 16777619u;
+
+  return hash;
+}
+
+steno_index* sti_new(void) {
+  steno_index* this = new(steno_index);
+  this->table_size = 64;
+  this->table = gcalloc(this->table_size * sizeof(sti_entry*));
+  return this;
+}
+
+unsigned sti_size(const steno_index* this) {
+  return this->nwords;
+}
+
+/* Returns the slot in the hash table for the given word; if the word is not
+ * present, the slot where it should be inserted.
+ */
+static sti_entry** find_slot(const steno_index* this, wstring word) {
+  unsigned mask = this->table_size - 1;
+  sti_entry** insert_at = NULL;
+  for (unsigned i = word_hash(word) & mask; ; i = (i+1) & mask) {
+    sti_entry** slot = this->table + i;
+    if (!*slot)
+      return insert_at ?: slot;
+    if (*slot == &tombstone) {
+      if (!insert_at) insert_at = slot;
+    } else if (!wcscmp((*slot)->word, word)) {
+      return slot;
+    }
+  }
+}
+
+static void rehash(steno_index* this) {
+  sti_entry** old = this->table;
+  unsigned old_size = this->table_size;
+
+  // Only grow if live entries (as opposed to tombstones) fill the table
+  if (this->nwords*2 >= old_size)
+    this->table_size *= 2;
+  this->table = gcalloc(this->table_size * sizeof(sti_entry*));
+  this->table_used = this->nwords;
+
+  for (unsigned i = 0; i < old_size; ++i)
+    if (old[i] && old[i] != &tombstone)
+      *find_slot(this, old[i]->word) = old[i];
+}
+
+void sti_add(steno_index* this, wstring word) {
+  if (!*word) return;
+
+  sti_entry** slot = find_slot(this, word);
+  if (*slot && *slot != &tombstone) {
+    ++(*slot)->refs;
+    return;
+  }
+
+  sti_entry* entry = new(sti_entry);
+  entry->word = wstrdup(word);
+  entry->chars = char_signature(word);
+  entry->len = wcslen(word);
+  entry->refs = 1;
+
+  sti_bucket* bucket = this->buckets + (word[0] % NBUCKETS);
+  if (bucket->len == bucket->size) {
+    bucket->size = bucket->size? bucket->size*2 : 4;
+    bucket->v = gcrealloc(bucket->v, bucket->size * sizeof(sti_entry*));
+  }
+  entry->ix = bucket->len;
+  bucket->v[bucket->len++] = entry;
+
+  if (!*slot) ++this->table_used;
+  *slot = entry;
+  ++this->nwords;
+
+  // Keep the table at most three quarters full, counting tombstones
+  if (this->table_used*4 >= this->table_size*3)
+    rehash(this);
+}
+
+void sti_remove(steno_index* this, wstring word) {
+  if (!*word) return;
+
+  sti_entry** slot = find_slot(this, word);
+  sti_entry* entry = *slot;
+  if (!entry || entry == &tombstone) return;
+  if (--entry->refs) return;
+
+  // Swap the last entry of the bucket into this one's place
+  sti_bucket* bucket = this->buckets + (word[0] % NBUCKETS);
+  sti_entry* last = bucket->v[--bucket->len];
+  bucket->v[entry->ix] = last;
+  last->ix = entry->ix;
+
+  *slot = &tombstone;
+  --this->nwords;
+}
+
+void sti_each_candidate(const steno_index* this, wstring input,
+                        void (*f)(wstring)) {
+  unsigned long long chars = char_signature(input);
+  unsigned len = wcslen(input);
+  const sti_bucket* bucket = this->buckets + (input[0] % NBUCKETS);
+
+  for (unsigned i = 0; i < bucket->len; ++i) {
+    const sti_entry* entry = bucket->v[i];
+    if (entry->word[0] == input[0] &&
+        entry->len >= len &&
+        (entry->chars & chars) == chars)
+      f(entry->word);
+  }
+}
+
+deftest(steno_index_maintains_vocabulary) {
+  steno_index* ix = sti_new();
+  sti_add(ix, L"soliloquy");
+  sti_add(ix, L"silly");
+  sti_add(ix, L"silly");
+  sti_add(ix, L"foo");
+  assert(3 == sti_size(ix));
+
+  unsigned cnt = 0;
+  sti_each_candidate(ix, L"slq", lambdav((wstring w), ++cnt));
+  assert(1 == cnt);
+
+  sti_remove(ix, L"silly");
+  assert(3 == sti_size(ix));
+  sti_remove(ix, L"silly");
+  assert(2 == sti_size(ix));
+
+  cnt = 0;
+  sti_each_candidate(ix, L"sl", lambdav((wstring w), ++cnt));
+  assert(1 == cnt);
+
+  // Force a few rehashes, including ones dominated by tombstones
+  wchar_t word[4] = L"aaa";
+  for (unsigned i = 0; i < 1000; ++i) {
+    word[1] = L'a' + i % 26;
+    word[2] = L'a' + i / 26;
+    sti_add(ix, word);
+    if (i % 2)
+      sti_remove(ix, word);
+  }
+  assert(502 == sti_size(ix));
+}
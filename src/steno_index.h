@@ -0,0 +1,66 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef STENO_INDEX_H_
+#define STENO_INDEX_H_
+
+/**
+ * Opaque type representing an indexed vocabulary of words for
+ * pseudo-stenographic expansion (see $f_pseudo_steno_expand). Instances are
+ * allocated on the heap with the GC.
+ *
+ * Each word is reference-counted, so that a client tracking, eg, the words of
+ * a buffer can add a word once per occurrence and remove it once per
+ * occurrence removed; the word is only dropped from the vocabulary when its
+ * last occurrence is.
+ */
+typedef struct steno_index steno_index;
+
+/**
+ * Creates a new, empty steno_index.
+ */
+steno_index* sti_new(void);
+
+/**
+ * Adds one reference to the given word, inserting it into the vocabulary if
+ * it is not already present. Empty words are ignored. The string is copied.
+ */
+void sti_add(steno_index*, wstring);
+
+/**
+ * Removes one reference to the given word, deleting it from the vocabulary if
+ * that was its last reference. Words not in the vocabulary are ignored.
+ */
+void sti_remove(steno_index*, wstring);
+
+/**
+ * Returns the number of distinct words in the vocabulary.
+ */
+unsigned sti_size(const steno_index*);
+
+/**
+ * Calls the given function on every word in the vocabulary which could
+ * possibly be an expansion of the given input; that is, those that begin with
+ * the same character, are at least as long, and contain every character the
+ * input does. Words not passed to the function are guaranteed not to be
+ * expansions, but those passed must still be checked fully.
+ */
+void sti_each_candidate(const steno_index*, wstring input,
+                        void (*)(wstring));
+
+#endif /* STENO_INDEX_H_ */
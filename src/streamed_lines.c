@@ -0,0 +1,327 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "streamed_lines.slc"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "streamed_lines.h"
+#include "bench.h"
+
+/*
+  TITLE: Streamed Line Access
+  OVERVIEW: Provides the streamed_lines, which presents the lines of an
+    arbitrarily large file without reading it into memory. The file is scanned
+    once, with large reads and memchr(), to count its lines and note where
+    every SL_STRIDE'th one begins; no line is decoded or allocated during the
+    scan, so indexing runs at about the speed of the disk. Lines are decoded
+    only when asked for, through a small LRU window of blocks, so that
+    displaying or stepping through a region of the file costs one read per
+    SL_STRIDE lines.
+*/
+
+// The size of the reads used to scan the file.
+#define SL_READ_SIZE (1024*1024)
+
+struct sl_block {
+  /* The index of the block (ie, of its first line divided by SL_STRIDE), and
+   * the number of lines it holds.
+   */
+  unsigned block, nlines;
+  // The value of the clock when the block was last used
+  unsigned long long last_use;
+  // The decoded lines, or NULL if this slot of the window is empty
+  wstring* lines;
+};
+
+struct streamed_lines {
+  int fd;
+  /* The number of lines terminated by a newline, and the offset at which the
+   * line following them begins.
+   */
+  unsigned complete;
+  unsigned long long tail;
+  /* The number of bytes indexed. If greater than tail, the file ends with a
+   * line lacking a trailing newline.
+   */
+  unsigned long long size;
+  // marks[i] is the offset at which line i*SL_STRIDE begins
+  unsigned long long* marks;
+  unsigned nmarks, marks_cap;
+
+  struct sl_block window[SL_WINDOW];
+  unsigned long long clock;
+};
+
+static void push_mark(streamed_lines* this, unsigned long long offset) {
+  if (this->nmarks == this->marks_cap) {
+    this->marks_cap *= 2;
+    this->marks = gcrealloc(this->marks,
+                            this->marks_cap * sizeof(unsigned long long));
+  }
+
+  this->marks[this->nmarks++] = offset;
+}
+
+/* Indexes the file from this->size to its end. On failure, returns false
+ * with errno set, and leaves this unchanged.
+ */
+static bool scan(streamed_lines* this) {
+  unsigned complete = this->complete, nmarks = this->nmarks;
+  unsigned long long tail = this->tail, size = this->size;
+  char* buf = xmalloc(SL_READ_SIZE);
+  ssize_t nread;
+
+  while (0 < (nread = pread(this->fd, buf, SL_READ_SIZE, size))) {
+    for (char* nl = buf; (nl = memchr(nl, '\n', buf + nread - nl)); ++nl) {
+      tail = size + (nl - buf) + 1;
+      if (!(++complete % SL_STRIDE))
+        push_mark(this, tail);
+    }
+
+    size += nread;
+  }
+
+  free(buf);
+  if (-1 == nread) {
+    this->nmarks = nmarks;
+    return false;
+  }
+
+  this->complete = complete;
+  this->tail = tail;
+  this->size = size;
+  return true;
+}
+
+streamed_lines* sl_open(string filename) {
+  int fd = open(filename, O_RDONLY);
+  if (-1 == fd) return NULL;
+
+  streamed_lines* this = new(streamed_lines);
+  this->fd = fd;
+  this->marks_cap = 64;
+  this->marks = gcalloc_atomic(this->marks_cap * sizeof(unsigned long long));
+  push_mark(this, 0);
+
+  if (!scan(this)) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return NULL;
+  }
+
+  return this;
+}
+
+unsigned sl_len(const streamed_lines* this) {
+  return this->complete + (this->size > this->tail);
+}
+
+unsigned long long sl_size(const streamed_lines* this) {
+  return this->size;
+}
+
+bool sl_extend(streamed_lines* this) {
+  unsigned old_len = sl_len(this);
+  if (!scan(this)) return false;
+
+  // The last block read may have gained lines, and its last line may have
+  // grown.
+  unsigned stale = old_len? (old_len-1) / SL_STRIDE : 0;
+  for (unsigned i = 0; i < SL_WINDOW; ++i)
+    if (this->window[i].block >= stale)
+      this->window[i].lines = NULL;
+
+  return true;
+}
+
+/* Decodes the first len bytes of line, which has room for a terminator. If
+ * the line was cut short, a multibyte character split by the cut is dropped,
+ * rather than making the whole line undecodable.
+ */
+static wstring decode(char* line, size_t len, bool truncated) {
+  line[len] = 0;
+  if (truncated) {
+    for (size_t cut = len; cut + MB_CUR_MAX > len && cut; --cut) {
+      char at = line[cut];
+      line[cut] = 0;
+      if (~mbstowcs(NULL, line, 0))
+        return cstrtowstr(line);
+      line[cut] = at;
+    }
+  }
+
+  return cstrtowstr(line);
+}
+
+/* Reads and decodes the given block into the given slot of the window. The
+ * block is read SL_READ_SIZE bytes at a time, and each line is cut off after
+ * SL_MAX_LINE bytes, so the memory needed does not depend on the length of
+ * the lines.
+ */
+static void load(streamed_lines* this, struct sl_block* slot, unsigned block) {
+  unsigned first = block * SL_STRIDE;
+  unsigned nlines = sl_len(this) - first;
+  if (nlines > SL_STRIDE) nlines = SL_STRIDE;
+
+  unsigned long long offset = this->marks[block];
+  unsigned long long end =
+    block+1 < this->nmarks? this->marks[block+1] : this->size;
+  char* buf = xmalloc(SL_READ_SIZE);
+  char* line = xmalloc(SL_MAX_LINE + 1);
+  size_t len = 0;
+  bool truncated = false;
+  ssize_t nread;
+  unsigned i = 0;
+
+  slot->block = block;
+  slot->nlines = nlines;
+  slot->lines = gcalloc(nlines * sizeof(wstring));
+  while (i < nlines && offset < end &&
+         0 < (nread = pread(this->fd, buf,
+                            end - offset < SL_READ_SIZE?
+                              end - offset : SL_READ_SIZE,
+                            offset))) {
+    offset += nread;
+    for (char* curr = buf; curr < buf + nread && i < nlines; ) {
+      char* nl = memchr(curr, '\n', buf + nread - curr);
+      size_t n = (nl? nl : buf + nread) - curr;
+      if (n > SL_MAX_LINE - len) {
+        n = SL_MAX_LINE - len;
+        truncated = true;
+      }
+      memcpy(line + len, curr, n);
+      len += n;
+
+      // Otherwise, the line continues into the next read
+      if (!nl) break;
+
+      slot->lines[i++] = decode(line, len, truncated);
+      len = 0;
+      truncated = false;
+      curr = nl+1;
+    }
+  }
+
+  // The last line of the file may lack a trailing newline
+  if (i < nlines && len)
+    slot->lines[i++] = decode(line, len, truncated);
+  while (i < nlines)
+    slot->lines[i++] = L"";
+
+  free(line);
+  free(buf);
+}
+
+wstring sl_line(streamed_lines* this, unsigned ix) {
+  unsigned block = ix / SL_STRIDE;
+  struct sl_block* slot = this->window;
+  for (unsigned i = 0; i < SL_WINDOW; ++i) {
+    if (this->window[i].lines && this->window[i].block == block) {
+      slot = this->window + i;
+      goto found;
+    }
+
+    // Otherwise, evict an empty or the least recently used slot
+    if (!this->window[i].lines ||
+        (slot->lines && this->window[i].last_use < slot->last_use))
+      slot = this->window + i;
+  }
+
+  load(this, slot, block);
+
+  found:
+  slot->last_use = ++this->clock;
+  return ix % SL_STRIDE < slot->nlines? slot->lines[ix % SL_STRIDE] : L"";
+}
+
+void sl_close(streamed_lines* this) {
+  close(this->fd);
+  this->fd = -1;
+  for (unsigned i = 0; i < SL_WINDOW; ++i)
+    this->window[i].lines = NULL;
+}
+
+deftest(streamed_lines_index_and_window) {
+  unsigned n = SL_STRIDE * (SL_WINDOW + 2) + 7;
+  string filename = bench_write_file(n);
+  streamed_lines* lines = sl_open(filename);
+  assert(lines);
+  assert(n == sl_len(lines));
+
+  void check(unsigned i) {
+    wchar_t expected[64];
+    swprintf(expected, lenof(expected),
+             L"Line %u of the benchmark file, followed by some text.", i);
+    assert(!wcscmp(expected, sl_line(lines, i)));
+  }
+
+  // Walking backwards then forwards cycles the whole window
+  for (unsigned i = n; i > 0; --i)
+    check(i-1);
+  for (unsigned i = 0; i < n; i += 97)
+    check(i);
+
+  // Appending to the file, first without a trailing newline
+  FILE* out = fopen(filename, "a");
+  assert(out);
+  fputs("partial", out);
+  fflush(out);
+  assert(sl_extend(lines));
+  assert(n+1 == sl_len(lines));
+  assert(!wcscmp(L"partial", sl_line(lines, n)));
+  check(n-1);
+
+  fputs(" line\nlast\n", out);
+  fclose(out);
+  assert(sl_extend(lines));
+  assert(n+2 == sl_len(lines));
+  assert(!wcscmp(L"partial line", sl_line(lines, n)));
+  assert(!wcscmp(L"last", sl_line(lines, n+1)));
+  check(0);
+
+  sl_close(lines);
+  unlink(filename);
+
+  // An empty file has no lines
+  filename = bench_write_file(0);
+  lines = sl_open(filename);
+  assert(lines);
+  assert(!sl_len(lines));
+  sl_close(lines);
+  unlink(filename);
+
+  // Over-long lines are cut short, without disturbing those after them
+  filename = bench_write_file(0);
+  out = fopen(filename, "w");
+  assert(out);
+  for (unsigned i = 0; i < 3 * SL_MAX_LINE; ++i)
+    putc('x', out);
+  fputs("\nafter\n", out);
+  fclose(out);
+  lines = sl_open(filename);
+  assert(lines);
+  assert(2 == sl_len(lines));
+  assert(SL_MAX_LINE == wcslen(sl_line(lines, 0)));
+  assert(!wcscmp(L"after", sl_line(lines, 1)));
+  sl_close(lines);
+  unlink(filename);
+}
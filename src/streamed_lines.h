@@ -0,0 +1,89 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef STREAMED_LINES_H_
+#define STREAMED_LINES_H_
+
+/**
+ * Read-only access to the lines of a file too large to hold in memory, as
+ * used by streamed FileBuffers. Opening the file scans it once to build a
+ * sparse index holding the byte offset of every SL_STRIDE'th line; lines are
+ * then read and decoded on demand, a block of SL_STRIDE lines at a time, and
+ * the SL_WINDOW most recently used blocks are kept. The memory used is thus
+ * that of the window plus one offset per SL_STRIDE lines, regardless of how
+ * large the file is.
+ *
+ * Lines are decoded the same way as by $f_FileBuffer_reload, except that only
+ * the first SL_MAX_LINE bytes of any line are kept, so that a file with
+ * enormous lines cannot make the window large either. A line which
+ * cannot be read (for example, because the file was truncated behind the
+ * streamed_lines' back) reads as the empty string.
+ *
+ * Instances are allocated on the heap with the GC, but hold an open file
+ * descriptor, so they must be closed with sl_close().
+ */
+typedef struct streamed_lines streamed_lines;
+
+/**
+ * The number of lines per index entry, and per block of the window.
+ */
+#define SL_STRIDE 256
+/**
+ * The number of blocks of lines kept decoded.
+ */
+#define SL_WINDOW 16
+/**
+ * The number of bytes of a line after which the rest of it is dropped.
+ */
+#define SL_MAX_LINE (64*1024)
+
+/**
+ * Opens and indexes the given file. Returns NULL and sets errno on failure.
+ */
+streamed_lines* sl_open(string filename);
+
+/**
+ * Indexes whatever has been appended to the file since it was opened or
+ * last extended. If the last line had no trailing newline, it is re-read, so
+ * any text appended to it becomes part of it. Returns false and sets errno
+ * on failure, in which case the streamed_lines is unchanged.
+ */
+bool sl_extend(streamed_lines*);
+
+/**
+ * Returns the number of lines in the file as of when it was last indexed.
+ */
+unsigned sl_len(const streamed_lines*);
+
+/**
+ * Returns the number of bytes of the file which have been indexed.
+ */
+unsigned long long sl_size(const streamed_lines*);
+
+/**
+ * Returns the line at the given index, which must be less than sl_len().
+ */
+wstring sl_line(streamed_lines*, unsigned);
+
+/**
+ * Closes the file and drops the window. The streamed_lines may not be used
+ * afterwards.
+ */
+void sl_close(streamed_lines*);
+
+#endif /* STREAMED_LINES_H_ */
@@ -21,6 +21,7 @@
 #include <time.h>
 
 #include "../kb_layout_xlate.h"
+#include "../gap_buffer.h"
 
 /*
   TITLE: Symbol Chord Mode
@@ -115,12 +116,15 @@ mode_adv_before($u_input_preprocessing, $h_LineEditor_self_insert) {
           (map[0] == b && map[1] == a)) {
         // Remove the character before point
         if ($i_LineEditor_point > 0 &&
-            $az_LineEditor_buffer->v[$i_LineEditor_point-1] ==
+            gb_at($p_LineEditor_buffer, $i_LineEditor_point-1) ==
               $z_LineEditor_symbol_chord_first) {
           --$i_LineEditor_point;
           $y_LineEditor_edit_is_minor = true;
           $m_push_undo();
-          dynar_erase_z($az_LineEditor_buffer, $i_LineEditor_point, 1);
+          $M_edit(0,0,
+                  $I_LineEditor_edit_offset = $i_LineEditor_point,
+                  $I_LineEditor_edit_length = 1,
+                  $I_LineEditor_edit_insertion_length = 0);
 
           // Replace with mapping
           $x_Terminal_input_value = map[2];
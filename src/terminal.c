@@ -24,7 +24,12 @@
 
 #include "terminal.slc"
 
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
 #include "inc_ncurses.h"
+#include "registry.h"
 
 /*
   SYMBOL: $c_Terminal
@@ -33,9 +38,12 @@
     constructor is called. Call $f_Terminal_destroy when a terminal is to be
     disconnected. Subclass of $c_Consumer.
 
-  SYMBOL: $lo_terminals
-    A list of all currently-initialised Terminal objects, in no particular
-    order.
+  SYMBOL: $p_terminals
+    A registry of all currently-initialised Terminal objects, most recently
+    created first.
+
+  SYMBOL: $p_Terminal_registration
+    The registry_node of this Terminal within $p_terminals.
 
   SYMBOL: $s_Terminal_type
     The type of the connected terminal; that is, the contents of its TERM
@@ -58,6 +66,24 @@
   SYMBOL: $i_Terminal_rows $i_Terminal_cols
     The current number of rows (lines) or columns present on the Terminal.
 
+  SYMBOL: $y_Terminal_headless
+    If true when the Terminal is constructed, the Terminal does not use
+    ncurses or any real terminal at all, and $p_Terminal_input,
+    $p_Terminal_output, and $s_Terminal_type are ignored. Output is rendered
+    into $Q_Terminal_screen, and input is taken from the queue filled by
+    $f_Terminal_feed(). $i_Terminal_rows and $i_Terminal_cols may be given to
+    the constructor; they default to 24 and 80. This is used by the benchmark
+    harness (see bench.c), and allows running without a tty.
+
+  SYMBOL: $Q_Terminal_screen
+    For headless Terminals, a row-major array of $i_Terminal_rows times
+    $i_Terminal_cols qchars holding what is currently displayed.
+
+  SYMBOL: $I_Terminal_refreshes
+    For headless Terminals, the number of times the screen has been
+    refreshed (ie, the number of frames which would have been sent to a real
+    terminal).
+
  */
 
 subclass($c_Consumer,$c_Terminal)
@@ -65,8 +91,15 @@ member_of_domain($$d_Terminal, $d_Terminal)
 
 STATIC_INIT_TO($y_Terminal_cursor_visible, true)
 STATIC_INIT_TO($$y_Terminal_cursor_visible, true)
+STATIC_INIT_TO($p_terminals, reg_new())
 
+static void construct_headless(void);
 defun($h_Terminal) {
+  if ($y_Terminal_headless) {
+    construct_headless();
+    return;
+  }
+
   $$p_Terminal_screen = newterm($s_Terminal_type,
                                 $p_Terminal_output, $p_Terminal_input);
   $i_Consumer_fd = fileno((FILE*)$p_Terminal_input);
@@ -85,7 +118,34 @@ defun($h_Terminal) {
   $f_Terminal_enter_raw_mode();
   $$y_Terminal_needs_refresh = false;
 
-  $lo_terminals = cons_o($o_Terminal, $lo_terminals);
+  $p_Terminal_registration = reg_add($p_terminals, $o_Terminal);
+}
+
+static void construct_headless(void) {
+  int pipes[2];
+  if (-1 == pipe(pipes)) {
+    $y_Terminal_ok = false;
+    $f_Consumer_destroy();
+    return;
+  }
+  fcntl(pipes[0], F_SETFL, O_NONBLOCK);
+  fcntl(pipes[1], F_SETFL, O_NONBLOCK);
+
+  // The input queue lives in memory; the pipe only serves to wake the kernel
+  // up when it becomes non-empty.
+  $i_Consumer_fd = pipes[0];
+  $$i_Terminal_wake_fd = pipes[1];
+  $$az_Terminal_input_queue = dynar_new_z();
+  $$I_Terminal_input_head = 0;
+
+  if (!$i_Terminal_rows) $i_Terminal_rows = 24;
+  if (!$i_Terminal_cols) $i_Terminal_cols = 80;
+  $Q_Terminal_screen = qcalloc($i_Terminal_rows * $i_Terminal_cols);
+
+  $y_Terminal_ok = true;
+  $$y_Terminal_needs_refresh = false;
+
+  $p_Terminal_registration = reg_add($p_terminals, $o_Terminal);
 }
 
 /*
@@ -95,6 +155,8 @@ defun($h_Terminal) {
     Soliloquy in one terminal.
  */
 defun($h_Terminal_enter_raw_mode) {
+  if ($y_Terminal_headless) return;
+
   set_term($$p_Terminal_screen);
   raw();
   noecho();
@@ -108,17 +170,24 @@ defun($h_Terminal_enter_raw_mode) {
 /*
   SYMBOL: $h_Terminal_destroy
     Resets the terminal into sane mode, then frees its associated resources and
-    removes it from the terminal list.
+    removes it from the terminal registry.
 */
 defun($h_Terminal_destroy) {
-  set_term($$p_Terminal_screen);
-  endwin();
-  delscreen($$p_Terminal_screen);
-  $lo_terminals = lrm_o($lo_terminals, $o_Terminal);
+  if ($y_Terminal_headless) {
+    reg_remove($p_Terminal_registration);
+    $f_Consumer_destroy();
+    close($i_Consumer_fd);
+    close($$i_Terminal_wake_fd);
+  } else {
+    set_term($$p_Terminal_screen);
+    endwin();
+    delscreen($$p_Terminal_screen);
+    reg_remove($p_Terminal_registration);
 
-  $f_Consumer_destroy();
-  fclose($p_Terminal_input);
-  fclose($p_Terminal_output);
+    $f_Consumer_destroy();
+    fclose($p_Terminal_input);
+    fclose($p_Terminal_output);
+  }
 
   del_hook(&$h_kernel_cycle, HOOK_BEFORE, $u_Terminal_refresh, $o_Terminal);
 }
@@ -138,7 +207,13 @@ defun($h_Terminal_destroy) {
     Called for each character read from the Terminal, within the Terminal's
     context.
 */
+static void read_headless(void);
 defun($h_Terminal_read) {
+  if ($y_Terminal_headless) {
+    read_headless();
+    return;
+  }
+
   set_term($$p_Terminal_screen);
   wint_t wchar;
   int type;
@@ -155,22 +230,53 @@ defun($h_Terminal_read) {
   }
 }
 
+static void read_headless(void) {
+  char wakeups[64];
+  while (0 < read($i_Consumer_fd, wakeups, sizeof(wakeups)));
+
+  while ($$I_Terminal_input_head < $$az_Terminal_input_queue->len) {
+    $x_Terminal_input_value =
+      $$az_Terminal_input_queue->v[$$I_Terminal_input_head++];
+    $f_Terminal_getch();
+  }
+
+  $$az_Terminal_input_queue->len = 0;
+  $$I_Terminal_input_head = 0;
+}
+
+/*
+  SYMBOL: $f_Terminal_feed $w_Terminal_feed
+    Appends the characters in $w_Terminal_feed to the input queue of this
+    headless Terminal. They will be processed as if typed by the user the next
+    time the Terminal is read (ie, by the kernel, or by an explicit call to
+    $m_read()). Has no effect on non-headless Terminals.
+ */
+defun($h_Terminal_feed) {
+  if (!$y_Terminal_headless) return;
+
+  // A full pipe already holds a byte to wake the kernel, which is all that is
+  // needed. Otherwise, the worst case is that the kernel does not notice the
+  // input until it next reads this Terminal anyway.
+  if ($$I_Terminal_input_head == $$az_Terminal_input_queue->len &&
+      -1 == write($$i_Terminal_wake_fd, "", 1) && EAGAIN != errno)
+    perror("write");
+
+  dynar_ins_z($$az_Terminal_input_queue, $$az_Terminal_input_queue->len,
+              $w_Terminal_feed, wcslen($w_Terminal_feed));
+}
+
 advise_after($h_graceful_exit) {
   if ($y_is_handling_signal && !$y_signal_is_synchronous)
     return;
-  void f(object o) {
-    $M_destroy(0, o);
-  }
-  each_o($lo_terminals, f);
+  REG_EACH(curr, $p_terminals)
+    $M_destroy(0, curr->obj);
 }
 
 advise_after($h_die_gracelessly) {
   if ($y_is_handling_signal && !$y_signal_is_synchronous)
     return;
-  void f(object o) {
-    $M_destroy(0, o);
-  }
-  each_o($lo_terminals, f);
+  REG_EACH(curr, $p_terminals)
+    $M_destroy(0, curr->obj);
 }
 
 /*
@@ -198,6 +304,14 @@ advise_after($h_die_gracelessly) {
     Identifies the hook used to refresh the terminal.
  */
 defun($h_Terminal_putch) {
+  if ($y_Terminal_headless) {
+    if ($i_x >= 0 && $i_x < $i_Terminal_cols &&
+        $i_y >= 0 && $i_y < $i_Terminal_rows)
+      $Q_Terminal_screen[$i_y * $i_Terminal_cols + $i_x] = *$q_qch;
+    $f_Terminal_update();
+    return;
+  }
+
   set_term($$p_Terminal_screen);
 
   cchar_t wch;
@@ -239,7 +353,24 @@ defun($h_Terminal_update) {
   }
 }
 
+/*
+  SYMBOL: $f_Terminal_flush
+    Performs any refresh scheduled by $f_Terminal_update() immediately,
+    instead of waiting for the next kernel cycle.
+ */
+defun($h_Terminal_flush) {
+  if ($$y_Terminal_needs_refresh)
+    $$f_Terminal_refresh();
+}
+
 defun($$h_Terminal_refresh) {
+  if ($y_Terminal_headless) {
+    ++$I_Terminal_refreshes;
+    $$y_Terminal_needs_refresh = false;
+    del_hook(&$h_kernel_cycle, HOOK_BEFORE, $u_Terminal_refresh, $o_Terminal);
+    return;
+  }
+
   set_term($$p_Terminal_screen);
   if ($$y_Terminal_cursor_visible != $y_Terminal_cursor_visible) {
     if (ERR == curs_set($y_Terminal_cursor_visible? 1 : 0))
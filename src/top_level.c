@@ -19,6 +19,7 @@
 #include "top_level.slc"
 #include "interactive.h"
 #include "key_dispatch.h"
+#include "registry.h"
 
 /*
   SYMBOL: $c_TopLevel
@@ -35,6 +36,8 @@
  */
 subclass($c_Workspace, $c_TopLevel)
 defun($h_TopLevel) {
+  $mo_TopLevel_editors = hashmap_new_o();
+
   // We need to modify the BufferEditor class to track the BufferEditors local
   // to this TopLevel
   implant($h_BufferEditor);
@@ -50,7 +53,7 @@ defun($h_TopLevel) {
                
   // Activate whatever buffer is first in the list
   $M_activate(0,0,
-              $o_TopLevel_curr_buffer = $lo_buffers->car);
+              $o_TopLevel_curr_buffer = reg_first($p_buffers));
 }
 
 advise_before_superconstructor($h_TopLevel) {
@@ -62,15 +65,14 @@ advise_before_superconstructor($h_TopLevel) {
     Registers $o_BufferEditor into this TopLevel, creating a
     FileBuffer-BufferEditor mapping as necessary.
 
-  SYMBOL: $lo_TopLevel_editors
+  SYMBOL: $mo_TopLevel_editors
     A FileBuffer-BufferEditor mapping of the editors currently known to this
     TopLevel.
  */
 defun($h_TopLevel_register_buffer) {
-  $lo_TopLevel_editors = lmput_o($lo_TopLevel_editors,
-                                 $($o_BufferEditor,
-                                   $o_BufferEditor_buffer),
-                                 $o_BufferEditor);
+  hashmap_put_o($mo_TopLevel_editors,
+                $($o_BufferEditor, $o_BufferEditor_buffer),
+                $o_BufferEditor);
 }
 
 /*
@@ -81,14 +83,15 @@ defun($h_TopLevel_register_buffer) {
  */
 defun($h_TopLevel_deregister_buffer) {
   object buffer = $($o_BufferEditor, $o_BufferEditor_buffer);
-  $lo_TopLevel_editors = lmdel_o($lo_TopLevel_editors, buffer);
+  hashmap_del_o($mo_TopLevel_editors, buffer);
 
   if (buffer == $o_TopLevel_curr_buffer) {
     // There must always be at least one buffer; if one is being closed, we may
     // safely assume that there are currently at least two.
+    registry* buffers = $p_buffers;
+    registry_node* first = reg_next(buffers, &buffers->head);
     $o_TopLevel_curr_buffer =
-      (buffer == $lo_buffers->car?
-       $lo_buffers->cdr->car : $lo_buffers->car);
+      (buffer == first->obj? reg_next($p_buffers, first)->obj : first->obj);
     $M_activate(0, $o_TopLevel);
   }
 }
@@ -105,16 +108,17 @@ defun($h_TopLevel_activate) {
   if ($o_TopLevel_curr_editor)
     $M_suspend(0, $o_TopLevel_curr_editor);
 
-  list_o curr = lmget_o($lo_TopLevel_editors, $o_TopLevel_curr_buffer);
-  if (curr) {
-    $o_TopLevel_curr_editor = curr->car;
+  object* editor = hashmap_get_o($mo_TopLevel_editors,
+                                 $o_TopLevel_curr_buffer);
+  if (editor) {
+    $o_TopLevel_curr_editor = *editor;
     $M_resume(0, $o_TopLevel_curr_editor);
   } else {
     $o_TopLevel_curr_editor =
       $c_BufferEditor($o_BufferEditor_buffer = $o_TopLevel_curr_buffer);
-    $lo_TopLevel_editors = lmput_o($lo_TopLevel_editors,
-                                   $o_TopLevel_curr_buffer,
-                                   $o_TopLevel_curr_editor);
+    hashmap_put_o($mo_TopLevel_editors,
+                  $o_TopLevel_curr_buffer,
+                  $o_TopLevel_curr_editor);
   }
 
   $m_update_echo_area();
@@ -133,14 +137,13 @@ interactive($h_TopLevel_visit_file_i,
             $h_TopLevel_visit_file,
             i_(w, $w_TopLevel_filename, L"Visit File")) {
   // See if there is already such a buffer
-  list_o lexisting =
-    find_where_o(
-      $lo_buffers,
-      lambda((object o),
-             (bool)!wcscmp($w_TopLevel_filename,
-                           $(o, $w_FileBuffer_filename))));
-  $o_TopLevel_curr_buffer =
-    lexisting? lexisting->car : NULL;
+  $o_TopLevel_curr_buffer = NULL;
+  REG_EACH(curr, $p_buffers) {
+    if (!wcscmp($w_TopLevel_filename, $(curr->obj, $w_FileBuffer_filename))) {
+      $o_TopLevel_curr_buffer = curr->obj;
+      break;
+    }
+  }
 
   if (!$o_TopLevel_curr_buffer) {
     $o_TopLevel_curr_buffer =
@@ -18,6 +18,8 @@
 */
 #include "transcript.slc"
 #include "face.h"
+#include "bench.h"
+#include "chunked_lines.h"
 
 /*
   TITLE: Transcript Workspace Backing
@@ -64,7 +66,7 @@ STATIC_INIT_TO($i_Transcript_truncation_amt, 1024)
     is unused afterward.
 
   SYMBOL: $ai_Transcript_line_refs
-    An array of indices into $ao_Backing_lines which must be maintained. These
+    An array of indices into $p_Backing_lines which must be maintained. These
     are used to maintain references into the lines array, even in the presence
     of structural changes to the array. Entries which are -1 indicate deleted
     references. The zeroth element should never be -1.
@@ -100,7 +102,7 @@ defun($h_Transcript) {
 defun($h_Transcript_append) {
   $M_alter(0,0,
            $i_Backing_alteration_begin =
-             $ao_Backing_lines->len,
+             cl_len($p_Backing_lines),
            $i_Backing_ndeletions = 0,
            $lo_Backing_replacements =
              $lo_Transcript_output);
@@ -124,14 +126,42 @@ STATIC_INIT_TO($I_Transcript_even_group_meta_highlight_face,
                mkface("+bL"))
 STATIC_INIT_TO($I_Transcript_odd_group_meta_highlight_face,
                mkface("!fL"));
+
 /*
-  SYMBOL: $f_Transcript_group
-    Like $f_Transcript_append, but handles the text as a group. Highlighting
-    will be applied to the metadata (by cloning the RenderedLines before
-    appending), and a reference to the group added to
-    $ai_Transcript_output_groups.
+  SYMBOL: $f_Transcript_append_bodies
+    Appends one line to the end of the transcript for each element of
+    $aq_Transcript_bodies, all of which share $q_Transcript_meta as their
+    metadata. The lines do not form an output group. The RenderedLines are
+    pushed directly onto the end of $p_Backing_lines, so no
+    intermediate list is built. $aq_Transcript_bodies will be NULLed after
+    this call.
+
+  SYMBOL: $aq_Transcript_bodies
+    The bodies of the lines to append in a call to $f_Transcript_append_bodies
+    or $f_Transcript_group_bodies.
+
+  SYMBOL: $q_Transcript_meta
+    The metadata shared by every line appended by $f_Transcript_append_bodies
+    or $f_Transcript_group_bodies. May be NULL.
  */
-defun($h_Transcript_group) {
+defun($h_Transcript_append_bodies) {
+  dynar_q bodies = $aq_Transcript_bodies;
+  qstring meta = $q_Transcript_meta;
+  $aq_Transcript_bodies = NULL;
+
+  for (unsigned i = 0; i < bodies->len; ++i)
+    cl_push($p_Backing_lines,
+            $c_RenderedLine($q_RenderedLine_body = bodies->v[i],
+                            $q_RenderedLine_meta = meta));
+
+  $M_alter(0,0, $I_Backing_nappended_in_place = bodies->len);
+  $m_check_size();
+}
+
+/* Returns the face with which to highlight the next output group, advancing
+ * $y_Transcript_next_group_colour.
+ */
+static face next_group_face(void) {
   face group_face;
   if ($y_Transcript_next_group_colour) {
     group_face = $I_Transcript_even_group_meta_highlight_face;
@@ -139,30 +169,96 @@ defun($h_Transcript_group) {
     group_face = $I_Transcript_odd_group_meta_highlight_face;
   }
   $y_Transcript_next_group_colour = !$y_Transcript_next_group_colour;
+  return group_face;
+}
 
-  // Apply face to all metadata
-  $lo_Transcript_output =
-    map_o($lo_Transcript_output,
-          lambda((object o), ({
-                mqstring new_meta = qcalloc($i_line_meta_width+1);
-                qmemcpy(new_meta, $(o, $q_RenderedLine_meta), $i_line_meta_width);
-                apply_face_arr(group_face, new_meta, $i_line_meta_width);
-                $c_RenderedLine($q_RenderedLine_body =
-                                   $(o, $q_RenderedLine_body),
-                                 $q_RenderedLine_meta = new_meta);
-              })));
-
-  // Add this group to the group array
-  int begin = $ao_Backing_lines->len;
-  int len = llen_o($lo_Transcript_output);
+/* Returns a copy of the given line metadata (which may be NULL) with the given
+ * group face applied.
+ */
+static qstring highlight_meta(face group_face, qstring meta) {
+  mqstring new_meta = qcalloc($i_line_meta_width+1);
+  if (meta)
+    qmemcpy(new_meta, meta, $i_line_meta_width);
+  apply_face_arr(group_face, new_meta, $i_line_meta_width);
+  return new_meta;
+}
+
+/* Adds an output group of the given length, starting at the current end of the
+ * Transcript, to the front of $ai_Transcript_output_groups.
+ */
+static void add_output_group(int len) {
   memmove($ai_Transcript_output_groups->v+2,
           $ai_Transcript_output_groups->v+0,
           sizeof(int)*($ai_Transcript_output_groups->len-2));
-  $ai_Transcript_output_groups->v[0] = begin;
+  $ai_Transcript_output_groups->v[0] = cl_len($p_Backing_lines);
   $ai_Transcript_output_groups->v[1] = len;
+}
+
+/*
+  SYMBOL: $f_Transcript_group
+    Like $f_Transcript_append, but handles the text as a group. Highlighting
+    will be applied to the metadata (by cloning the RenderedLines as they are
+    appended), and a reference to the group added to
+    $ai_Transcript_output_groups.
+ */
+defun($h_Transcript_group) {
+  unsigned len = llen_o($lo_Transcript_output);
+  face group_face = next_group_face();
+
+  add_output_group(len);
+
+  // Clone the lines straight into the Backing, applying the face to all
+  // metadata
+  for (list_o curr = $lo_Transcript_output; curr; curr = curr->cdr) {
+    qstring new_meta = highlight_meta(group_face,
+                                      $(curr->car, $q_RenderedLine_meta));
+    cl_push($p_Backing_lines,
+            $c_RenderedLine($q_RenderedLine_body =
+                              $(curr->car, $q_RenderedLine_body),
+                            $q_RenderedLine_meta = new_meta));
+  }
+  $lo_Transcript_output = NULL;
+
+  $M_alter(0,0, $I_Backing_nappended_in_place = len);
+  $m_check_size();
+}
 
-  // Append the actual text
-  $M_append(0,0);
+/*
+  SYMBOL: $f_Transcript_group_bodies
+    Like $f_Transcript_append_bodies, but the lines form an output group, as
+    with $f_Transcript_group. The group highlighting is applied to
+    $q_Transcript_meta only once, and the result shared by every line.
+ */
+defun($h_Transcript_group_bodies) {
+  add_output_group($aq_Transcript_bodies->len);
+  $M_append_bodies(0,0,
+                   $q_Transcript_meta =
+                     highlight_meta(next_group_face(),
+                                    $q_Transcript_meta));
+}
+
+defbench(transcript_group, "Append 256-line output groups to a transcript") {
+  dynar_q bodies = dynar_new_q();
+  for (unsigned i = 0; i < 256; ++i) {
+    wchar_t text[64];
+    swprintf(text, lenof(text), L"Output line %u, with some text", i);
+    dynar_push_q(bodies, wstrtoqstr(text));
+  }
+
+  object workspace = bench_workspace();
+  mqstring meta = qcalloc($i_line_meta_width+1);
+  for (unsigned i = 0; i < (unsigned)$i_line_meta_width; ++i)
+    meta[i] = L'-';
+
+  bench_start();
+  for (unsigned i = 0; i < iterations; ++i) {
+    $$(workspace) {
+      $M_group_bodies(0, $o_Workspace_backing,
+                      $aq_Transcript_bodies = bodies,
+                      $q_Transcript_meta = meta);
+    }
+    bench_keys(L"");
+  }
 }
 
 /*
@@ -182,7 +278,7 @@ defun($h_Transcript_add_ref_line) {
   $i_Transcript_line_ref =
     $i_Transcript_line_ref_offset +
       $ai_Transcript_line_refs->len;
-  dynar_push_i($ai_Transcript_line_refs, $ao_Backing_lines->len);
+  dynar_push_i($ai_Transcript_line_refs, cl_len($p_Backing_lines));
   $M_append(0,0,
             $lo_Transcript_output =
               cons_o($o_Transcript_ref_line, NULL));
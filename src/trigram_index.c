@@ -0,0 +1,144 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "trigram_index.slc"
+
+#include "trigram_index.h"
+
+/*
+  TITLE: Trigram Line Index
+  OVERVIEW: Maintains a compact signature of the trigrams (sequences of three
+    consecutive characters) in each line of a text, so that searches for
+    literal strings can skip lines which cannot possibly match without
+    examining their text.
+
+    Each line is summarised by a 128-bit set, with one bit per trigram hash.
+    Because the signatures are stored positionally, inserting or removing
+    lines only requires moving the signatures the same way the lines
+    themselves are moved, so the index can be kept current incrementally as
+    the text is edited.
+*/
+
+#define TGI_BITS (8*sizeof(((tgi_query*)0)->bits))
+
+struct trigram_index {
+  tgi_query* sigs;
+  unsigned len, size;
+};
+
+static inline unsigned trigram_bit(wchar_t a, wchar_t b, wchar_t c) {
+  unsigned h = (unsigned)a;
+  h = h * 0x9E3779B1u + (unsigned)b;
+  h = h * 0x9E3779B1u + (unsigned)c;
+  return (h * 0x9E3779B1u) >> 25;
+}
+
+static void signature_of(tgi_query* dst, wstring str) {
+  dst->bits[0] = dst->bits[1] = 0;
+  tgi_query_add(dst, str);
+}
+
+void tgi_query_add(tgi_query* dst, wstring str) {
+  if (!str[0] || !str[1]) return;
+
+  for (; str[2]; ++str) {
+    unsigned bit = trigram_bit(str[0], str[1], str[2]);
+    dst->bits[bit / 64] |= 1ULL << (bit % 64);
+  }
+}
+
+/* Ensures there is space for at least cnt more signatures. The signatures
+ * contain no pointers, so they are allocated atomically to keep the collector
+ * from scanning them.
+ */
+static void reserve(trigram_index* this, unsigned cnt) {
+  if (this->len + cnt <= this->size) return;
+
+  unsigned size = this->size? this->size : 64;
+  while (size < this->len + cnt)
+    size *= 2;
+
+  tgi_query* sigs = gcalloc_atomic(size * sizeof(tgi_query));
+
+  if (this->sigs)
+    memcpy(sigs, this->sigs, this->len * sizeof(tgi_query));
+
+  this->sigs = sigs;
+  this->size = size;
+}
+
+trigram_index* tgi_new(const wstring* lines, unsigned cnt) {
+  trigram_index* this = new(trigram_index);
+  tgi_insert(this, 0, lines, cnt);
+  return this;
+}
+
+void tgi_replace(trigram_index* this, unsigned line, wstring str) {
+  signature_of(this->sigs + line, str);
+}
+
+void tgi_insert(trigram_index* this, unsigned line,
+                const wstring* lines, unsigned cnt) {
+  reserve(this, cnt);
+  memmove(this->sigs + line + cnt, this->sigs + line,
+          (this->len - line) * sizeof(tgi_query));
+  for (unsigned i = 0; i < cnt; ++i)
+    signature_of(this->sigs + line + i, lines[i]);
+
+  this->len += cnt;
+}
+
+void tgi_erase(trigram_index* this, unsigned line, unsigned cnt) {
+  memmove(this->sigs + line, this->sigs + line + cnt,
+          (this->len - line - cnt) * sizeof(tgi_query));
+  this->len -= cnt;
+}
+
+bool tgi_may_match(const trigram_index* this, unsigned line,
+                   const tgi_query* query) {
+  const tgi_query* sig = this->sigs + line;
+  return
+    (sig->bits[0] & query->bits[0]) == query->bits[0] &&
+    (sig->bits[1] & query->bits[1]) == query->bits[1];
+}
+
+deftest(trigram_index_narrows_candidates) {
+  wstring lines[] = { L"foo bar", L"baz", L"xyzzy plugh" };
+  trigram_index* ix = tgi_new(lines, lenof(lines));
+  tgi_query query = {{0}};
+
+  // Empty query admits everything
+  assert(tgi_may_match(ix, 0, &query));
+  assert(tgi_may_match(ix, 1, &query));
+
+  tgi_query_add(&query, L"xyzzy");
+  assert(tgi_may_match(ix, 2, &query));
+  assert(!tgi_may_match(ix, 1, &query));
+
+  wstring more[] = { L"a xyzzy" };
+  tgi_insert(ix, 1, more, 1);
+  assert(tgi_may_match(ix, 1, &query));
+  assert(tgi_may_match(ix, 3, &query));
+
+  tgi_erase(ix, 0, 2);
+  assert(!tgi_may_match(ix, 0, &query));
+  assert(tgi_may_match(ix, 1, &query));
+
+  tgi_replace(ix, 1, L"nothing");
+  assert(!tgi_may_match(ix, 1, &query));
+}
@@ -0,0 +1,77 @@
+/*
+  Copyright ⓒ 2013 Jason Lingle
+
+  This file is part of Soliloquy.
+
+  Soliloquy is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Soliloquy is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Soliloquy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef TRIGRAM_INDEX_H_
+#define TRIGRAM_INDEX_H_
+
+/**
+ * Opaque type representing a per-line trigram index over an array of
+ * wstrings. Instances are allocated on the heap with the GC.
+ *
+ * The index stores a small signature of the trigrams present in each line,
+ * which can say with certainty that a line does NOT contain some set of
+ * literal strings. It never produces false negatives, so any line it admits
+ * must still be tested properly.
+ */
+typedef struct trigram_index trigram_index;
+
+/**
+ * A set of trigrams to look for within a trigram_index. A zero-initialised
+ * tgi_query is empty, and admits every line.
+ */
+typedef struct tgi_query {
+  unsigned long long bits[2];
+} tgi_query;
+
+/**
+ * Builds a new trigram_index over the given cnt lines.
+ */
+trigram_index* tgi_new(const wstring* lines, unsigned cnt);
+
+/**
+ * Updates the index to reflect that the line at the given index now has the
+ * given contents.
+ */
+void tgi_replace(trigram_index*, unsigned line, wstring);
+
+/**
+ * Updates the index to reflect that cnt lines were inserted before the given
+ * line index.
+ */
+void tgi_insert(trigram_index*, unsigned line,
+                const wstring* lines, unsigned cnt);
+
+/**
+ * Updates the index to reflect that cnt lines starting at the given line
+ * index were removed.
+ */
+void tgi_erase(trigram_index*, unsigned line, unsigned cnt);
+
+/**
+ * Adds every trigram within the given literal string to the query. Literals
+ * shorter than three characters place no constraint on the query.
+ */
+void tgi_query_add(tgi_query*, wstring literal);
+
+/**
+ * Returns whether the given line could possibly contain every literal that
+ * has been added to the query.
+ */
+bool tgi_may_match(const trigram_index*, unsigned line, const tgi_query*);
+
+#endif /* TRIGRAM_INDEX_H_ */
@@ -19,6 +19,9 @@
 #include "tty_consumer.slc"
 #include <limits.h>
 #include <unistd.h>
+#include <fcntl.h>
+
+#include "../bench.h"
 
 /*
   TITLE: TTY Emulation Consumer
@@ -117,3 +120,42 @@ defun($h_TtyConsumer_destroy) {
   $M_release(0, $o_TtyConsumer_emulator);
   $f_Consumer_destroy();
 }
+
+defbench(process_output, "Ingest 4KiB of process output into a transcript") {
+  static char chunk[4096];
+  for (unsigned i = 0; i < sizeof(chunk); ++i)
+    chunk[i] = (i % 64 == 63? '\n' : 'a' + i % 26);
+
+  object workspace = bench_workspace();
+  int pipes[2];
+  if (pipe(pipes)) {
+    perror("pipe");
+    return;
+  }
+  fcntl(pipes[0], F_SETFL, O_NONBLOCK);
+
+  object consumer;
+  $$(workspace) {
+    consumer = $c_TtyConsumer(
+      $o_TtyConsumer_emulator =
+      $c_TranscriptTty($i_Consumer_fd = pipes[0],
+                       $o_TranscriptTty_transcript = $o_Workspace_backing,
+                       $q_RenderedLine_meta = wstrtoqstr(L"bench"),
+                       $I_TtyEmulator_ninputs = 1));
+  }
+
+  bench_start();
+  for (unsigned i = 0; i < iterations; ++i) {
+    if ((ssize_t)sizeof(chunk) != write(pipes[1], chunk, sizeof(chunk))) {
+      perror("write");
+      break;
+    }
+    $M_read(0, consumer);
+    bench_keys(L"");
+  }
+  bench_stop();
+
+  close(pipes[1]);
+  $M_destroy(0, consumer);
+  close(pipes[0]);
+}
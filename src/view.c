@@ -23,6 +23,8 @@
 #include "key_dispatch.h"
 #include "face.h"
 #include "interactive.h"
+#include "bench.h"
+#include "chunked_lines.h"
 
 /*
   TITLE: Terminal/Workspace View Management
@@ -51,8 +53,9 @@
   SYMBOL: $o_View_terminal
     The terminal this View is bound to.
 
-  SYMBOL: $lo_Terminal_views
-    A listmap of all Views bound to the Terminal, keyed by Workspace.
+  SYMBOL: $mo_Terminal_views
+    A map of all Views bound to the Terminal, keyed by Workspace. Created by
+    the first View bound to the Terminal.
 
   SYMBOL: $lo_Workspace_views
     A list of all Views bound to the Workspace.
@@ -69,8 +72,9 @@
     The currently-active view of the Terminal.
  */
 defun($h_View) {
-  $i_View_cut_in_workspace = $($($o_View_workspace, $o_Workspace_backing),
-                               $ao_Backing_lines)->len;
+  $i_View_cut_in_workspace = cl_len($($($o_View_workspace,
+                                        $o_Workspace_backing),
+                                      $p_Backing_lines));
   $o_View_terminal = $o_Terminal;
   $$($($o_View_workspace,$o_Workspace_backing)) {
     add_hook_obj(&$h_Backing_alter, HOOK_AFTER,
@@ -91,7 +95,9 @@ defun($h_View) {
       cons_o($o_View, $lo_Workspace_views);
   }
 
-  $lo_Terminal_views = lmput_o($lo_Terminal_views, $o_View_workspace, $o_View);
+  if (!$mo_Terminal_views)
+    $mo_Terminal_views = hashmap_new_o();
+  hashmap_put_o($mo_Terminal_views, $o_View_workspace, $o_View);
 
   $i_View_cols = $i_Terminal_cols / ($i_column_width + $i_line_meta_width);
   if ($i_View_cols == 0) $i_View_cols = 1;
@@ -123,8 +129,8 @@ defun($h_View_destroy) {
     $lo_Workspace_views = lrm_o($lo_Workspace_views, $o_View);
   }
 
+  hashmap_del_o($($o_View_terminal, $mo_Terminal_views), $o_View_workspace);
   $o_View_workspace = NULL;
-  $lo_Terminal_views = lmdel_o($lo_Terminal_views, $o_View_workspace);
 }
 
 /*
@@ -163,16 +169,18 @@ defun($h_View_backing_changed) {
   // If this was an append and we were at the end, move cut forward
   if ($y_Backing_alteration_was_append &&
       $i_View_cut_in_workspace == $i_Backing_alteration_begin) {
-    $i_View_cut_on_screen += $ao_Backing_lines->len - $i_View_cut_in_workspace;
+    $i_View_cut_on_screen +=
+      cl_len($p_Backing_lines) - $i_View_cut_in_workspace;
     $i_View_cut_on_screen %= $i_View_rows;
-    $i_View_cut_in_workspace = $ao_Backing_lines->len;
+    $i_View_cut_in_workspace = cl_len($p_Backing_lines);
   }
   //If the change leaves cut outside the workspace, move it back
-  if ($i_View_cut_in_workspace > $ao_Backing_lines->len) {
-    $i_View_cut_on_screen -= $i_View_cut_in_workspace - $ao_Backing_lines->len;
+  if ($i_View_cut_in_workspace > cl_len($p_Backing_lines)) {
+    $i_View_cut_on_screen -=
+      $i_View_cut_in_workspace - cl_len($p_Backing_lines);
     while ($i_View_cut_on_screen < 0)
       $i_View_cut_on_screen += $i_View_rows;
-    $i_View_cut_in_workspace = $ao_Backing_lines->len;
+    $i_View_cut_in_workspace = cl_len($p_Backing_lines);
   }
 
   for ($i_View_line_to_paint = $i_Backing_alteration_begin;
@@ -224,8 +232,8 @@ defun($h_View_paint_line) {
   object oline = NULL;
   $$($($o_View_workspace, $o_Workspace_backing)) {
     if ($i_View_line_to_paint >= 0 &&
-        $i_View_line_to_paint < $ao_Backing_lines->len)
-      oline = $ao_Backing_lines->v[$i_View_line_to_paint];
+        $i_View_line_to_paint < cl_len($p_Backing_lines))
+      oline = cl_at($p_Backing_lines, $i_View_line_to_paint);
   }
 
   if (oline) {
@@ -265,9 +273,9 @@ defun($h_View_scroll) {
   int old = $i_View_cut_in_workspace;
   $i_View_cut_in_workspace += $i_View_scroll;
 
-  unsigned end = $($($o_View_workspace,
-                     $o_Workspace_backing),
-                   $ao_Backing_lines)->len;
+  unsigned end = cl_len($($($o_View_workspace,
+                            $o_Workspace_backing),
+                          $p_Backing_lines));
 
   if ($i_View_cut_in_workspace < $i_View_rows)
     $i_View_cut_in_workspace = $i_View_rows;
@@ -311,8 +319,8 @@ defun($h_View_home) {
     Moves the scroll of this View to the end.
  */
 defun($h_View_end) {
-  unsigned end = $($($o_View_workspace, $o_Workspace_backing),
-                   $ao_Backing_lines)->len;
+  unsigned end = cl_len($($($o_View_workspace, $o_Workspace_backing),
+                          $p_Backing_lines));
   $M_scroll(0,0, $i_View_scroll = end - $i_View_cut_in_workspace);
 }
 
@@ -357,3 +365,43 @@ ATSINIT {
   bind_kp($lp_View_keymap, $u_ground, KEY_SR, NULL,
           $m_scroll_up);
 }
+
+static object bench_transcript_workspace(unsigned lines) {
+  object workspace = bench_workspace();
+  dynar_q bodies = dynar_new_q();
+  for (unsigned i = 0; i < lines; ++i) {
+    wchar_t text[64];
+    swprintf(text, lenof(text), L"Transcript line %u, with some text", i);
+    dynar_push_q(bodies, wstrtoqstr(text));
+  }
+
+  $$(workspace) {
+    $M_append_bodies(0, $o_Workspace_backing,
+                     $aq_Transcript_bodies = bodies,
+                     $q_Transcript_meta = NULL);
+  }
+  bench_keys(L"");
+  return workspace;
+}
+
+defbench(scroll, "Page up and down through a 5000-line transcript") {
+  bench_transcript_workspace(5000);
+
+  bench_start();
+  for (unsigned i = 0; i < iterations; ++i)
+    bench_keys((i / 64) & 1? L"\033r" : L"\033e");
+}
+
+defbench(redraw, "Redraw a View of a full transcript") {
+  bench_transcript_workspace(1000);
+  object view = $($o_bench_terminal, $o_Terminal_current_view);
+
+  bench_start();
+  for (unsigned i = 0; i < iterations; ++i) {
+    $$($o_bench_terminal) {
+      $M_redraw(0, view);
+    }
+    $M_flush(0, $o_bench_terminal);
+    arena_reset();
+  }
+}
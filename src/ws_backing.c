@@ -18,6 +18,8 @@
 */
 #include "ws_backing.slc"
 
+#include "chunked_lines.h"
+
 /*
   TITLE: Workspace Backing Object
   OVERVIEW: A Workspace Backing stores an array of RenderedLines, and supports
@@ -27,16 +29,17 @@
 /*
   SYMBOL: $c_Backing
     A Workspace Backing object. The base class by itself does not do much of
-    interest, other than manage $ao_Backing_lines.
+    interest, other than manage $p_Backing_lines.
 
-  SYMBOL: $ao_Backing_lines
-    The array of RenderedLines stored in this Backing. Third parties,
-    including subclasses, should consider this read-only; the Backing
-    manipulation functions should be used with $f_Backing_alter.
+  SYMBOL: $p_Backing_lines
+    The chunked_lines holding the RenderedLines stored in this Backing. Third
+    parties, including subclasses, should consider this read-only (other than
+    as described for $I_Backing_nappended_in_place); the Backing manipulation
+    functions should be used with $f_Backing_alter.
 */
 
 defun($h_Backing) {
-  $ao_Backing_lines = dynar_new_o();
+  $p_Backing_lines = cl_new();
 }
 
 /*
@@ -68,14 +71,46 @@ defun($h_Backing) {
   SYMBOL: $lo_Backing_replacements
     The lines to insert when calling $f_Backing_alter. This is destroyed during
     that call.
+
+  SYMBOL: $I_Backing_nappended_in_place
+    If non-zero when $f_Backing_alter is called, the alteration is instead the
+    append of this many lines, which the caller has already pushed directly
+    onto $p_Backing_lines with cl_push(). $i_Backing_alteration_begin,
+    $i_Backing_ndeletions, and $lo_Backing_replacements are ignored and set
+    appropriately for the notification of the append. This is reset to 0 by
+    that call.
  */
+static void check_not_transient(object line) {
+  // Lines stored in a Backing outlive the current kernel cycle, so they must
+  // not refer to the transient arena. (Short-lived RenderedLines, such as the
+  // one BufferLineEditor builds for the echo area, may.)
+  assert(!arena_owns($(line, $q_RenderedLine_body)));
+  assert(!arena_owns($(line, $q_RenderedLine_meta)));
+}
+
 defun($h_Backing_alter) {
+  chunked_lines* lines = $p_Backing_lines;
   $y_Backing_alteration_was_append = true;
 
+  if ($I_Backing_nappended_in_place) {
+    $i_Backing_alteration_begin =
+      cl_len(lines) - $I_Backing_nappended_in_place;
+    $I_Backing_nappended_in_place = 0;
+    $i_Backing_ndeletions = 0;
+    $lo_Backing_replacements = NULL;
+
+    for (unsigned i = $i_Backing_alteration_begin; i < cl_len(lines); ++i)
+      check_not_transient(cl_at(lines, i));
+    return;
+  }
+
+  for (list_o curr = $lo_Backing_replacements; curr; curr = curr->cdr)
+    check_not_transient(curr->car);
+
   //First, in-place replacements
   unsigned ix = $i_Backing_alteration_begin;
   while ($lo_Backing_replacements && $i_Backing_ndeletions) {
-    $ao_Backing_lines->v[ix++] = $lo_Backing_replacements->car;
+    *cl_slot(lines, ix++) = $lo_Backing_replacements->car;
     $lo_Backing_replacements = $lo_Backing_replacements->cdr;
     --$i_Backing_ndeletions;
 
@@ -84,33 +119,13 @@ defun($h_Backing_alter) {
 
   //Trailing deletes
   if ($i_Backing_ndeletions) {
-    memmove($ao_Backing_lines->v + ix,
-            $ao_Backing_lines->v + ix + $i_Backing_ndeletions,
-            sizeof(object) *
-              ($ao_Backing_lines->len - ix - $i_Backing_ndeletions));
-    dynar_contract_by_o($ao_Backing_lines, $i_Backing_ndeletions);
+    cl_delete(lines, ix, $i_Backing_ndeletions);
     $y_Backing_alteration_was_append = false;
   } else if ($lo_Backing_replacements) {
     //Insertions
-    size_t cnt = llen_o($lo_Backing_replacements);
-    dynar_expand_by_o($ao_Backing_lines, cnt);
-    //Handle the case of appending specially, since it's quite common and much
-    //faster.
-    if (ix+cnt == $ao_Backing_lines->len) {
-      while ($lo_Backing_replacements) {
-        $ao_Backing_lines->v[ix++] = $lo_Backing_replacements->car;
-        $lo_Backing_replacements = $lo_Backing_replacements->cdr;
-      }
-    } else {
-      //Middle-of-array insertions
+    if (ix != cl_len(lines))
       $y_Backing_alteration_was_append = false;
-      memmove($ao_Backing_lines->v + ix + cnt,
-              $ao_Backing_lines->v + ix,
-              ($ao_Backing_lines->len - ix - cnt)*sizeof(object));
-      while ($lo_Backing_replacements) {
-        $ao_Backing_lines->v[ix++] = $lo_Backing_replacements->car;
-        $lo_Backing_replacements = $lo_Backing_replacements->cdr;
-      }
-    }
+    cl_insert(lines, ix, $lo_Backing_replacements);
+    $lo_Backing_replacements = NULL;
   }
 }